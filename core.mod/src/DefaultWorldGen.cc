@@ -369,21 +369,26 @@ void DefaultWorldGen::genChunk(Swan::WorldPlane &plane, Swan::Chunk &chunk)
 	// Process biome
 	biome.postProcess(area, wg_);
 
-	for (int cy = 0; cy < Swan::CHUNK_HEIGHT; ++cy) {
-		// Copy over tiles
-		Swan::Tile::ID *crow = &chunk.getTileData()[cy * Swan::CHUNK_WIDTH];
-		Swan::Tile::ID *arow = &buffer[(cy + GEN_PADDING) * GEN_WIDTH];
-		memcpy(
-			crow, &arow[GEN_PADDING],
-			Swan::CHUNK_WIDTH * sizeof(Swan::Tile::ID));
-
-		// Copy over background tiles
-		crow = &chunk.getBackgroundTileData()[cy * Swan::CHUNK_WIDTH];
-		arow = &backgroundBuffer[(cy + GEN_PADDING) * GEN_WIDTH];
-		memcpy(
-			crow, &arow[GEN_PADDING],
-			Swan::CHUNK_WIDTH * sizeof(Swan::Tile::ID));
-	}
+	auto copyRows = [&](
+		std::span<Swan::Tile::ID> dest, const Swan::Tile::ID *src
+	) {
+		for (int cy = 0; cy < Swan::CHUNK_HEIGHT; ++cy) {
+			const Swan::Tile::ID *arow = &src[(cy + GEN_PADDING) * GEN_WIDTH];
+			memcpy(
+				&dest[cy * Swan::CHUNK_WIDTH], &arow[GEN_PADDING],
+				Swan::CHUNK_WIDTH * sizeof(Swan::Tile::ID));
+		}
+	};
+
+	// Copy over tiles
+	chunk.writeTiles([&](std::span<Swan::Tile::ID> tiles) {
+		copyRows(tiles, buffer);
+	});
+
+	// Copy over background tiles
+	chunk.writeBackgroundTiles([&](std::span<Swan::Tile::ID> tiles) {
+		copyRows(tiles, backgroundBuffer);
+	});
 }
 
 Swan::EntityRef DefaultWorldGen::spawnPlayer(Swan::Ctx &ctx)
@@ -30,6 +30,7 @@ public:
 		Swan::Ctx &ctx, Cygnet::Renderer &rnd, Swan::Vec2 pos) override;
 	Cygnet::Color backgroundColor(Swan::Vec2 pos) override;
 	void genChunk(Swan::WorldPlane &plane, Swan::Chunk &chunk) override;
+	bool canRegenerate() override { return true; }
 	Swan::EntityRef spawnPlayer(Swan::Ctx &ctx) override;
 	float getAirTemperature(Swan::TilePos pos) override;
 	void update(Swan::Ctx &ctx, float dt) override;
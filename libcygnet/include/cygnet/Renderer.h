@@ -425,7 +425,7 @@ public:
 
 	static constexpr size_t CHUNK_SIZE = Swan::CHUNK_WIDTH * Swan::CHUNK_HEIGHT;
 	RenderChunk createChunk(
-		TileID tiles[CHUNK_SIZE], TileID backgroundTiles[CHUNK_SIZE]);
+		const TileID tiles[CHUNK_SIZE], const TileID backgroundTiles[CHUNK_SIZE]);
 	void modifyChunk(RenderChunk chunk, Swan::Vec2i pos, TileID id);
 	void modifyChunkBackground(RenderChunk chunk, Swan::Vec2i pos, TileID id);
 	void destroyChunk(RenderChunk chunk);
@@ -437,6 +437,11 @@ public:
 	void modifyChunkFluid(
 		RenderChunkFluid fluid,
 		uint8_t data[FLUID_CHUNK_SIZE]);
+
+	// Upload 'count' rows of fluid cells, starting at row 'first'.
+	// 'data' points at the first of those rows.
+	void modifyChunkFluidRows(
+		RenderChunkFluid fluid, const uint8_t *data, int first, int count);
 	void destroyChunkFluid(RenderChunkFluid fluid);
 
 	RenderChunkShadow createChunkShadow(
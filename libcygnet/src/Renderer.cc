@@ -602,7 +602,7 @@ void Renderer::modifyTile(TileID id, uint16_t newAssetID)
 }
 
 RenderChunk Renderer::createChunk(
-	TileID tiles[CHUNK_SIZE], TileID backgroundTiles[CHUNK_SIZE])
+	const TileID tiles[CHUNK_SIZE], const TileID backgroundTiles[CHUNK_SIZE])
 {
 	RenderChunk chunk;
 
@@ -725,6 +725,21 @@ void Renderer::modifyChunkFluid(
 	glCheck();
 }
 
+void Renderer::modifyChunkFluidRows(
+	RenderChunkFluid fluid, const uint8_t *data, int first, int count)
+{
+	assert(fluid.tex != ~(GLuint)0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, fluid.tex);
+
+	glTexSubImage2D(
+		GL_TEXTURE_2D, 0, 0, first,
+		Swan::CHUNK_WIDTH * Swan::FLUID_RESOLUTION, count,
+		GL_RED_INTEGER, GL_UNSIGNED_BYTE, data);
+	glCheck();
+}
+
 void Renderer::destroyChunkFluid(RenderChunkFluid fluid)
 {
 	assert(fluid.tex != ~(GLuint)0);
@@ -888,13 +903,14 @@ void Renderer::uploadTileAtlas(const void *, int, int) {}
 void Renderer::uploadTileMap(std::span<uint16_t>) {}
 void Renderer::modifyTile(TileID, uint16_t) {}
 
-RenderChunk Renderer::createChunk(TileID *, TileID *) { return {}; }
+RenderChunk Renderer::createChunk(const TileID *, const TileID *) { return {}; }
 void Renderer::modifyChunk(RenderChunk, Swan::Vec2i, TileID) {}
 void Renderer::modifyChunkBackground(RenderChunk, Swan::Vec2i, TileID) {}
 void Renderer::destroyChunk(RenderChunk) {}
 
 RenderChunkFluid Renderer::createChunkFluid(uint8_t *) { return {}; }
 void Renderer::modifyChunkFluid(RenderChunkFluid, uint8_t *) {}
+void Renderer::modifyChunkFluidRows(RenderChunkFluid, const uint8_t *, int, int) {}
 void Renderer::destroyChunkFluid(RenderChunkFluid) {}
 
 RenderChunkShadow Renderer::createChunkShadow(uint8_t *) { return {}; }
@@ -0,0 +1,139 @@
+// Compares plain RLE against RLE followed by gzip at different levels,
+// on synthetic chunks which look roughly like generated terrain:
+// air on top, dirt and stone below with some ores and caves,
+// and some water sitting in the caves.
+
+#include "rle.h"
+#include "gzip.h"
+#include "lib/bench.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include <swan/constants.h>
+
+using namespace Swan;
+using namespace benchlib;
+
+static constexpr int FLUID_WIDTH = CHUNK_WIDTH * FLUID_RESOLUTION;
+static constexpr int FLUID_HEIGHT = CHUNK_HEIGHT * FLUID_RESOLUTION;
+static constexpr int CHUNK_COUNT = 64;
+
+struct ChunkLayers {
+	std::vector<uint16_t> tiles;
+	std::vector<uint16_t> background;
+	std::vector<uint8_t> fluid;
+};
+
+static ChunkLayers makeChunk(uint32_t seed)
+{
+	constexpr uint8_t WATER_FLUID = 3;
+
+	ChunkLayers c;
+	c.tiles.resize(CHUNK_WIDTH * CHUNK_HEIGHT);
+	c.background.resize(CHUNK_WIDTH * CHUNK_HEIGHT);
+	c.fluid.resize(FLUID_WIDTH * FLUID_HEIGHT);
+
+	uint32_t rng = seed * 7919 + 1;
+	int surface = 10 + nextRandom(rng) % 20;
+	int caveX = nextRandom(rng) % CHUNK_WIDTH;
+	int caveY = surface + 10 + nextRandom(rng) % 20;
+	int caveR = 4 + nextRandom(rng) % 6;
+	fillTerrain(c.tiles, c.background, surface, rng);
+
+	for (int y = 0; y < CHUNK_HEIGHT; ++y) {
+		for (int x = 0; x < CHUNK_WIDTH; ++x) {
+			uint16_t &fg = c.tiles[y * CHUNK_WIDTH + x];
+			int dx = x - caveX, dy = y - caveY;
+			bool inCave = dx * dx + dy * dy < caveR * caveR;
+			if (inCave) {
+				fg = AIR;
+			}
+
+			// Solid tiles are solid fluid cells,
+			// the bottom half of the cave is full of water
+			uint8_t fluid = fg == AIR ? 0 : 1;
+			if (inCave && dy >= 0) {
+				fluid = WATER_FLUID;
+			}
+
+			for (int fy = 0; fy < FLUID_RESOLUTION; ++fy) {
+				for (int fx = 0; fx < FLUID_RESOLUTION; ++fx) {
+					size_t idx =
+						(y * FLUID_RESOLUTION + fy) * FLUID_WIDTH +
+						x * FLUID_RESOLUTION + fx;
+					c.fluid[idx] = fluid;
+				}
+			}
+		}
+	}
+
+	return c;
+}
+
+static void rleEncodeChunk(std::vector<uint8_t> &out, const ChunkLayers &c)
+{
+	rleEncode16SRO(out, c.tiles);
+	rleEncode16SRO(out, c.background);
+	rleEncode8(out, c.fluid);
+}
+
+int main()
+{
+	std::vector<ChunkLayers> chunks;
+	std::vector<std::vector<uint8_t>> rle(CHUNK_COUNT);
+	size_t rawSize = 0;
+	size_t rleSize = 0;
+	for (int i = 0; i < CHUNK_COUNT; ++i) {
+		chunks.push_back(makeChunk(i));
+		rawSize +=
+			(chunks[i].tiles.size() + chunks[i].background.size()) * 2 +
+			chunks[i].fluid.size();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < CHUNK_COUNT; ++i) {
+		rleEncodeChunk(rle[i], chunks[i]);
+		rleSize += rle[i].size();
+	}
+	double rleSec = seconds(start);
+
+	double mb = rawSize / (1024.0 * 1024.0);
+	printf("%-8s %10s %8s %12s\n", "codec", "bytes", "ratio", "encode");
+	printf("%-8s %10zu %7.1fx %9.0fMB/s\n",
+		"rle", rleSize / CHUNK_COUNT, double(rawSize) / rleSize, mb / rleSec);
+
+	for (int level: {1, 3, 6, 9}) {
+		std::vector<std::vector<uint8_t>> gz(CHUNK_COUNT);
+		size_t gzSize = 0;
+
+		// Encoding includes the RLE step, since that's what compressing a chunk costs
+		start = std::chrono::steady_clock::now();
+		std::vector<uint8_t> scratch;
+		for (int i = 0; i < CHUNK_COUNT; ++i) {
+			scratch.clear();
+			rleEncodeChunk(scratch, chunks[i]);
+			gzipEncode(gz[i], scratch, level);
+			gzSize += gz[i].size();
+		}
+		double encSec = seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < CHUNK_COUNT; ++i) {
+			scratch.clear();
+			if (!gzipDecode(scratch, gz[i]) || scratch != rle[i]) {
+				printf("gzip level %d: round trip failed!\n", level);
+				return 1;
+			}
+		}
+		double decSec = seconds(start);
+
+		char name[16];
+		snprintf(name, sizeof(name), "gzip-%d", level);
+		printf("%-8s %10zu %7.1fx %9.0fMB/s  (gunzip %.0fMB/s of RLE data)\n",
+			name, gzSize / CHUNK_COUNT, double(rawSize) / gzSize,
+			mb / encSec, (rleSize / (1024.0 * 1024.0)) / decSec);
+	}
+}
@@ -0,0 +1,140 @@
+// Measures how long chunk lookups take with the access patterns
+// of the fluid system, entity physics and lighting.
+// The ChunkIndex, with and without a cache, is compared against
+// the std::unordered_map which WorldPlane used to use.
+
+#include "ChunkIndex.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace Swan;
+
+static constexpr int WORLD_WIDTH = 24;
+static constexpr int WORLD_HEIGHT = 16;
+
+struct Pattern {
+	const char *name;
+	std::vector<ChunkPos> lookups;
+};
+
+// Fluid updates walk cell by cell through a handful of chunks,
+// mostly hitting the same chunk and sometimes a neighbour
+static Pattern fluidPattern()
+{
+	Pattern p{"fluid", {}};
+	for (int pass = 0; pass < 4; ++pass) {
+		for (int y = 0; y < CHUNK_HEIGHT * 3; ++y) {
+			for (int x = 0; x < CHUNK_WIDTH * 3; ++x) {
+				TilePos tp{x + CHUNK_WIDTH * 8, y + CHUNK_HEIGHT * 6};
+				p.lookups.push_back(chunkPos(tp));
+				p.lookups.push_back(chunkPos(tp + Vec2i{0, 1}));
+				p.lookups.push_back(chunkPos(tp + Vec2i{-1, 0}));
+				p.lookups.push_back(chunkPos(tp + Vec2i{1, 0}));
+			}
+		}
+	}
+	return p;
+}
+
+// Each physics body looks up the chunks under the corners of its
+// bounding box, and bodies are scattered over the active area
+static Pattern physicsPattern()
+{
+	Pattern p{"physics", {}};
+	uint32_t rng = 12345;
+	for (int i = 0; i < 200000; ++i) {
+		rng = rng * 1664525 + 1013904223;
+		int x = (rng >> 8) % (CHUNK_WIDTH * WORLD_WIDTH);
+		rng = rng * 1664525 + 1013904223;
+		int y = (rng >> 8) % (CHUNK_HEIGHT * WORLD_HEIGHT);
+		p.lookups.push_back(chunkPos({x, y}));
+		p.lookups.push_back(chunkPos({x + 2, y}));
+		p.lookups.push_back(chunkPos({x, y + 2}));
+		p.lookups.push_back(chunkPos({x + 2, y + 2}));
+	}
+	return p;
+}
+
+// Lighting looks at the 3x3 neighbourhood of every chunk
+static Pattern lightPattern()
+{
+	Pattern p{"light", {}};
+	for (int pass = 0; pass < 20; ++pass) {
+		for (int cy = 1; cy < WORLD_HEIGHT - 1; ++cy) {
+			for (int cx = 1; cx < WORLD_WIDTH - 1; ++cx) {
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						p.lookups.push_back({cx + dx, cy + dy});
+					}
+				}
+			}
+		}
+	}
+	return p;
+}
+
+template<typename Func>
+static double measure(const Pattern &p, Func &&func)
+{
+	// Warm up once, then take the best of a few runs
+	uintptr_t sink = 0;
+	for (ChunkPos pos: p.lookups) {
+		sink += (uintptr_t)func(pos);
+	}
+
+	double best = 1e30;
+	for (int run = 0; run < 5; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		for (ChunkPos pos: p.lookups) {
+			sink += (uintptr_t)func(pos);
+		}
+		auto end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count();
+		best = std::min(best, ns / p.lookups.size());
+	}
+
+	if (sink == 1) {
+		printf("(sink)\n");
+	}
+
+	return best;
+}
+
+int main()
+{
+	ChunkBufferPool pool;
+	ChunkIndex index;
+	std::unordered_map<ChunkPos, Chunk *> map;
+	for (int y = 0; y < WORLD_HEIGHT; ++y) {
+		for (int x = 0; x < WORLD_WIDTH; ++x) {
+			Chunk &chunk = index.insert(Chunk({x, y}, pool));
+			map[{x, y}] = &chunk;
+		}
+	}
+
+	printf("%-10s %14s %14s %14s\n",
+		"pattern", "unordered_map", "ChunkIndex", "+ Cache");
+
+	for (const Pattern &p: {fluidPattern(), physicsPattern(), lightPattern()}) {
+		double mapNs = measure(p, [&](ChunkPos pos) {
+			auto it = map.find(pos);
+			return it == map.end() ? nullptr : it->second;
+		});
+
+		double indexNs = measure(p, [&](ChunkPos pos) {
+			return index.find(pos);
+		});
+
+		ChunkIndex::Cache cache;
+		double cacheNs = measure(p, [&](ChunkPos pos) {
+			return cache.find(index, pos);
+		});
+
+		printf("%-10s %11.2fns %11.2fns %11.2fns\n",
+			p.name, mapNs, indexNs, cacheNs);
+	}
+}
@@ -0,0 +1,128 @@
+// Measures how long it takes the fluid system to keep track of which
+// cells are queued for an update and which have moved, for a flood
+// which covers several chunks. The FluidActivityMap is compared against
+// the std::unordered_set which FluidSystem used to use.
+
+#include "FluidActivityMap.h"
+#include "lib/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <unordered_set>
+#include <vector>
+
+using namespace Swan;
+using namespace benchlib;
+
+// The flood is 6 chunks wide, and each tick moves its front down
+// by a few cells. Cells above the front settle, so only a band
+// of cells just above it gets updated each tick.
+static constexpr int FLOOD_WIDTH = FluidActivityMap::WIDTH * 6;
+static constexpr int FLOOD_DEPTH = FluidActivityMap::HEIGHT * 3;
+static constexpr int BAND_HEIGHT = 12;
+static constexpr int FRONT_SPEED = 4;
+
+// The updates of each tick, in the random order the fluid system uses
+static std::vector<std::vector<FluidPos>> floodTicks()
+{
+	std::vector<std::vector<FluidPos>> ticks;
+	uint32_t rng = 12345;
+	for (int front = BAND_HEIGHT; front < FLOOD_DEPTH; front += FRONT_SPEED) {
+		auto &updates = ticks.emplace_back();
+		for (int y = front - BAND_HEIGHT; y < front; ++y) {
+			for (int x = -FLOOD_WIDTH / 2; x < FLOOD_WIDTH / 2; ++x) {
+				updates.push_back({x, y});
+			}
+		}
+
+		for (size_t i = 1; i < updates.size(); ++i) {
+			std::swap(updates[i], updates[nextRandom(rng) % (i + 1)]);
+		}
+	}
+
+	return ticks;
+}
+
+// Run the bookkeeping of FluidSystemImpl::tick and applyRules:
+// every update is checked against the moved set, and every cell
+// which moves queues updates for the cells around it and where it went
+template<typename Set>
+static size_t simulate(const std::vector<std::vector<FluidPos>> &ticks)
+{
+	Set updateSet;
+	Set movedSet;
+	size_t queued = 0;
+	for (auto &updates: ticks) {
+		updateSet.clear();
+		movedSet.clear();
+		for (FluidPos pos: updates) {
+			if (!movedSet.insert(pos).second) {
+				continue;
+			}
+
+			FluidPos below = pos.add(0, 1);
+			for (FluidPos center: {pos, below}) {
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						queued += updateSet.insert(center.add(dx, dy)).second;
+					}
+				}
+				queued += updateSet.insert(center).second;
+			}
+			movedSet.insert(below);
+		}
+	}
+
+	return queued;
+}
+
+// Gives the FluidActivityMap the same interface as the std::unordered_set
+struct ActivityMapSet {
+	struct Result {
+		bool second;
+	};
+
+	Result insert(FluidPos pos) { return {map.insert(pos)}; }
+	void clear() { map.clear(); }
+
+	FluidActivityMap map;
+};
+
+template<typename Set>
+static double measure(const std::vector<std::vector<FluidPos>> &ticks, size_t cells)
+{
+	// Warm up once, then take the best of a few runs
+	size_t sink = simulate<Set>(ticks);
+	double best = 1e30;
+	for (int run = 0; run < 5; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		sink += simulate<Set>(ticks);
+		auto end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count();
+		best = std::min(best, ns / cells);
+	}
+
+	if (sink == 1) {
+		printf("(sink)\n");
+	}
+
+	return best;
+}
+
+int main()
+{
+	auto ticks = floodTicks();
+	size_t cells = 0;
+	for (auto &updates: ticks) {
+		cells += updates.size();
+	}
+
+	printf("%zu ticks, %zu cell updates\n", ticks.size(), cells);
+	printf("%-16s %14s\n", "set", "per update");
+	printf("%-16s %11.2fns\n", "unordered_set",
+		measure<std::unordered_set<FluidPos>>(ticks, cells));
+	printf("%-16s %11.2fns\n", "FluidActivityMap",
+		measure<ActivityMapSet>(ticks, cells));
+}
@@ -0,0 +1,213 @@
+// Measures how the order of a tick's fluid updates affects how quickly
+// they can be applied, for a large body of water spread over many chunks.
+// The global shuffle which FluidSystem used to do is compared against
+// FluidUpdateOrder's shuffle within chunks and bands of rows.
+// On Linux, cache misses are counted with perf events where allowed.
+
+#include "FluidUpdateOrder.h"
+#include "SparseFluidGrid.h"
+#include "lib/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace Swan;
+using namespace benchlib;
+
+// 16 * 8 chunks of water, with a tick's worth of updates in it
+static constexpr int BODY_WIDTH = 16;
+static constexpr int BODY_HEIGHT = 8;
+static constexpr size_t UPDATES = 2'000'000;
+
+static constexpr int W = SparseFluidGrid::WIDTH;
+static constexpr int H = SparseFluidGrid::HEIGHT;
+
+// Counts last level cache misses, if perf events are available
+class CacheMissCounter {
+public:
+	CacheMissCounter()
+	{
+#ifdef __linux__
+		perf_event_attr attr{};
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~CacheMissCounter()
+	{
+#ifdef __linux__
+		if (fd_ >= 0) {
+			close(fd_);
+		}
+#endif
+	}
+
+	bool available() const { return fd_ >= 0; }
+
+	void start()
+	{
+#ifdef __linux__
+		if (fd_ >= 0) {
+			ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	uint64_t stop()
+	{
+		uint64_t count = 0;
+#ifdef __linux__
+		if (fd_ >= 0) {
+			ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+				count = 0;
+			}
+		}
+#endif
+		return count;
+	}
+
+private:
+	int fd_ = -1;
+};
+
+struct Body {
+	std::vector<std::unique_ptr<SparseFluidGrid>> grids;
+
+	SparseFluidGrid &grid(FluidPos pos)
+	{
+		return *grids[(pos.y / H) * BODY_WIDTH + (pos.x / W)];
+	}
+};
+
+// Water everywhere, moving every which way, so every tile has a block
+static Body makeBody()
+{
+	Body body;
+	uint32_t rng = 1;
+	std::vector<uint8_t> cells(SparseFluidGrid::SIZE);
+	for (int i = 0; i < BODY_WIDTH * BODY_HEIGHT; ++i) {
+		for (auto &cell: cells) {
+			cell = 2 | ((nextRandom(rng) % 3) << 6);
+		}
+		body.grids.push_back(std::make_unique<SparseFluidGrid>());
+		body.grids.back()->pack(cells);
+	}
+	return body;
+}
+
+// Look at the same cells as applyRules does, and move some of the water
+static uint64_t applyUpdates(Body &body, const std::vector<FluidPos> &updates)
+{
+	uint64_t sum = 0;
+	for (FluidPos pos: updates) {
+		auto &grid = body.grid(pos);
+		Vec2i rel{int(pos.x % W), int(pos.y % H)};
+		uint8_t self = grid.get(rel);
+		sum += self;
+		if (rel.y + 2 < H && rel.x > 0 && rel.x + 1 < W) {
+			sum += grid.get(rel.add(0, 1)) + grid.get(rel.add(0, 2));
+			sum += grid.get(rel.add(-1, 0)) + grid.get(rel.add(1, 0));
+		}
+
+		if (sum % 4 == 0) {
+			*grid.getForWrite(rel) = self ^ 0x40;
+		}
+	}
+	return sum;
+}
+
+static std::vector<FluidPos> makeUpdates()
+{
+	std::vector<FluidPos> updates;
+	updates.reserve(UPDATES);
+	uint32_t rng = 7;
+	for (size_t i = 0; i < UPDATES; ++i) {
+		int x = nextRandom(rng) % (W * BODY_WIDTH);
+		int y = nextRandom(rng) % (H * BODY_HEIGHT);
+		updates.push_back({x, y});
+	}
+	return updates;
+}
+
+static void globalShuffle(std::vector<FluidPos> &updates, uint32_t rng)
+{
+	for (size_t i = 1; i < updates.size(); ++i) {
+		size_t newIndex = nextRandom(rng) % (updates.size() - i) + i;
+		std::swap(updates[i], updates[newIndex]);
+	}
+}
+
+template<typename Shuffle>
+static void measure(const char *name, Body &body, Shuffle &&shuffle)
+{
+	CacheMissCounter counter;
+	auto updates = makeUpdates();
+	uint64_t sink = 0;
+
+	// Take the best of a few ticks
+	double bestShuffle = 1e30;
+	double bestApply = 1e30;
+	uint64_t bestMisses = 0;
+	for (int run = 0; run < 5; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		shuffle(updates, run);
+		bestShuffle = std::min(bestShuffle, seconds(start));
+
+		counter.start();
+		start = std::chrono::steady_clock::now();
+		sink += applyUpdates(body, updates);
+		double applySec = seconds(start);
+		uint64_t misses = counter.stop();
+		if (applySec < bestApply) {
+			bestApply = applySec;
+			bestMisses = misses;
+		}
+	}
+
+	if (sink == 1) {
+		printf("(sink)\n");
+	}
+
+	printf("%-16s %9.1fms %9.1fM/s", name, bestShuffle * 1000, updates.size() / bestApply / 1e6);
+	if (counter.available()) {
+		printf(" %12.3f\n", double(bestMisses) / updates.size());
+	} else {
+		printf(" %12s\n", "n/a");
+	}
+}
+
+int main()
+{
+	auto body = makeBody();
+	printf("%d chunks of water, %zu updates per tick\n", BODY_WIDTH * BODY_HEIGHT, UPDATES);
+	printf("%-16s %11s %11s %12s\n", "order", "shuffle", "apply", "misses/upd");
+
+	measure("global shuffle", body, [](auto &updates, int run) {
+		globalShuffle(updates, run + 1);
+	});
+
+	FluidUpdateOrder order;
+	measure("FluidUpdateOrder", body, [&](auto &updates, int run) {
+		order.shuffle(updates, run + 1);
+	});
+}
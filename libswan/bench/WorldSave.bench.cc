@@ -0,0 +1,119 @@
+// Measures save throughput for a world with lots of modified chunks,
+// with different numbers of threads: both the snapshot, which encodes
+// the active chunks while the game waits, and the background save,
+// which gzips the chunks and writes the region files.
+
+#include "Chunk.h"
+#include "ChunkBufferPool.h"
+#include "RegionFile.h"
+#include "WorkerPool.h"
+#include "WorldSaver.h"
+#include "lib/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace Swan;
+using namespace benchlib;
+
+// 128 * 96 chunks is 12288 chunks, in 12 regions
+static constexpr int WORLD_WIDTH = 128;
+static constexpr int WORLD_HEIGHT = 96;
+
+// Air above a quarter of the way down the world, the surface in that row
+// of chunks, and everything below it underground
+static void fillChunk(Chunk &chunk, uint32_t seed)
+{
+	uint32_t rng = seed * 7919 + 1;
+	int surface = chunk.pos().y < WORLD_HEIGHT / 4 ? CHUNK_HEIGHT : -CHUNK_HEIGHT;
+	if (chunk.pos().y == WORLD_HEIGHT / 4) {
+		surface = 10 + nextRandom(rng) % 20;
+	}
+
+	std::vector<Tile::ID> tiles(CHUNK_WIDTH * CHUNK_HEIGHT);
+	std::vector<Tile::ID> background(CHUNK_WIDTH * CHUNK_HEIGHT);
+	fillTerrain(tiles, background, surface, rng);
+	chunk.writeTiles([&](std::span<Tile::ID> out) {
+		std::copy(tiles.begin(), tiles.end(), out.begin());
+	});
+	chunk.writeBackgroundTiles([&](std::span<Tile::ID> out) {
+		std::copy(background.begin(), background.end(), out.begin());
+	});
+}
+
+int main()
+{
+	auto dir = std::filesystem::temp_directory_path() / "swan-bench-world-save";
+	std::filesystem::create_directories(dir);
+
+	ChunkBufferPool pool;
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	std::vector<Chunk *> chunkPtrs;
+	for (int y = 0; y < WORLD_HEIGHT; ++y) {
+		for (int x = 0; x < WORLD_WIDTH; ++x) {
+			auto &chunk = chunks.emplace_back(std::make_unique<Chunk>(ChunkPos{x, y}, pool));
+			fillChunk(*chunk, y * WORLD_WIDTH + x);
+			chunkPtrs.push_back(chunk.get());
+		}
+	}
+
+	int maxThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+	printf("%zu chunks, up to %d threads\n", chunks.size(), maxThreads);
+	printf("%-8s %14s %14s\n", "threads", "snapshot", "save");
+
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		WorkerPool workers(threads);
+		auto start = std::chrono::steady_clock::now();
+		auto snapshots = Chunk::snapshotAll(chunkPtrs, workers);
+		double snapshotSec = seconds(start);
+
+		WorldSaver::Snapshot snapshot{
+			.worldPath = dir / "world.swan",
+			.world = std::make_unique<capnp::MallocMessageBuilder>(),
+			.regions = {},
+			.gzipLevel = 6,
+			.deltaChunks = false,
+		};
+		snapshot.world->initRoot<proto::World>();
+
+		std::unordered_map<RegionPos, size_t> regionIndex;
+		for (auto &chunk: snapshots) {
+			RegionPos rp = RegionFile::regionPos(chunk.pos);
+			auto [it, inserted] = regionIndex.try_emplace(rp, snapshot.regions.size());
+			if (inserted) {
+				snapshot.regions.push_back({
+					.plane = 0,
+					.pos = rp,
+					.path = RegionFile::path(dir, rp),
+					.chunks = {},
+				});
+			}
+			snapshot.regions[it->second].chunks.push_back(std::move(chunk));
+		}
+
+		WorldSaver saver(threads);
+		bool ok = false;
+		start = std::chrono::steady_clock::now();
+		saver.start(std::move(snapshot), [&](auto &result) {
+			ok = result.ok;
+		});
+		saver.wait();
+		double saveSec = seconds(start);
+		if (!ok) {
+			printf("Save failed!\n");
+			return 1;
+		}
+
+		printf("%-8d %9.0f ch/s %9.0f ch/s\n",
+			threads, chunks.size() / snapshotSec, chunks.size() / saveSec);
+	}
+
+	std::filesystem::remove_all(dir);
+}
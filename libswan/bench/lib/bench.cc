@@ -0,0 +1,42 @@
+#include "bench.h"
+
+#include <swan/constants.h>
+
+namespace benchlib {
+
+using namespace Swan;
+
+uint32_t nextRandom(uint32_t &rng)
+{
+	rng = rng * 1664525 + 1013904223;
+	return rng >> 8;
+}
+
+double seconds(std::chrono::steady_clock::time_point start)
+{
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+void fillTerrain(
+	std::span<uint16_t> tiles, std::span<uint16_t> background,
+	int surface, uint32_t &rng)
+{
+	for (int y = 0; y < CHUNK_HEIGHT; ++y) {
+		for (int x = 0; x < CHUNK_WIDTH; ++x) {
+			int h = surface + (x / 8) % 3;
+			uint16_t bg = y < h ? AIR : y < h + 6 ? DIRT : STONE;
+			uint16_t fg = bg;
+			if (y == h) {
+				fg = GRASS;
+			} else if (fg == STONE && nextRandom(rng) % 32 == 0) {
+				fg = ORE;
+			}
+
+			tiles[y * CHUNK_WIDTH + x] = fg;
+			background[y * CHUNK_WIDTH + x] = bg;
+		}
+	}
+}
+
+}
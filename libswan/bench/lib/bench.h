@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <span>
+#include <stdint.h>
+
+namespace benchlib {
+
+// A simple LCG, so that every run measures the same data
+uint32_t nextRandom(uint32_t &rng);
+
+// Seconds since 'start'
+double seconds(std::chrono::steady_clock::time_point start);
+
+enum TerrainTile: uint16_t {
+	AIR, GRASS, DIRT, STONE, ORE,
+};
+
+// Fill a chunk's worth of tiles with something like generated terrain:
+// air on top, grass on the surface, then some dirt, then stone with ores.
+// The surface goes up and down a little across the chunk. It can be
+// outside of the chunk, for chunks which are all air or all underground.
+void fillTerrain(
+	std::span<uint16_t> tiles, std::span<uint16_t> background,
+	int surface, uint32_t &rng);
+
+}
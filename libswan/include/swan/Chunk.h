@@ -1,18 +1,26 @@
 #pragma once
 
+#include <algorithm>
 #include <deque>
+#include <functional>
 #include <span>
 #include <string.h>
 #include <stdint.h>
 #include <memory>
+#include <type_traits>
 #include <unordered_set>
 #include <cygnet/Renderer.h>
 #include <assert.h>
 
 #include "common.h"
+#include "ChunkBufferPool.h"
 #include "Fluid.h"
 #include "Tile.h"
 #include "EntityCollection.h"
+#include "PaletteTileData.h"
+#include "SparseFluidGrid.h"
+#include "WorkerPool.h"
+#include "gzip.h"
 #include "swan.capnp.h"
 
 namespace Swan {
@@ -31,16 +39,20 @@ public:
 	static constexpr size_t BACKGROUND_TILE_DATA_SIZE = TILE_DATA_SIZE;
 	static constexpr size_t BACKGROUND_TILE_DATA_OFFSET = TILE_DATA_OFFSET + TILE_DATA_SIZE;
 
-	static constexpr size_t FLUID_DATA_SIZE =
-		CHUNK_WIDTH * FLUID_RESOLUTION * CHUNK_HEIGHT * FLUID_RESOLUTION;
-	static constexpr size_t FLUID_DATA_OFFSET = BACKGROUND_TILE_DATA_OFFSET + BACKGROUND_TILE_DATA_SIZE;
-
 	static constexpr size_t LIGHT_DATA_SIZE =
 		CHUNK_WIDTH * CHUNK_HEIGHT;
-	static constexpr size_t LIGHT_DATA_OFFSET = FLUID_DATA_OFFSET + FLUID_DATA_SIZE;
+	static constexpr size_t LIGHT_DATA_OFFSET = BACKGROUND_TILE_DATA_OFFSET + BACKGROUND_TILE_DATA_SIZE;
+
+	static constexpr size_t DATA_SIZE = LIGHT_DATA_OFFSET + LIGHT_DATA_SIZE;
 
+	// Fluids aren't part of the data buffer, they live in a SparseFluidGrid.
+	// This is the size of the flat fluid array used for rendering
+	// and serialization.
+	static constexpr size_t FLUID_DATA_SIZE = SparseFluidGrid::SIZE;
+
+	// Uncompressed serialized chunks contain the tiles,
+	// the background tiles and the flat fluid array
 	static constexpr size_t PERSISTENT_DATA_SIZE = TILE_DATA_SIZE + BACKGROUND_TILE_DATA_SIZE + FLUID_DATA_SIZE;
-	static constexpr size_t DATA_SIZE = PERSISTENT_DATA_SIZE + LIGHT_DATA_SIZE + BACKGROUND_TILE_DATA_SIZE;
 
 	// What does this chunk want the world gen to do after a tick?
 	enum class TickAction {
@@ -49,82 +61,178 @@ public:
 		NOTHING,
 	};
 
-	Chunk(ChunkPos pos);
+	// Maps the tile IDs in a save to the current tile IDs,
+	// or nullptr when they're the same
+	using TileMap = std::shared_ptr<const std::vector<Tile::ID>>;
+
+	// Fills flat tile and background arrays with what the world gen
+	// generates for a chunk, which delta chunks are stored against.
+	// It's called from worker threads and from the saver thread.
+	using Regenerator = std::shared_ptr<const std::function<void(
+		ChunkPos pos, std::span<Tile::ID> tiles, std::span<Tile::ID> background)>>;
+
+	// The entities which were in the chunk when it was deactivated,
+	// as a packed proto::ChunkEntities message
+	using HibernatingEntities = std::shared_ptr<const std::vector<uint8_t>>;
+
+	// How the foreground and background tiles are kept in memory
+	// while the chunk is active.
+	// FLAT stores plain Tile::ID arrays in the chunk's data buffer,
+	// PALETTE stores them bit-packed in a PaletteTileData.
+	enum class TileStorage {
+		FLAT,
+		PALETTE,
+	};
+
+	// The chunk's data buffer comes from 'pool', which has to outlive the chunk
+	Chunk(ChunkPos pos, ChunkBufferPool &pool, TileStorage storage = TileStorage::FLAT);
+
+	// Chunks must not be moved while a background job is running
+	Chunk(Chunk &&) = default;
+	Chunk &operator=(Chunk &&) = default;
+	~Chunk();
+
+	TileStorage tileStorage() const
+	{
+		return tileStorage_;
+	}
 
+	void setTileStorage(TileStorage storage);
+
+	// The raw tile arrays are only available with TileStorage::FLAT.
+	// Code which has to work with any chunk should use
+	// readTiles/writeTiles and friends instead.
 	Tile::ID *getTileData()
 	{
-		assert(isActive());
+		assert(isActive() && tileStorage_ == TileStorage::FLAT);
 		return (Tile::ID *)(data_.get() + TILE_DATA_OFFSET);
 	}
 
 	const Tile::ID *getTileData() const
 	{
-		assert(isActive());
+		assert(isActive() && tileStorage_ == TileStorage::FLAT);
 		return (Tile::ID *)(data_.get() + TILE_DATA_OFFSET);
 	}
 
 	Tile::ID *getBackgroundTileData()
 	{
-		assert(isActive());
+		assert(isActive() && tileStorage_ == TileStorage::FLAT);
 		return (Tile::ID *)(data_.get() + BACKGROUND_TILE_DATA_OFFSET);
 	}
 
 	const Tile::ID *getBackgroundTileData() const
 	{
-		assert(isActive());
+		assert(isActive() && tileStorage_ == TileStorage::FLAT);
 		return (Tile::ID *)(data_.get() + BACKGROUND_TILE_DATA_OFFSET);
 	}
 
-	Fluid::ID *getFluidData()
+	SparseFluidGrid &getFluidData()
 	{
 		assert(isActive());
-		return (Fluid::ID *)(data_.get() + FLUID_DATA_OFFSET);
+		return fluidData_;
 	}
 
-	const Fluid::ID *getFluidData() const
+	const SparseFluidGrid &getFluidData() const
 	{
 		assert(isActive());
-		return (Fluid::ID *)(data_.get() + FLUID_DATA_OFFSET);
+		return fluidData_;
 	}
 
 	uint8_t *getLightData()
 	{
 		assert(isActive());
-		return data_.get() + LIGHT_DATA_OFFSET;
+		return data_.get() + LIGHT_DATA_OFFSET - tileDataOffset();
 	}
 
 	const uint8_t *getLightData() const
 	{
 		assert(isActive());
-		return data_.get() + LIGHT_DATA_OFFSET;
+		return data_.get() + LIGHT_DATA_OFFSET - tileDataOffset();
+	}
+
+	// Call 'func' with a std::span<const Tile::ID> of all the tiles.
+	// With TileStorage::PALETTE, that's a temporary unpacked copy,
+	// which is only valid until the callback returns.
+	template<typename Func>
+	void readTiles(Func &&func) const
+	{
+		readLayer(0, tilePalette_, func);
+	}
+
+	template<typename Func>
+	void readBackgroundTiles(Func &&func) const
+	{
+		readLayer(1, backgroundPalette_, func);
+	}
+
+	// Call 'func' with a std::span<Tile::ID> of all the tiles,
+	// for bulk modification. Unlike setTileID, this doesn't mark the chunk
+	// as modified or tell the renderer; it's meant for world generation
+	// and deserialization.
+	template<typename Func>
+	void writeTiles(Func &&func)
+	{
+		writeLayer(0, tilePalette_, func);
+	}
+
+	template<typename Func>
+	void writeBackgroundTiles(Func &&func)
+	{
+		writeLayer(1, backgroundPalette_, func);
 	}
 
 	Tile::ID getTileID(ChunkRelPos pos) const
 	{
-		return getTileData()[pos.y * CHUNK_WIDTH + pos.x];
+		size_t index = pos.y * CHUNK_WIDTH + pos.x;
+		if (tileStorage_ == TileStorage::PALETTE) {
+			return tilePalette_.get(index);
+		}
+
+		return getTileData()[index];
 	}
 
 	void setTileID(ChunkRelPos pos, Tile::ID id)
 	{
-		getTileData()[pos.y * CHUNK_WIDTH + pos.x] = id;
+		size_t index = pos.y * CHUNK_WIDTH + pos.x;
+		if (tileStorage_ == TileStorage::PALETTE) {
+			tilePalette_.set(index, id);
+		} else {
+			getTileData()[index] = id;
+		}
 		changeList_.emplace_back(pos, id);
 		isModified_ = true;
+		needsSave_ = true;
 	}
 
 	Tile::ID getBackgroundTileID(ChunkRelPos pos) const
 	{
-		return getBackgroundTileData()[pos.y * CHUNK_WIDTH + pos.x];
+		size_t index = pos.y * CHUNK_WIDTH + pos.x;
+		if (tileStorage_ == TileStorage::PALETTE) {
+			return backgroundPalette_.get(index);
+		}
+
+		return getBackgroundTileData()[index];
 	}
 
 	void setBackgroundTileID(ChunkRelPos pos, Tile::ID id)
 	{
-		getBackgroundTileData()[pos.y * CHUNK_WIDTH + pos.x] = id;
+		size_t index = pos.y * CHUNK_WIDTH + pos.x;
+		if (tileStorage_ == TileStorage::PALETTE) {
+			backgroundPalette_.set(index, id);
+		} else {
+			getBackgroundTileData()[index] = id;
+		}
 		backgroundChangeList_.emplace_back(pos, id);
 		isModified_ = true;
+		needsSave_ = true;
 	}
 
 	void setFluidID(ChunkRelPos pos, Fluid::ID fluid);
 	void setFluidSolid(ChunkRelPos pos, const FluidCollision &set);
+
+	// Make the fluid cells in row 'y' solid wherever the tiles in 'tiles'
+	// are, for a new chunk. Non-solid tiles are left alone.
+	void initFluidSolidRow(int y, std::span<Tile *const, CHUNK_WIDTH> tiles);
 	void clearFluidSolid(ChunkRelPos pos);
 
 	void setFluidMask(ChunkRelPos pos, Cygnet::RenderMask mask);
@@ -149,7 +257,33 @@ public:
 	void generateDone();
 	void keepActive();
 	void decompress();
-	void compress();
+
+	// With a gzip level above GZIP_LEVEL_NONE, the RLE data is gzipped too
+	void compress(int gzipLevel = GZIP_LEVEL_NONE);
+
+	// Compress or decompress the chunk on a worker thread.
+	// Until the job is finished, the chunk is inactive and must not
+	// be touched, except by serialize(); call pollCodec() regularly
+	// to pick up the result. Calling any of keepActive(), decompress(),
+	// compress() or setTileStorage() waits for the job instead.
+	// Returns false if there was nothing to do.
+	bool compressAsync(WorkerPool &workers, int gzipLevel = GZIP_LEVEL_NONE);
+	bool decompressAsync(WorkerPool &workers);
+
+	// Apply the result of a finished background job.
+	// Returns true if a job finished.
+	bool pollCodec();
+
+	// Wait for the background job, if any, and apply its result
+	void waitCodec()
+	{
+		finishCodec(true);
+	}
+
+	bool hasPendingCodec() const
+	{
+		return codecState_ != CodecState::IDLE;
+	}
 
 	void destroyTextures(Cygnet::Renderer &rnd)
 	{
@@ -165,7 +299,7 @@ public:
 
 	bool isActive() const
 	{
-		return !isCompressed() && data_;
+		return codecState_ == CodecState::IDLE && !isCompressed() && data_;
 	}
 
 	bool isModified() const
@@ -173,38 +307,256 @@ public:
 		return isModified_;
 	}
 
+	// Whether the chunk has changed since it was last saved.
+	// Freshly deserialized chunks need saving too,
+	// unless whoever loaded them calls markSaved().
+	bool needsSave() const
+	{
+		return needsSave_;
+	}
+
+	void markSaved()
+	{
+		needsSave_ = false;
+	}
+
+	// Keep and save the chunk like a modified one, even if nothing
+	// changed since it was generated
+	void markModified()
+	{
+		isModified_ = true;
+		needsSave_ = true;
+	}
+
+	// Entities which go to sleep in a chunk have to be kept and saved
+	// with it, so the chunk counts as modified from then on
+	void hibernateEntities(HibernatingEntities entities)
+	{
+		assert(!hibernatingEntities_);
+		hibernatingEntities_ = std::move(entities);
+		isModified_ = true;
+		needsSave_ = true;
+	}
+
+	// Once they're awake, the saved chunk must not have them anymore
+	HibernatingEntities wakeEntities()
+	{
+		if (hibernatingEntities_) {
+			needsSave_ = true;
+		}
+
+		return std::move(hibernatingEntities_);
+	}
+
+	bool hasHibernatingEntities() const
+	{
+		return hibernatingEntities_ != nullptr;
+	}
+
 	ChunkPos pos() const
 	{
 		return pos_;
 	}
 
-	void setFluidModified()
+	// Mark the fluids in the rows of tiles [begin, end) as modified.
+	// Only those rows get uploaded to the fluid texture again.
+	void setFluidModified(int begin = 0, int end = CHUNK_HEIGHT)
 	{
-		isFluidModified_ = true;
+		fluidDirtyBegin_ = std::min(fluidDirtyBegin_, begin);
+		fluidDirtyEnd_ = std::max(fluidDirtyEnd_, end);
+		needsSave_ = true;
 	}
 
 	size_t getMemUsage() const
 	{
-		return isCompressed() ? compressedSize_ : DATA_SIZE;
+		// Compressed data which lives in a mapped file doesn't count,
+		// the OS can drop those pages whenever it wants
+		if (isCompressed()) {
+			return compressedBacking_ ? 0 : compressedSize_;
+		}
+
+		if (!data_) {
+			return 0;
+		}
+
+		return DATA_SIZE - tileDataOffset() +
+			tilePalette_.getMemUsage() + backgroundPalette_.getMemUsage() +
+			fluidData_.getMemUsage();
+	}
+
+	// An immutable copy of the chunk's persistent data, in compressed form.
+	// It can be serialized on any thread, while the chunk keeps changing.
+	struct Snapshot {
+		ChunkPos pos;
+		std::shared_ptr<const void> owner;
+		std::span<const uint8_t> data;
+		proto::Chunk::Compression compression;
+		TileMap tileMap;
+
+		// Needed to decode delta data, and to make deltas
+		Regenerator regenerator;
+
+		HibernatingEntities entities;
+	};
+
+	// A compressed chunk just shares its compressed data,
+	// an active chunk gets RLE encoded
+	Snapshot snapshot() const;
+
+	// Snapshot many chunks at once, with the active ones encoded on
+	// 'workers'. Nothing else may touch the chunks until it returns.
+	static std::vector<Snapshot> snapshotAll(
+		std::span<Chunk *const> chunks, WorkerPool &workers);
+
+	// 'gzipLevel' is the level for the serialized data.
+	// With 'delta', the chunk is stored as the difference to what the
+	// snapshot's regenerator generates, unless the full chunk is smaller.
+	static void serialize(
+		const Snapshot &snapshot, proto::Chunk::Builder w,
+		int gzipLevel = GZIP_LEVEL_NONE, bool delta = false);
+
+	void serialize(proto::Chunk::Builder w, int gzipLevel = GZIP_LEVEL_NONE) const
+	{
+		serialize(snapshot(), w, gzipLevel);
 	}
 
-	void serialize(proto::Chunk::Builder w) const;
-	void deserialize(proto::Chunk::Reader r, std::span<Tile::ID> tileMap);
+	// Compressed chunks stay compressed, and only get their tiles
+	// run through 'tileMap' once they're decompressed.
+	// If 'backing' keeps the memory behind 'r' alive, compressed data
+	// is used in place instead of copied, until the chunk is activated.
+	// Delta chunks need a 'regenerator' to be decompressed.
+	void deserialize(
+		proto::Chunk::Reader r, TileMap tileMap = nullptr,
+		std::shared_ptr<const void> backing = nullptr,
+		Regenerator regenerator = nullptr);
+
+	// Copy compressed data which is used in place into the chunk,
+	// so that whatever it lives in can be released or overwritten
+	void detachCompressedData();
 
 	std::unordered_set<EntityRef> entities_;
 	uint64_t lightGeneration_ = 0;
 
+	// When the chunk was last compressed, so that the least recently
+	// used chunks are paged out first
+	uint64_t compressedStamp_ = 0;
+
 private:
 	static constexpr float DEACTIVATE_INTERVAL = 20;
 
+	enum class CodecState {
+		IDLE,
+		COMPRESSING,
+		DECOMPRESSING,
+	};
+
 	bool isCompressed() const
 	{
 		return compressedSize_ != -1;
 	}
 
-	std::unique_ptr<uint8_t[]> compressToBuffer(size_t &size) const;
+	std::span<const uint8_t> compressedBytes() const
+	{
+		return {compressedPtr_, size_t(compressedSize_)};
+	}
+
+	static_assert(std::is_same_v<Tile::ID, PaletteTileData::ID>);
+
+	// With TileStorage::PALETTE, the data buffer doesn't contain
+	// the tile arrays, so everything else is shifted down
+	size_t tileDataOffset() const
+	{
+		return tileStorage_ == TileStorage::FLAT ? 0 : LIGHT_DATA_OFFSET;
+	}
+
+	// Unpack the fluid grid into a temporary flat array
+	uint8_t *flattenFluidData() const;
+
+	// Flatten the fluids in the rows of tiles [begin, end),
+	// returning a pointer to the first of those rows
+	uint8_t *flattenFluidRows(int begin, int end) const;
+
+	static constexpr size_t layerOffset(int layer)
+	{
+		return layer == 0 ? TILE_DATA_OFFSET : BACKGROUND_TILE_DATA_OFFSET;
+	}
+
+	// Scratch space for unpacked palette tiles, one per layer
+	static std::span<Tile::ID, CHUNK_WIDTH * CHUNK_HEIGHT> tileScratch(int layer);
+
+	template<typename Func>
+	void readLayer(int layer, const PaletteTileData &palette, Func &func) const
+	{
+		if (tileStorage_ == TileStorage::FLAT) {
+			auto *data = (const Tile::ID *)(data_.get() + layerOffset(layer));
+			func(std::span<const Tile::ID>(data, CHUNK_WIDTH * CHUNK_HEIGHT));
+			return;
+		}
+
+		auto scratch = tileScratch(layer);
+		palette.unpack(scratch);
+		func(std::span<const Tile::ID>(scratch));
+	}
 
-	std::unique_ptr<uint8_t[]> data_;
+	template<typename Func>
+	void writeLayer(int layer, PaletteTileData &palette, Func &func)
+	{
+		if (tileStorage_ == TileStorage::FLAT) {
+			auto *data = (Tile::ID *)(data_.get() + layerOffset(layer));
+			func(std::span<Tile::ID>(data, CHUNK_WIDTH * CHUNK_HEIGHT));
+			return;
+		}
+
+		auto scratch = tileScratch(layer);
+		palette.unpack(scratch);
+		func(std::span<Tile::ID>(scratch));
+		palette.pack(scratch);
+	}
+
+	std::unique_ptr<uint8_t[]> compressToBuffer(size_t &size, int gzipLevel) const;
+
+	// compress() and decompress() are split into the parts which have to run
+	// on the main thread, and the parts which can run on a worker
+	void applyCompressed(
+		std::unique_ptr<uint8_t[]> data, size_t size,
+		proto::Chunk::Compression compression);
+	void beginDecompress();
+	void decodeCompressed();
+	void endDecompress();
+
+	// Undo beginDecompress() after decoding failed, leaving the chunk compressed
+	void abortDecompress();
+
+	// Wait for the background job, if any.
+	// A finished decompression is applied, but with 'keepCompressed' false,
+	// the result of a compression is thrown away, leaving the chunk active.
+	// A decompression which threw is rethrown here, with the chunk left
+	// compressed; a compression which threw leaves the chunk active.
+	void finishCodec(bool keepCompressed);
+
+	// Get a fresh data buffer from the pool, sized for the current tile storage
+	ChunkBufferPool::Buffer allocData();
+
+	ChunkBufferPool *pool_;
+	ChunkBufferPool::Buffer data_;
+	// The compressed data is either owned by the chunk, or used in place
+	// in memory which compressedBacking_ keeps alive;
+	// compressedPtr_ points to whichever it is.
+	// It's never modified, and snapshots share it.
+	std::shared_ptr<const uint8_t[]> compressedData_;
+	std::shared_ptr<const void> compressedBacking_;
+	const uint8_t *compressedPtr_ = nullptr;
+
+	// The compressed data's tile IDs have yet to be remapped with this
+	TileMap tileMap_;
+
+	// Only set while the compressed data is a delta
+	Regenerator regenerator_;
+	HibernatingEntities hibernatingEntities_;
+	TileStorage tileStorage_;
+	PaletteTileData tilePalette_;
+	PaletteTileData backgroundPalette_;
+	SparseFluidGrid fluidData_;
 	std::deque<std::pair<ChunkRelPos, Tile::ID>> changeList_;
 	std::deque<std::pair<ChunkRelPos, Tile::ID>> backgroundChangeList_;
 
@@ -212,13 +564,22 @@ private:
 	std::unordered_map<ChunkRelPos, size_t> fluidMaskMap_;
 
 	ssize_t compressedSize_ = -1; // -1 if not compressed, a positive number if compressed
+	proto::Chunk::Compression compression_ = proto::Chunk::Compression::RLE;
+
+	CodecState codecState_ = CodecState::IDLE;
+	WorkerPool::JobPtr codecJob_;
+	std::unique_ptr<uint8_t[]> codecResult_;
+	size_t codecResultSize_ = 0;
+	proto::Chunk::Compression codecResultCompression_ = proto::Chunk::Compression::RLE;
 	Cygnet::RenderChunk renderChunk_;
 	Cygnet::RenderChunkFluid renderChunkFluid_;
 	Cygnet::RenderChunkShadow renderChunkShadow_;
 	bool needLightRender_ = false;
 	float deactivateTimer_ = DEACTIVATE_INTERVAL;
 	bool isModified_ = false;
-	bool isFluidModified_ = false;
+	int fluidDirtyBegin_ = CHUNK_HEIGHT;
+	int fluidDirtyEnd_ = 0;
+	bool needsSave_ = false;
 	bool isRendered_ = false;
 
 	ChunkPos pos_;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <swan/util.h>
+
+namespace Swan {
+
+/*
+ * Recycles the fixed-size data buffers of active chunks.
+ * Chunks are constantly compressed and decompressed as the player moves
+ * around, so instead of going through the general-purpose allocator
+ * every time, buffers are carved out of big slabs (backed by huge pages
+ * where the OS supports it) and put on a free list when released.
+ *
+ * Each distinct buffer size gets its own free list and slabs.
+ * Slabs are never returned to the OS before the pool is destroyed,
+ * so the pool's footprint is its high-water mark.
+ *
+ * The pool isn't thread safe. It must outlive every buffer it hands out.
+ */
+class ChunkBufferPool: NonCopyable {
+public:
+	static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
+
+	struct Deleter {
+		ChunkBufferPool *pool = nullptr;
+		size_t size = 0;
+
+		void operator()(uint8_t *buf) const
+		{
+			pool->release(buf, size);
+		}
+	};
+
+	using Buffer = std::unique_ptr<uint8_t[], Deleter>;
+
+	struct Stats {
+		size_t buffersInUse = 0;
+		size_t bytesInUse = 0;
+		size_t highWaterBytes = 0;
+		size_t slabBytes = 0;
+	};
+
+	ChunkBufferPool() = default;
+	~ChunkBufferPool();
+
+	// The buffer's contents are unspecified
+	Buffer allocate(size_t size);
+
+	const Stats &stats() const { return stats_; }
+
+private:
+	struct SizeClass {
+		size_t size;
+		std::vector<uint8_t *> free;
+	};
+
+	struct Slab {
+		uint8_t *mem;
+		size_t size;
+		bool fromOS;
+	};
+
+	SizeClass &sizeClass(size_t size);
+	void grow(SizeClass &sc);
+	void release(uint8_t *buf, size_t size);
+
+	std::vector<SizeClass> classes_;
+	std::vector<Slab> slabs_;
+	Stats stats_;
+};
+
+}
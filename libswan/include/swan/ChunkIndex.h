@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <swan/util.h>
+#include "common.h"
+#include "Chunk.h"
+
+namespace Swan {
+
+/*
+ * Owns the chunks of a plane, and finds them by position.
+ * Chunks are grouped into REGION_SIZE * REGION_SIZE regions,
+ * each of which is a flat table of chunk pointers,
+ * and regions are looked up in a small open-addressing table.
+ * Chunks never move once inserted, so Chunk pointers stay valid
+ * until the chunk is erased.
+ *
+ * Regions are only freed by clear(); a region whose chunks
+ * have all been erased just sits there empty.
+ */
+class ChunkIndex: NonCopyable {
+public:
+	static constexpr int REGION_SHIFT = 5;
+	static constexpr int REGION_SIZE = 1 << REGION_SHIFT;
+
+	/*
+	 * A tiny direct-mapped cache in front of the index.
+	 * Hot code which looks up the same handful of chunks over and over
+	 * keeps one of these around. Caches notice on their own when chunks
+	 * are erased from the index, or when invalidateCaches() is called.
+	 */
+	class Cache {
+	public:
+		static constexpr int SIZE = 16;
+
+		Chunk *find(const ChunkIndex &index, ChunkPos pos)
+		{
+			if (generation_ != index.generation_) {
+				clear();
+				generation_ = index.generation_;
+			}
+
+			Entry &e = entries_[slot(pos)];
+			if (e.chunk && e.pos == pos) {
+				return e.chunk;
+			}
+
+			Chunk *chunk = index.find(pos);
+			if (chunk) {
+				e = {pos, chunk};
+			}
+
+			return chunk;
+		}
+
+		void clear()
+		{
+			for (auto &e: entries_) {
+				e.chunk = nullptr;
+			}
+		}
+
+	private:
+		struct Entry {
+			ChunkPos pos{0, 0};
+			Chunk *chunk = nullptr;
+		};
+
+		// A 4x4 neighbourhood of chunks never collides
+		static size_t slot(ChunkPos pos)
+		{
+			return (pos.x & 3) | ((pos.y & 3) << 2);
+		}
+
+		Entry entries_[SIZE];
+		uint64_t generation_ = 0;
+	};
+
+	ChunkIndex() = default;
+
+	Chunk *find(ChunkPos pos) const
+	{
+		Region *region = findRegion(regionKey(pos));
+		if (!region) {
+			return nullptr;
+		}
+
+		return region->chunks[localIndex(pos)].get();
+	}
+
+	bool contains(ChunkPos pos) const
+	{
+		return find(pos) != nullptr;
+	}
+
+	// Insert a chunk at chunk.pos(). If there's already a chunk there,
+	// it's left alone and returned instead.
+	Chunk &insert(Chunk &&chunk);
+
+	void erase(ChunkPos pos);
+	void clear();
+
+	// Make every Cache drop its entries, e.g when a chunk gets deactivated
+	void invalidateCaches()
+	{
+		generation_ += 1;
+	}
+
+	size_t size() const { return size_; }
+	size_t regionCount() const { return regions_.size(); }
+
+	// Call 'func' with every chunk, region by region
+	template<typename Func>
+	void forEach(Func &&func)
+	{
+		for (auto &region: regions_) {
+			if (region->count == 0) {
+				continue;
+			}
+
+			for (auto &chunk: region->chunks) {
+				if (chunk) {
+					func(*chunk);
+				}
+			}
+		}
+	}
+
+	template<typename Func>
+	void forEach(Func &&func) const
+	{
+		for (auto &region: regions_) {
+			if (region->count == 0) {
+				continue;
+			}
+
+			for (auto &chunk: region->chunks) {
+				if (chunk) {
+					func(static_cast<const Chunk &>(*chunk));
+				}
+			}
+		}
+	}
+
+private:
+	struct Region {
+		std::unique_ptr<Chunk> chunks[REGION_SIZE * REGION_SIZE];
+		size_t count = 0;
+	};
+
+	struct Slot {
+		uint64_t key;
+		Region *region;
+	};
+
+	static uint64_t regionKey(ChunkPos pos)
+	{
+		return
+			(uint64_t(uint32_t(pos.x >> REGION_SHIFT)) << 32) |
+			uint32_t(pos.y >> REGION_SHIFT);
+	}
+
+	static size_t localIndex(ChunkPos pos)
+	{
+		return
+			(pos.y & (REGION_SIZE - 1)) * REGION_SIZE +
+			(pos.x & (REGION_SIZE - 1));
+	}
+
+	static size_t hashKey(uint64_t key)
+	{
+		key ^= key >> 29;
+		key *= 0xbf58476d1ce4e5b9ull;
+		key ^= key >> 32;
+		return size_t(key);
+	}
+
+	Region *findRegion(uint64_t key) const
+	{
+		if (slots_.empty()) {
+			return nullptr;
+		}
+
+		size_t mask = slots_.size() - 1;
+		size_t index = hashKey(key) & mask;
+		while (true) {
+			const Slot &slot = slots_[index];
+			if (!slot.region) {
+				return nullptr;
+			}
+
+			if (slot.key == key) {
+				return slot.region;
+			}
+
+			index = (index + 1) & mask;
+		}
+	}
+
+	Region &getOrCreateRegion(uint64_t key);
+	void rehash(size_t newCap);
+
+	std::vector<Slot> slots_;
+	std::vector<std::unique_ptr<Region>> regions_;
+	size_t size_ = 0;
+	uint64_t generation_ = 1;
+};
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <swan/util.h>
+#include "common.h"
+
+namespace Swan {
+
+/*
+ * Where compressed chunks go when there's no room for them in memory.
+ * When a plane's chunks use more memory than the budget allows, the
+ * least recently used compressed chunks are written to a swap file and
+ * dropped, until something needs them again.
+ *
+ * The swap file is scratch space for the running game, not part of the
+ * save; it's deleted when the swap is closed. The space a chunk used is
+ * reused by later chunks once it's read back.
+ */
+class ChunkSwap: NonCopyable {
+public:
+	struct Stats {
+		size_t evictions = 0;
+		size_t faults = 0;
+		size_t liveBytes = 0;
+		size_t fileBytes = 0;
+	};
+
+	struct Page {
+		// Chunks are stored as flat capnp messages, so they're read back
+		// into word aligned memory
+		std::vector<uint64_t> words;
+		bool needsSave;
+	};
+
+	ChunkSwap() = default;
+	~ChunkSwap() { close(); }
+
+	// The file is only created once the first chunk is put in it
+	void setPath(std::filesystem::path path);
+
+	// Delete the file, and forget every chunk in it
+	void close();
+
+	bool contains(ChunkPos pos) const
+	{
+		return entries_.contains(pos);
+	}
+
+	size_t chunkCount() const
+	{
+		return entries_.size();
+	}
+
+	// Every chunk in the swap, and whether it needs saving
+	std::vector<std::pair<ChunkPos, bool>> list() const;
+
+	// 'data' must be a whole number of words long.
+	// Returns false if it couldn't be written, in which case the chunk
+	// has to stay in memory.
+	bool put(ChunkPos pos, std::span<const unsigned char> data, bool needsSave);
+
+	// Read a chunk back, and remove it from the swap.
+	// If it can't be read, it stays in the swap.
+	std::optional<Page> take(ChunkPos pos);
+
+	const Stats &stats() const { return stats_; }
+
+private:
+	struct Entry {
+		size_t offset;
+		size_t size;
+		bool needsSave;
+	};
+
+	void release(size_t offset, size_t size);
+
+	std::filesystem::path path_;
+	std::fstream file_;
+	std::unordered_map<ChunkPos, Entry> entries_;
+
+	// Unused extents in the file, by size
+	std::multimap<size_t, size_t> free_;
+	size_t end_ = 0;
+
+	Stats stats_;
+};
+
+}
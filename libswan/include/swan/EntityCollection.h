@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "Clock.h"
 #include "Entity.h"
 #include "traits/BodyTrait.h"
 #include "swan.capnp.h"
@@ -126,12 +127,29 @@ public:
 	virtual EntityRef spawn(Ctx &ctx) = 0;
 	virtual EntityRef spawn(Ctx &ctx, capnp::Data::Reader data) = 0;
 	virtual void update(Ctx &ctx, float dt) = 0;
-	virtual void tick(Ctx &ctx, float dt) = 0;
-	virtual void tick2(Ctx &ctx, float dt) = 0;
+
+	// Tick the entities from index 'begin' on, until all of them are done
+	// or the deadline passes. Returns the index to continue from,
+	// which is size() once every entity has been ticked.
+	// Erasing entities moves others around, so there must be no erases
+	// between a call which stopped early and the one which continues.
+	virtual size_t tick(
+		Ctx &ctx, float dt, size_t begin, RTDeadline deadline) = 0;
+	virtual size_t tick2(
+		Ctx &ctx, float dt, size_t begin, RTDeadline deadline) = 0;
+
 	virtual void draw(Ctx &ctx, Cygnet::Renderer &rnd) = 0;
 	virtual void erase(Ctx &ctx, uint64_t id) = 0;
 	virtual void onWorldLoaded(Ctx &ctx) = 0;
 
+	// A packed message, as accepted by spawn(ctx, data)
+	virtual kj::Array<kj::byte> serializeEntity(Ctx &ctx, uint64_t id) = 0;
+
+	// Bring an entity back from what serializeEntity returned, with the ID
+	// it had before. Returns a nil ref if that fails, or if the ID is taken.
+	virtual EntityRef restore(
+		Ctx &ctx, uint64_t id, capnp::Data::Reader data) = 0;
+
 	virtual void serialize(
 		Ctx &ctx, proto::EntitySystem::Collection::Builder w) = 0;
 	virtual void deserialize(
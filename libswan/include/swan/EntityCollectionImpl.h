@@ -65,17 +65,26 @@ public:
 	}
 
 	void update(Ctx &ctx, float dt) override;
-	void tick(Ctx &ctx, float dt) override;
-	void tick2(Ctx &ctx, float dt) override;
+	size_t tick(
+		Ctx &ctx, float dt, size_t begin, RTDeadline deadline) override;
+	size_t tick2(
+		Ctx &ctx, float dt, size_t begin, RTDeadline deadline) override;
 	void draw(Ctx &ctx, Cygnet::Renderer &rnd) override;
 	void erase(Ctx &ctx, uint64_t id) override;
 	void onWorldLoaded(Ctx &ctx) override;
 
+	kj::Array<kj::byte> packEntity(Ctx &ctx, Ent &ent);
+	kj::Array<kj::byte> serializeEntity(Ctx &ctx, uint64_t id) override;
+	EntityRef restore(
+		Ctx &ctx, uint64_t id, capnp::Data::Reader data) override;
 	void serialize(
 		Ctx &ctx, proto::EntitySystem::Collection::Builder w) override;
 	void deserialize(
 		Ctx &ctx, proto::EntitySystem::Collection::Reader r) override;
 
+	// How many entities to tick between looking at the deadline
+	static constexpr size_t TICK_DEADLINE_INTERVAL = 16;
+
 	const std::string name_;
 	uint64_t nextId_ = 0;
 	std::vector<Wrapper> entities_;
@@ -323,40 +332,61 @@ inline void EntityCollectionImpl<Ent>::update(Ctx &ctx, float dt)
 }
 
 template<typename Ent>
-inline void EntityCollectionImpl<Ent>::tick(Ctx &ctx, float dt)
+inline size_t EntityCollectionImpl<Ent>::tick(
+	Ctx &ctx, float dt, size_t begin, RTDeadline deadline)
 {
 	ZoneScopedN(__PRETTY_FUNCTION__);
-	for (auto &w: entities_) {
+	size_t index = begin;
+	while (index < entities_.size()) {
 		ZoneScopedN("tick");
-		currentId_ = w.id;
-		w.ent.tick(ctx, dt);
+		currentId_ = entities_[index].id;
+		entities_[index].ent.tick(ctx, dt);
 
 		if constexpr (std::is_base_of_v<BodyTrait, Ent> ) {
+			// Spawning from the tick can have moved the entity in memory
+			auto &w = entities_[index];
 			Body &body = w.ent.get(BodyTrait::Tag{});
 			auto newChunkPos = chunkPos(tilePos(body.pos));
-			if (hasTicked_ && newChunkPos == body.chunkPos) {
-				continue;
+			if (!hasTicked_ || newChunkPos != body.chunkPos) {
+				EntityRef ref{this, w.id};
+				ctx.plane.getChunk(body.chunkPos).entities_.erase(ref);
+				ctx.plane.getChunk(newChunkPos).entities_.insert(ref);
+				body.chunkPos = newChunkPos;
 			}
+		}
 
-			EntityRef ref{this, w.id};
-			ctx.plane.getChunk(body.chunkPos).entities_.erase(ref);
-			ctx.plane.getChunk(newChunkPos).entities_.insert(ref);
-			body.chunkPos = newChunkPos;
+		index += 1;
+		if (index % TICK_DEADLINE_INTERVAL == 0 && deadline.passed()) {
+			break;
 		}
 	}
 
-	hasTicked_ = true;
+	if (index >= entities_.size()) {
+		hasTicked_ = true;
+	}
+
+	return index;
 }
 
 template<typename Ent>
-inline void EntityCollectionImpl<Ent>::tick2(Ctx &ctx, float dt)
+inline size_t EntityCollectionImpl<Ent>::tick2(
+	Ctx &ctx, float dt, size_t begin, RTDeadline deadline)
 {
 	ZoneScopedN(__PRETTY_FUNCTION__);
-	for (auto &w: entities_) {
+	size_t index = begin;
+	while (index < entities_.size()) {
 		ZoneScopedN("tick2");
+		auto &w = entities_[index];
 		currentId_ = w.id;
 		w.ent.tick2(ctx, dt);
+
+		index += 1;
+		if (index % TICK_DEADLINE_INTERVAL == 0 && deadline.passed()) {
+			break;
+		}
 	}
+
+	return index;
 }
 
 template<typename Ent>
@@ -422,6 +452,73 @@ inline void EntityCollectionImpl<Ent>::onWorldLoaded(Ctx &ctx)
 	}
 }
 
+template<typename Ent>
+inline kj::Array<kj::byte> EntityCollectionImpl<Ent>::packEntity(
+	Ctx &ctx, Ent &ent)
+{
+	capnp::MallocMessageBuilder mb;
+	auto root = mb.initRoot<typename Ent::Proto>();
+	ent.serialize(ctx, root);
+
+	kj::VectorOutputStream out;
+	capnp::writePackedMessage(out, mb);
+	auto arr = out.getArray();
+	return kj::heapArray<kj::byte>(arr.begin(), arr.size());
+}
+
+template<typename Ent>
+inline kj::Array<kj::byte> EntityCollectionImpl<Ent>::serializeEntity(
+	Ctx &ctx, uint64_t id)
+{
+	auto indexIt = idToIndex_.find(id);
+	if (indexIt == idToIndex_.end()) {
+		return nullptr;
+	}
+
+	return packEntity(ctx, entities_[indexIt->second].ent);
+}
+
+template<typename Ent>
+inline EntityRef EntityCollectionImpl<Ent>::restore(
+	Ctx &ctx, uint64_t id, capnp::Data::Reader data)
+{
+	if (idToIndex_.contains(id)) {
+		warn << "Attempt to restore " << name_ << " entity with existing ID " << id;
+		return {};
+	}
+
+	auto prevCurrentId = currentId_;
+	currentId_ = id;
+
+	size_t index = entities_.size();
+	auto &w = entities_.emplace_back(ctx);
+	w.id = id;
+
+	kj::ArrayInputStream stream(data);
+	capnp::PackedMessageReader reader(stream);
+	try {
+		w.ent.deserialize(ctx, reader.getRoot<typename Ent::Proto>());
+	} catch (std::exception &ex) {
+		warn << "Failed to restore " << name_ << " entity: " << ex.what();
+		entities_.pop_back();
+		currentId_ = prevCurrentId;
+		return {};
+	}
+
+	idToIndex_[id] = index;
+	nextId_ = std::max(nextId_, id + 1);
+
+	// Unlike a new entity, a restored one is already where it should be
+	if constexpr (std::is_base_of_v<BodyTrait, Ent> ) {
+		Body &body = w.ent.get(BodyTrait::Tag{});
+		body.chunkPos = chunkPos(tilePos(body.pos));
+		ctx.plane.getChunk(body.chunkPos).entities_.insert({this, id});
+	}
+
+	currentId_ = prevCurrentId;
+	return {this, id};
+}
+
 template<typename Ent>
 inline void EntityCollectionImpl<Ent>::serialize(
 	Ctx &ctx, proto::EntitySystem::Collection::Builder w)
@@ -443,14 +540,7 @@ inline void EntityCollectionImpl<Ent>::serialize(
 		auto &wrapper = entities_[i];
 		entities[i].setId(wrapper.id);
 
-		capnp::MallocMessageBuilder mb;
-		auto root = mb.initRoot<typename Ent::Proto>();
-		wrapper.ent.serialize(ctx, root);
-
-		kj::VectorOutputStream out;
-		capnp::writePackedMessage(out, mb);
-
-		auto arr = out.getArray();
+		auto arr = packEntity(ctx, wrapper.ent);
 		auto data = entities[i].initData(arr.size());
 		memcpy(&data.front(), &arr.front(), arr.size());
 
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+namespace Swan {
+
+/*
+ * A set of fluid cells, stored as one bitmap per chunk.
+ * The fluid system marks every cell it has queued or moved in a tick,
+ * and most of those are close together, so a bit per cell is a lot
+ * cheaper than hashing each position.
+ *
+ * Bitmaps are only created for chunks which have marked cells. Clearing
+ * zeroes the bitmaps in use, and keeps them around for the next round.
+ */
+class FluidActivityMap {
+public:
+	static constexpr int WIDTH = CHUNK_WIDTH * FLUID_RESOLUTION;
+	static constexpr int HEIGHT = CHUNK_HEIGHT * FLUID_RESOLUTION;
+	static constexpr size_t WORDS = size_t(WIDTH) * HEIGHT / 64;
+
+	static_assert(std::has_single_bit(unsigned(WIDTH)));
+	static_assert(std::has_single_bit(unsigned(HEIGHT)));
+	static_assert(WIDTH % 64 == 0);
+
+	// Mark a cell. Returns false if it was already marked.
+	bool insert(FluidPos pos)
+	{
+		Bitmap *bitmap = find(chunkOf(pos), true);
+		size_t bit = bitOf(pos);
+		uint64_t &word = bitmap->words[bit / 64];
+		uint64_t mask = uint64_t(1) << (bit % 64);
+		if (word & mask) {
+			return false;
+		}
+
+		word |= mask;
+		return true;
+	}
+
+	bool contains(FluidPos pos)
+	{
+		Bitmap *bitmap = find(chunkOf(pos), false);
+		if (!bitmap) {
+			return false;
+		}
+
+		size_t bit = bitOf(pos);
+		return bitmap->words[bit / 64] & (uint64_t(1) << (bit % 64));
+	}
+
+	// Mark every cell which is marked in 'other'
+	void merge(const FluidActivityMap &other)
+	{
+		for (size_t i = 0; i < other.used_; ++i) {
+			const Bitmap &src = *other.bitmaps_[i];
+			Bitmap *dest = find(src.pos, true);
+			for (size_t w = 0; w < WORDS; ++w) {
+				dest->words[w] |= src.words[w];
+			}
+		}
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < used_; ++i) {
+			memset(bitmaps_[i]->words, 0, sizeof(bitmaps_[i]->words));
+		}
+
+		index_.clear();
+		used_ = 0;
+		last_ = nullptr;
+	}
+
+	// The number of chunks with marked cells
+	size_t chunkCount() const { return used_; }
+
+private:
+	static constexpr int X_SHIFT = std::countr_zero(unsigned(WIDTH));
+	static constexpr int Y_SHIFT = std::countr_zero(unsigned(HEIGHT));
+	static constexpr size_t LINEAR_SEARCH_MAX = 8;
+
+	struct Bitmap {
+		ChunkPos pos;
+		uint64_t words[WORDS];
+	};
+
+	static ChunkPos chunkOf(FluidPos pos)
+	{
+		// Arithmetic shifts round towards negative infinity
+		return {int(pos.x >> X_SHIFT), int(pos.y >> Y_SHIFT)};
+	}
+
+	static size_t bitOf(FluidPos pos)
+	{
+		return size_t(pos.y & (HEIGHT - 1)) * WIDTH + size_t(pos.x & (WIDTH - 1));
+	}
+
+	Bitmap *find(ChunkPos pos, bool create)
+	{
+		if (last_ && last_->pos == pos) {
+			return last_;
+		}
+
+		// Updates are usually spread over a handful of chunks,
+		// which are quicker to look through than to hash
+		if (used_ <= LINEAR_SEARCH_MAX) {
+			for (size_t i = 0; i < used_; ++i) {
+				if (bitmaps_[i]->pos == pos) {
+					last_ = bitmaps_[i].get();
+					return last_;
+				}
+			}
+		} else if (auto it = index_.find(pos); it != index_.end()) {
+			last_ = it->second;
+			return last_;
+		}
+
+		if (!create) {
+			return nullptr;
+		}
+
+		if (used_ == bitmaps_.size()) {
+			auto bitmap = std::make_unique<Bitmap>();
+			memset(bitmap->words, 0, sizeof(bitmap->words));
+			bitmaps_.push_back(std::move(bitmap));
+		}
+
+		last_ = bitmaps_[used_++].get();
+		last_->pos = pos;
+		index_[pos] = last_;
+		return last_;
+	}
+
+	// The first 'used_' bitmaps are in use, the rest are zeroed spares
+	std::vector<std::unique_ptr<Bitmap>> bitmaps_;
+	size_t used_ = 0;
+	std::unordered_map<ChunkPos, Bitmap *> index_;
+	Bitmap *last_ = nullptr;
+};
+
+}
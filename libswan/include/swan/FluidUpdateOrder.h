@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+namespace Swan {
+
+/*
+ * Puts a tick's fluid updates in a random order, so that fluids don't
+ * favour any direction, but one which doesn't jump all over memory.
+ * Updates are grouped by chunk and by band of cell rows within the
+ * chunk; the groups are visited in a random order, and the updates
+ * within each group are shuffled.
+ */
+class FluidUpdateOrder {
+public:
+	// Rows of fluid cells per band
+	static constexpr int BAND_ROWS = 16;
+
+	void shuffle(std::vector<FluidPos> &updates, uint64_t seed);
+
+	// Identifies the chunk and band of rows a cell is in
+	static uint64_t bucketOf(FluidPos pos);
+
+private:
+	static constexpr uint32_t EMPTY = ~uint32_t(0);
+
+	// Find the dense index of a bucket, adding it if it's new
+	uint32_t bucketIndex(uint64_t bucket);
+	void growTable();
+
+	// Open addressing table from bucket to dense index
+	std::vector<uint64_t> tableKeys_;
+	std::vector<uint32_t> tableValues_;
+
+	// Per bucket: its number of updates, then where it starts
+	std::vector<uint32_t> counts_;
+	std::vector<uint32_t> starts_;
+	std::vector<uint32_t> bucketOrder_;
+
+	std::vector<uint32_t> updateBuckets_;
+	std::vector<FluidPos> out_;
+};
+
+}
@@ -19,12 +19,16 @@
 #include "World.h"
 #include "SoundPlayer.h"
 #include "FrameRecorder.h"
+#include "WorkerPool.h"
+#include "WorldJournal.h"
+#include "WorldSaver.h"
 
 namespace Swan {
 
 class Game {
 public:
 	Game(std::function<bool()> recompileMods);
+	~Game();
 
 	struct Debug {
 		bool show = false;
@@ -122,6 +126,14 @@ public:
 	void screenshot(const char *path, int w = -1, int h = -1);
 
 	void update(float dt);
+
+	// Snapshot the world at the end of the current tick, and write it in
+	// the background. 'done' is called on the main thread once the save
+	// is on disk. Returns false if a save is already in progress,
+	// or if a tick is in progress.
+	bool saveAsync(std::function<void(bool ok)> done = nullptr);
+
+	// Save, and wait for everything to be written
 	void save();
 
 	InputHandler &inputs() { return inputHandler_; }
@@ -130,6 +142,13 @@ public:
 	CommandSpec *matchCommand(std::span<CowStr> tokens, std::vector<CowStr> &out);
 	void runCommand(Ctx &ctx, std::string_view command, std::string &out);
 
+	// Declared before the world, since chunks may have jobs in flight
+	WorkerPool workers_;
+	WorldSaver saver_;
+
+	// Changes since the last save, so that they survive a crash
+	WorldJournal journal_;
+
 	std::unique_ptr<World> world_ = NULL;
 	std::string worldPath_;
 	Cygnet::Renderer renderer_;
@@ -146,6 +165,21 @@ public:
 	float timeScale_ = 1.0;
 	std::optional<float> fixedDeltaTime_;
 	float fpsLimit_ = 0;
+	Chunk::TileStorage chunkTileStorage_ = Chunk::TileStorage::FLAT;
+
+	// gzip levels for chunks which are compressed in memory, and for saves.
+	// GZIP_LEVEL_NONE means plain RLE.
+	int chunkMemoryGzipLevel_ = GZIP_LEVEL_FASTEST;
+	int chunkSaveGzipLevel_ = 6;
+
+	// Save modified chunks as the difference to what the world gen makes
+	bool chunkSaveDeltas_ = false;
+
+	// When chunks use more memory than this, compressed chunks are paged out
+	int chunkMemoryBudgetMiB_ = 1024;
+
+	// How long each update can spend initializing new chunks
+	float chunkInitBudgetMs_ = 2;
 	Debug debug_;
 	Perf perf_;
 	std::vector<EntityRef> debugEntities_;
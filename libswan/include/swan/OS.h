@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
 #include <string>
 #include <swan/util.h>
 
@@ -27,6 +31,67 @@ private:
 	void *handle_ = nullptr;
 };
 
+// Allocate page-aligned, zeroed memory straight from the OS.
+// Where supported, the OS is asked to back it with huge pages.
+// Returns nullptr on failure.
+void *allocPages(size_t size);
+void freePages(void *ptr, size_t size);
+
+// Write 'parts' to a temporary file next to 'path', flush it all the way
+// to disk and then move it into place, so that 'path' always has either
+// the old or the new contents, even after a crash.
+bool writeFileDurably(
+	const std::filesystem::path &path,
+	std::span<const std::span<const unsigned char>> parts);
+
+// A file which is only ever appended to, where every append
+// is flushed all the way to disk before it returns.
+class AppendFile: NonCopyable {
+public:
+	AppendFile() = default;
+	AppendFile(AppendFile &&af) noexcept;
+	~AppendFile();
+
+	AppendFile &operator=(AppendFile &&af) noexcept;
+
+	// Creates the file if it doesn't exist. Anything past the first
+	// 'keep' bytes is cut off, which also drops a torn write at the end.
+	bool open(const std::filesystem::path &path, size_t keep = 0);
+	void close();
+
+	bool append(std::span<const unsigned char> data);
+
+	bool isOpen() const { return handle_ != -1; }
+	size_t size() const { return size_; }
+
+private:
+	// A file descriptor, or a HANDLE on Windows
+	intptr_t handle_ = -1;
+	size_t size_ = 0;
+};
+
+// A read-only view of a whole file. The mapping is page aligned,
+// so it's suitably aligned for anything which lives at the start of the file.
+class MappedFile: NonCopyable {
+public:
+	MappedFile() = default;
+	MappedFile(MappedFile &&mf) noexcept;
+	~MappedFile();
+
+	MappedFile &operator=(MappedFile &&mf) noexcept;
+
+	// Returns false if the file can't be opened or is empty
+	bool open(const std::filesystem::path &path);
+	void close();
+
+	const unsigned char *data() const { return (const unsigned char *)data_; }
+	size_t size() const { return size_; }
+
+private:
+	void *data_ = nullptr;
+	size_t size_ = 0;
+};
+
 }
 
 }
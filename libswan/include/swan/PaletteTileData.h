@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <swan/constants.h>
+
+namespace Swan {
+
+/*
+ * Compact storage for one layer of a chunk's tile IDs.
+ * Every distinct tile ID in the chunk gets an entry in the palette,
+ * and each tile is stored as a bit-packed index into that palette.
+ * The index width is 0, 1, 2, 4 or 8 bits, and grows automatically
+ * when a tile ID which isn't in the palette is set.
+ * If a chunk ends up with more than 256 distinct IDs, the palette is dropped
+ * and IDs are stored directly as 16-bit values.
+ */
+class PaletteTileData {
+public:
+	using ID = uint16_t;
+
+	static constexpr size_t SIZE = CHUNK_WIDTH * CHUNK_HEIGHT;
+
+	// A default-constructed PaletteTileData holds no memory,
+	// and has to be filled with pack() or clear() before use.
+	PaletteTileData() = default;
+	explicit PaletteTileData(ID fill);
+
+	ID get(size_t index) const
+	{
+		if (bits_ == 0) {
+			return palette_[0];
+		}
+
+		size_t bit = index * bits_;
+		ID val = (words_[bit / 64] >> (bit % 64)) & mask();
+		if (bits_ == DIRECT_BITS) {
+			return val;
+		}
+
+		return palette_[val];
+	}
+
+	void set(size_t index, ID id);
+
+	// Replace the whole contents, picking the smallest index width
+	// which fits. This also drops palette entries which are no longer used.
+	void pack(std::span<const ID> in);
+	void unpack(std::span<ID> out) const;
+
+	// Fill with a single ID, releasing the index memory
+	void clear(ID fill);
+
+	// Release all memory, going back to the default-constructed state
+	void reset();
+
+	int bitsPerTile() const { return bits_; }
+	size_t paletteSize() const { return palette_.size(); }
+	size_t getMemUsage() const;
+
+private:
+	static constexpr int DIRECT_BITS = 16;
+
+	uint64_t mask() const
+	{
+		return (uint64_t(1) << bits_) - 1;
+	}
+
+	int findOrInsert(ID id);
+	void resize(int bits);
+
+	std::vector<ID> palette_;
+	std::vector<uint64_t> words_;
+	int bits_ = 0;
+};
+
+}
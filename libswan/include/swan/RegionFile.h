@@ -0,0 +1,114 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <capnp/serialize.h>
+#include <kj/array.h>
+
+#include "common.h"
+#include "OS.h"
+#include "swan.capnp.h"
+
+namespace Swan {
+
+// The position of a region, in units of RegionFile::SIZE chunks
+using RegionPos = Vec2i;
+
+/*
+ * Modified chunks are saved in region files of SIZE * SIZE chunks each,
+ * so that a save only has to rewrite the regions which actually changed.
+ *
+ * A region file is a header, followed by an index of SIZE * SIZE entries,
+ * followed by the chunks. Every chunk is an unpacked capnp message with
+ * a proto::Chunk root, starting at a word boundary. Index entries hold
+ * the offset and length of a chunk in words, or zeroes for chunks which
+ * aren't in the region. All numbers are little endian uint32s:
+ *
+ *   magic "SWRG", version, SIZE, 0
+ *   SIZE * SIZE * (offset, length)
+ *   chunk messages
+ */
+namespace RegionFile {
+
+constexpr int SHIFT = 5;
+constexpr int SIZE = 1 << SHIFT;
+
+inline RegionPos regionPos(ChunkPos pos)
+{
+	return {pos.x >> SHIFT, pos.y >> SHIFT};
+}
+
+inline ChunkPos firstChunk(RegionPos pos)
+{
+	return {pos.x << SHIFT, pos.y << SHIFT};
+}
+
+std::filesystem::path path(const std::filesystem::path &dir, RegionPos pos);
+
+}
+
+/*
+ * Region files are memory mapped rather than read, and the chunk messages
+ * are read in place. Chunks may keep pointing into the file after
+ * the reader is gone; they hold on to backing() to keep it mapped.
+ */
+class RegionReader {
+public:
+	// Returns false if the file can't be read or isn't a valid region file
+	bool load(const std::filesystem::path &path);
+
+	// Call 'func' with a proto::Chunk::Reader for every chunk in the region
+	template<typename Func>
+	void forEachChunk(Func &&func) const
+	{
+		for (auto &entry: entries_) {
+			if (entry.length == 0) {
+				continue;
+			}
+
+			capnp::FlatArrayMessageReader reader(
+				kj::ArrayPtr(words() + entry.offset, entry.length));
+			func(reader.getRoot<proto::Chunk>());
+		}
+	}
+
+	size_t chunkCount() const;
+
+	std::shared_ptr<const void> backing() const
+	{
+		return file_;
+	}
+
+private:
+	struct Entry {
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	const capnp::word *words() const
+	{
+		return (const capnp::word *)file_->data();
+	}
+
+	std::shared_ptr<OS::MappedFile> file_;
+	std::vector<Entry> entries_;
+};
+
+class RegionWriter {
+public:
+	RegionWriter();
+
+	// 'mb' must contain a proto::Chunk for a chunk in this region.
+	// Different chunks can be set from different threads at the same time.
+	void setChunk(ChunkPos pos, capnp::MessageBuilder &mb);
+
+	// Written with OS::writeFileDurably,
+	// so a failed write never leaves a half written region behind
+	bool write(const std::filesystem::path &path) const;
+
+private:
+	std::vector<kj::Array<capnp::word>> chunks_;
+};
+
+}
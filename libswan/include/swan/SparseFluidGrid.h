@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <swan/constants.h>
+#include <swan/Vector2.h>
+
+namespace Swan {
+
+/*
+ * The fluid cells of one chunk, stored with tile granularity.
+ * Each tile is either entirely air, entirely solid, or has a block of
+ * FLUID_RESOLUTION * FLUID_RESOLUTION cells allocated for it.
+ * Nothing at all is allocated until the first tile which isn't air
+ * is written, and blocks are only allocated for tiles which aren't uniform.
+ *
+ * Blocks live in fixed-size pages which are never moved or freed
+ * until reset(), so pointers returned by getForWrite() stay valid
+ * even when other blocks get allocated.
+ */
+class SparseFluidGrid {
+public:
+	static constexpr int WIDTH = CHUNK_WIDTH * FLUID_RESOLUTION;
+	static constexpr int HEIGHT = CHUNK_HEIGHT * FLUID_RESOLUTION;
+	static constexpr size_t SIZE = WIDTH * HEIGHT;
+	static constexpr size_t BLOCK_SIZE = FLUID_RESOLUTION * FLUID_RESOLUTION;
+
+	// Raw cell values which a whole tile can have without a block
+	static constexpr uint8_t AIR = 0;
+	static constexpr uint8_t SOLID = 1;
+
+	// Get the value of the cell at 'cell', in fluid cell coordinates
+	uint8_t get(Vec2i cell) const
+	{
+		uint16_t e = entry(tileIndex(cell));
+		if (e < FIRST_BLOCK) {
+			return uint8_t(e);
+		}
+
+		return block(e)[cellIndex(cell)];
+	}
+
+	// Get a pointer to the cell at 'cell',
+	// allocating a block for its tile if necessary
+	uint8_t *getForWrite(Vec2i cell)
+	{
+		return &blockForWrite(tileIndex(cell))[cellIndex(cell)];
+	}
+
+	void set(Vec2i cell, uint8_t value)
+	{
+		if (get(cell) != value) {
+			*getForWrite(cell) = value;
+		}
+	}
+
+	// The block for the tile at 'tile', in tile coordinates,
+	// or nullptr if the tile is uniformly AIR or SOLID
+	const uint8_t *peekBlock(Vec2i tile) const
+	{
+		uint16_t e = entry(tile.y * CHUNK_WIDTH + tile.x);
+		return e < FIRST_BLOCK ? nullptr : block(e);
+	}
+
+	uint8_t *blockForWrite(Vec2i tile)
+	{
+		return blockForWrite(tile.y * CHUNK_WIDTH + tile.x);
+	}
+
+	// Set every cell in a tile to 'value'.
+	// Filling with AIR or SOLID releases the tile's block.
+	void fillTile(Vec2i tile, uint8_t value);
+
+	// Release the tile's block if all its cells are AIR or all are SOLID
+	void collapseTile(Vec2i tile);
+
+	// Replace the whole contents from a flat WIDTH * HEIGHT array
+	void pack(std::span<const uint8_t> in);
+	void unpack(std::span<uint8_t> out) const;
+
+	// Like unpack, but only fills in the rows of tiles [begin, end)
+	void unpackRows(std::span<uint8_t> out, int begin, int end) const;
+
+	// Release all memory, making every cell air
+	void reset();
+
+	size_t blockCount() const { return blockSlots_ - freeBlocks_.size(); }
+	size_t getMemUsage() const;
+
+private:
+	static constexpr uint16_t FIRST_BLOCK = 2;
+	static constexpr size_t BLOCKS_PER_PAGE = 256;
+
+	static size_t tileIndex(Vec2i cell)
+	{
+		return
+			(cell.y / FLUID_RESOLUTION) * CHUNK_WIDTH +
+			(cell.x / FLUID_RESOLUTION);
+	}
+
+	static size_t cellIndex(Vec2i cell)
+	{
+		return
+			(cell.y % FLUID_RESOLUTION) * FLUID_RESOLUTION +
+			(cell.x % FLUID_RESOLUTION);
+	}
+
+	uint16_t entry(size_t tile) const
+	{
+		return index_ ? index_[tile] : fill_;
+	}
+
+	uint8_t *block(uint16_t e) const
+	{
+		size_t b = e - FIRST_BLOCK;
+		return pages_[b / BLOCKS_PER_PAGE].get() + (b % BLOCKS_PER_PAGE) * BLOCK_SIZE;
+	}
+
+	uint8_t *blockForWrite(size_t tile);
+	void allocIndex();
+	uint16_t allocBlock();
+
+	// One entry per tile: AIR, SOLID, or FIRST_BLOCK + block number.
+	// While there's no index, every tile is 'fill_'.
+	std::unique_ptr<uint16_t[]> index_;
+	uint16_t fill_ = AIR;
+
+	std::vector<std::unique_ptr<uint8_t[]>> pages_;
+	std::vector<uint16_t> freeBlocks_;
+	size_t blockSlots_ = 0;
+};
+
+}
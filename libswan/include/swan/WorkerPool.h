@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <swan/util.h>
+
+namespace Swan {
+
+/*
+ * A fixed set of background threads which run jobs in submission order.
+ * Jobs must not touch anything the main thread might be using at the
+ * same time; the submitter is responsible for that.
+ * Destroying the pool runs every queued job to completion first.
+ * A job which throws is marked as done, and keeps the exception for
+ * whoever waits on it to rethrow().
+ */
+class WorkerPool: NonCopyable {
+public:
+	class Job: NonCopyable {
+	public:
+		bool done() const
+		{
+			return done_.load(std::memory_order_acquire);
+		}
+
+		// Block until the job has finished running
+		void wait() const
+		{
+			done_.wait(false, std::memory_order_acquire);
+		}
+
+		// If the job threw, throw that again on this thread.
+		// Only call this once the job is done.
+		void rethrow() const
+		{
+			if (error_) {
+				std::rethrow_exception(error_);
+			}
+		}
+
+		bool failed() const
+		{
+			return error_ != nullptr;
+		}
+
+	private:
+		std::function<void()> func_;
+		std::exception_ptr error_;
+		std::atomic<bool> done_ = false;
+
+		friend WorkerPool;
+	};
+
+	using JobPtr = std::shared_ptr<Job>;
+
+	// With 0 threads, use one less than the number of hardware threads
+	explicit WorkerPool(int threads = 0);
+	~WorkerPool();
+
+	JobPtr submit(std::function<void()> func);
+
+	size_t threadCount() const { return threads_.size(); }
+
+	// Number of jobs which are queued or running
+	size_t pendingJobs() const
+	{
+		return pending_.load(std::memory_order_relaxed);
+	}
+
+private:
+	void run();
+
+	bool running_ = true;
+	std::deque<JobPtr> queue_;
+	std::atomic<size_t> pending_ = 0;
+	std::condition_variable cond_;
+	std::mutex mut_;
+	std::vector<std::thread> threads_;
+};
+
+}
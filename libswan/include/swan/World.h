@@ -17,6 +17,7 @@
 #include "Tile.h"
 #include "WorldPlane.h"
 #include "WorldGen.h"
+#include "WorldJournal.h"
 #include "Entity.h"
 #include "EntityCollection.h"
 #include "Mod.h"
@@ -65,6 +66,11 @@ public:
 		return *planes_[currentPlane_].plane;
 	}
 
+	WorldPlane *getPlane(WorldPlane::ID id)
+	{
+		return id < planes_.size() ? planes_[id].plane.get() : nullptr;
+	}
+
 	WorldPlane &addPlane(std::string gen);
 
 	WorldPlane &addPlane()
@@ -146,8 +152,15 @@ public:
 
 	uint32_t seed() const { return seed_; }
 
-	void serialize(proto::World::Builder w);
-	void deserialize(proto::World::Reader r);
+	// Each plane keeps its region files in its own directory in 'regionDir'.
+	// See WorldPlane::serialize for 'regionSnapshots'.
+	void serialize(
+		proto::World::Builder w, const std::filesystem::path &regionDir,
+		std::vector<WorldPlane::RegionSnapshot> &regionSnapshots);
+	void deserialize(proto::World::Reader r, const std::filesystem::path &regionDir);
+
+	// Apply journal records on top of a freshly loaded world
+	void replayJournal(std::span<const WorldJournal::Record> records);
 
 	// These things get filled in when the ctor loads mods.
 	std::vector<Tile> tiles_;
@@ -172,10 +185,17 @@ public:
 	EntityRef playerRef_;
 	Body *player_;
 
+	// Changes to the world get recorded here, unless it's null
+	WorldJournal *journal_ = nullptr;
+
 private:
 	class ChunkRenderer {
 	public:
 		void tick(WorldPlane &plane, ChunkPos abspos);
+
+		// Prefetch the chunks along the path the player is moving along,
+		// so that they're ready by the time the player gets there
+		void prefetchAhead(WorldPlane &plane, Vec2 pos, Vec2 vel);
 	};
 
 	struct PlaneWrapper {
@@ -27,6 +27,12 @@ public:
 	virtual Cygnet::Color backgroundColor(Vec2 pos) = 0;
 
 	virtual void genChunk(WorldPlane &plane, Chunk &chunk) = 0;
+
+	// Whether genChunk always generates the same chunk for the same
+	// position, and is safe to call from any thread for a chunk which
+	// isn't part of the plane. Chunks can then be saved as a delta
+	// against what genChunk generates.
+	virtual bool canRegenerate() { return false; }
 	virtual EntityRef spawnPlayer(Ctx &ctx) = 0;
 	virtual float getAirTemperature(Swan::TilePos pos) = 0;
 
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <swan/util.h>
+#include "common.h"
+#include "OS.h"
+
+namespace Swan {
+
+/*
+ * Between saves, changes to the world are appended to a journal,
+ * so that a crash only loses the last batch instead of everything since
+ * the last save. The tile, fluid and entity systems record changes as
+ * they happen; the game flushes them to disk in batches. When a world is
+ * loaded, the journal is replayed on top of the saved world. A save folds
+ * everything into the world and region files, and starts a new journal.
+ *
+ * Every save bumps the world's journal epoch, and every journal file
+ * belongs to one epoch. A journal has to be replayed if its epoch is at
+ * least the epoch of the saved world; older journals are already part of it.
+ *
+ * Only spawning and despawning entities is recorded, not what they do
+ * in between.
+ *
+ * A journal is a header, followed by batches. Every batch starts with its
+ * length and a checksum, so that a batch which was cut short by a crash
+ * can be told apart from a complete one. All numbers are little endian:
+ *
+ *   magic "SWJL", uint32 version, uint64 epoch
+ *   batches: uint32 length, uint32 checksum, records
+ *
+ * Records refer to tiles and fluids by IDs which are only valid within
+ * the journal file; a TILE_NAME or FLUID_NAME record names an ID before
+ * the first record which uses it.
+ */
+class WorldJournal: NonCopyable {
+public:
+	enum class RecordType: uint8_t {
+		TILE_NAME = 1,
+		FLUID_NAME,
+		SET_TILE,
+		SET_BACKGROUND,
+		SET_FLUID,
+		SPAWN_ENTITY,
+		DESPAWN_ENTITY,
+		SPAWN_TILE_ENTITY,
+		DESPAWN_TILE_ENTITY,
+	};
+
+	enum class FluidOp: uint8_t {
+		SET,
+		SET_PARTIAL,
+		REPLACE,
+	};
+
+	// A record as it's read back. Tile and fluid names are already resolved.
+	struct Record {
+		RecordType type;
+		uint16_t plane = 0;
+		TilePos pos = {};
+
+		// Tile, fluid or entity collection name
+		std::string name;
+
+		// Entity ID
+		uint64_t id = 0;
+
+		FluidOp fluidOp = FluidOp::SET;
+
+		// Packed entity proto
+		std::vector<unsigned char> data;
+	};
+
+	struct Contents {
+		uint64_t epoch;
+		std::vector<Record> records;
+
+		// The size of the file up to the end of the last complete batch
+		size_t validSize;
+	};
+
+	// Journal files live next to the world file
+	static std::filesystem::path path(
+		const std::filesystem::path &worldPath, uint64_t epoch);
+
+	// Every journal of 'worldPath', sorted by epoch
+	static std::vector<std::pair<uint64_t, std::filesystem::path>> find(
+		const std::filesystem::path &worldPath);
+
+	// Returns nothing if the file can't be read or has a bad header.
+	// Reading stops at the first incomplete or corrupt batch.
+	static std::optional<Contents> read(const std::filesystem::path &path);
+
+	WorldJournal() = default;
+	~WorldJournal() { close(); }
+
+	// Start a journal. With a 'keep' from Contents::validSize,
+	// keep appending to an existing journal instead.
+	bool open(const std::filesystem::path &path, uint64_t epoch, size_t keep = 0);
+	void close();
+
+	bool isOpen() const { return file_.isOpen(); }
+	uint64_t epoch() const { return epoch_; }
+
+	// The size of the journal on disk, not counting anything which isn't flushed
+	size_t size() const { return file_.size(); }
+	size_t pendingBytes() const { return batch_.size() - BATCH_HEADER_SIZE; }
+
+	void setTile(uint16_t plane, TilePos pos, uint16_t tile, std::string_view name);
+	void setBackground(uint16_t plane, TilePos pos, uint16_t tile, std::string_view name);
+	void setFluid(
+		uint16_t plane, TilePos pos, FluidOp op, uint8_t fluid, std::string_view name);
+	void spawnEntity(
+		uint16_t plane, std::string_view coll, uint64_t id,
+		std::span<const unsigned char> data);
+	void despawnEntity(uint16_t plane, std::string_view coll, uint64_t id);
+	void spawnTileEntity(uint16_t plane, TilePos pos, std::string_view name);
+	void despawnTileEntity(uint16_t plane, TilePos pos);
+
+	// Write everything recorded since the last flush to disk, as one batch
+	bool flush();
+
+private:
+	static constexpr size_t BATCH_HEADER_SIZE = 8;
+
+	template<typename T>
+	void put(T val);
+	void putString(std::string_view str);
+	void putHeader(RecordType type, uint16_t plane);
+	void putPos(TilePos pos);
+	void putTile(
+		RecordType type, uint16_t plane, TilePos pos,
+		uint16_t tile, std::string_view name);
+
+	OS::AppendFile file_;
+	uint64_t epoch_ = 0;
+
+	// Starts with room for the batch header
+	std::vector<unsigned char> batch_ = std::vector<unsigned char>(BATCH_HEADER_SIZE);
+
+	// Which tile and fluid IDs this file has a name for
+	std::vector<bool> tileNames_;
+	std::vector<bool> fluidNames_;
+};
+
+}
@@ -6,6 +6,8 @@
 #include <utility>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
 #include <functional>
 
 #include <swan/util.h>
@@ -16,8 +18,12 @@
 #include "systems/LightSystem.h"
 #include "systems/TileSystem.h"
 #include "Chunk.h"
+#include "ChunkIndex.h"
+#include "ChunkSwap.h"
+#include "RegionFile.h"
 #include "Tile.h"
 #include "WorldGen.h"
+#include "WorldJournal.h"
 
 namespace Swan {
 
@@ -28,13 +34,32 @@ class WorldPlane final: NonCopyable {
 public:
 	using ID = uint16_t;
 
+	// The phases of a tick, in the order they run in.
+	// A tick which runs out of time stops in one of them,
+	// and the next call to tick() resumes it there.
 	enum class TickProgress {
-		IDLE, FLUID_ONGOING,
+		IDLE,
+		WORLD_TICKS_ONGOING,
+		CHUNKS_ONGOING,
+		NEXT_TICK_ONGOING,
+		TILES_ONGOING,
+		ENTITIES_ONGOING,
+		FLUID_ONGOING,
+	};
+
+	struct GenStats {
+		// Chunks which were generated on the workers
+		size_t background = 0;
+
+		// Chunks which the main thread had to generate itself,
+		// or wait for
+		size_t stalls = 0;
 	};
 
 	WorldPlane(
 		ID id, World *world, std::unique_ptr<WorldGen> gen,
 		std::vector<std::unique_ptr<EntityCollection>> &&colls);
+	~WorldPlane();
 
 	Context getContext();
 
@@ -45,9 +70,17 @@ public:
 
 	bool hasChunk(ChunkPos pos);
 	Chunk &getChunk(ChunkPos pos);
+	Chunk &getChunk(ChunkPos pos, ChunkIndex::Cache &cache);
 	Chunk *subtleGetChunk(ChunkPos pos);
 	Chunk &slowGetChunk(ChunkPos pos);
 
+	// Get a chunk ready ahead of time. A compressed chunk gets decompressed
+	// in the background, and becomes active once that's done.
+	// A new chunk gets generated in the background too, if the world gen
+	// allows it. Returns the chunk if it's active, or null if it's not
+	// ready yet; unlike getChunk, it never blocks on world generation.
+	Chunk *prefetchChunk(ChunkPos pos);
+
 	EntityRef spawnPlayer();
 
 	bool breakTile(TilePos pos)
@@ -67,34 +100,174 @@ public:
 
 	void regenerate();
 
+	// Generate every missing chunk from 'from' to 'to', inclusive,
+	// spread over the workers. The chunks are initialized, compressed
+	// and kept as modified chunks, so that the next save writes them.
+	// Returns the number of chunks which were generated.
+	size_t pregenerate(ChunkPos from, ChunkPos to);
+
+	// Switch every chunk in the plane over to a different tile storage
+	void setTileStorage(Chunk::TileStorage storage);
+
 	size_t getChunkCount() { return chunks_.size(); }
 	size_t getActiveChunkCount() { return activeChunks_.size(); }
 	size_t getChunkDataMemUsage();
+	size_t getPendingCodecCount() { return codecChunks_.size(); }
+	size_t getGeneratingChunkCount() { return generating_.size(); }
+	size_t getChunkInitQueueSize() { return chunkInitList_.size(); }
+	const GenStats &getGenStats() { return genStats_; }
+	const ChunkBufferPool::Stats &getChunkBufferStats() { return bufferPool_.stats(); }
+	size_t getPagedOutChunkCount() { return swap_.chunkCount(); }
+	const ChunkSwap::Stats &getChunkSwapStats() { return swap_.stats(); }
+
+	// Page the least recently used compressed chunks out to the swap,
+	// until the chunks use a bit less memory than 'budget'
+	void pageOutChunks(size_t budget);
 
 	Cygnet::Color backgroundColor();
 	void draw(Cygnet::Renderer &rnd);
 	void update(float dt);
 	bool tick(float dt, RTDeadline deadline);
 
+	// A region which needs writing, captured by serialize(),
+	// so that it can be written on another thread
+	struct RegionSnapshot {
+		ID plane;
+		RegionPos pos;
+		std::filesystem::path path;
+		std::vector<Chunk::Snapshot> chunks;
+
+		// Some of its chunks couldn't be read back from the swap,
+		// so writing it would lose them; the saver counts it as failed
+		bool incomplete = false;
+	};
+
+	// If writing a region snapshot fails,
+	// this makes sure the next save tries again
+	void markRegionUnsaved(RegionPos pos);
+
 	ID id_;
 	World *world_;
 	std::unique_ptr<WorldGen> worldGen_;
 
 private:
-	void serialize(proto::WorldPlane::Builder w);
-	void deserialize(proto::WorldPlane::Reader r, std::span<Tile::ID> tileMap);
+	// Modified chunks are saved to region files in 'regionDir',
+	// everything else goes into the proto::WorldPlane.
+	// The region files aren't written here; 'regionSnapshots' gets
+	// the regions which need writing.
+	void serialize(
+		proto::WorldPlane::Builder w, const std::filesystem::path &regionDir,
+		std::vector<RegionSnapshot> &regionSnapshots);
+
+	void deserialize(
+		proto::WorldPlane::Reader r, Chunk::TileMap tileMap,
+		const std::filesystem::path &regionDir);
+	Chunk &deserializeChunk(
+		proto::Chunk::Reader r, Chunk::TileMap tileMap,
+		std::shared_ptr<const void> backing = nullptr);
+
+	// Apply the journal records which belong to this plane
+	void replay(std::span<const WorldJournal::Record> records);
+
+	void activateChunk(Chunk &chunk);
+	void pollChunkCodecs();
+
+	// A freshly generated chunk joins the active chunks
+	void addNewChunk(Chunk &chunk);
+
+	// Set up fluid collision for the chunk's tiles, and run their onSpawn
+	void initChunk(Chunk &chunk);
+
+	// Initialize the next few rows of a chunk, starting at 'row'.
+	// Returns the row to continue from.
+	int initChunkRows(Chunk &chunk, int row);
+
+	// Work through the chunk init list until the deadline has passed,
+	// but always make some progress
+	void initChunks(RTDeadline deadline);
+
+	// A chunk has to be initialized before it's deactivated
+	void finishChunkInit(Chunk &chunk);
 
-	std::unordered_map<ChunkPos, Chunk> chunks_;
+	// The resumable tick phases which loop over the active chunks.
+	// They return false if the deadline passed before they were done.
+	bool tickWorldTicks(RTDeadline deadline);
+	bool tickChunks(float dt, RTDeadline deadline);
+	void pollGeneratedChunks();
+
+	// Wait for the chunks which are being generated, and throw them away
+	void cancelGeneration();
+
+	// A compressed chunk gets in line to be paged out
+	void queuePageOut(Chunk &chunk);
+	bool pageOutChunk(Chunk &chunk);
+
+	// Returns the chunk, compressed, or null if it can't be read back
+	Chunk *pageInChunk(ChunkPos pos);
+
+	// Declared before the chunks, since it has to outlive them
+	ChunkBufferPool bufferPool_;
+
+	// Null if the world gen can't regenerate chunks
+	Chunk::Regenerator regenerator_;
+
+	ChunkIndex chunks_;
 	std::vector<Chunk *> activeChunks_;
-	std::vector<std::pair<ChunkPos, Chunk *>> tickChunks_;
 
-	std::deque<Chunk *> chunkInitList_;
+	// Used by getChunk when the caller doesn't bring its own cache
+	ChunkIndex::Cache chunkCache_;
+
+	// New chunks which have yet to be initialized,
+	// and the first row of each which hasn't been yet
+	struct ChunkInit {
+		Chunk *chunk;
+		int row;
+	};
+	std::deque<ChunkInit> chunkInitList_;
+
+	// Regions which have a region file on disk
+	std::unordered_set<RegionPos> savedRegions_;
+
+	// Regions which failed to save, and need to be saved again
+	std::unordered_set<RegionPos> unsavedRegions_;
+
+	// Chunks which are being compressed or decompressed in the background
+	std::vector<Chunk *> codecChunks_;
+
+	// Chunks which are being generated in the background. They aren't
+	// in the index until they're done, and the pointer keeps them in place.
+	struct GeneratingChunk {
+		std::unique_ptr<Chunk> chunk;
+		WorkerPool::JobPtr job;
+	};
+	std::unordered_map<ChunkPos, GeneratingChunk> generating_;
+	GenStats genStats_;
+
+	// Generation jobs run in order, so too many of them would hold up
+	// everything else on the workers
+	static constexpr size_t MAX_GENERATING_CHUNKS = 64;
+
+	// Compressed chunks in the order they were compressed in, along with
+	// their compressedStamp_; chunks which have been used since then have
+	// a newer stamp, and a newer entry further back
+	std::deque<std::pair<ChunkPos, uint64_t>> pageOutQueue_;
+	uint64_t pageOutStamp_ = 0;
+	int pageOutTicks_ = 0;
+
+	// Chunks which were paged out to make room
+	ChunkSwap swap_;
 
 	// Callbacks to run on next tick
 	std::vector<std::function<void(Ctx &)>> nextTickA_;
 	std::vector<std::function<void(Ctx &)>> nextTickB_;
 
 	TickProgress tickProgress_ = TickProgress::IDLE;
+
+	// Where the current tick phase is in the active chunks
+	// or nextTick callbacks
+	size_t tickIndex_ = 0;
+	bool tickDeletedChunk_ = false;
+
 	FluidSystem fluidSystem_{*this};
 	EntitySystem entitySystem_;
 	LightSystem lightSystem_{*this};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <capnp/message.h>
+
+#include <swan/util.h>
+#include "WorkerPool.h"
+#include "WorldPlane.h"
+
+namespace Swan {
+
+/*
+ * Writes saves on a background thread, so the game doesn't freeze.
+ * The main thread captures the world into a Snapshot: the world's capnp
+ * message, which is an arena of its own, and a Chunk::Snapshot of every
+ * modified chunk in the regions which need writing. The saver then gzips
+ * the chunks and writes the region files and the world file, all flushed
+ * to disk, while the game keeps running. Chunks are encoded on a small
+ * worker pool of the saver's own: a save queues a job for every chunk,
+ * which would hold up the game's chunk jobs in a shared pool, and the
+ * save isn't in a hurry, so it doesn't need a thread per core on top of
+ * the game's.
+ *
+ * There's only ever one snapshot; start() must not be called while busy().
+ */
+class WorldSaver: NonCopyable {
+public:
+	// World files start with this, followed by an unpacked capnp message.
+	// It's exactly one word long, so the message stays word aligned.
+	static constexpr char WORLD_MAGIC[8] = {'S', 'W', 'A', 'N', 'W', 'L', 'D', '1'};
+
+	struct Snapshot {
+		std::filesystem::path worldPath;
+		std::unique_ptr<capnp::MallocMessageBuilder> world;
+		std::vector<WorldPlane::RegionSnapshot> regions;
+		int gzipLevel;
+
+		// Store chunks as deltas against the world gen where that's smaller
+		bool deltaChunks;
+	};
+
+	struct Result {
+		bool ok = true;
+		size_t regionCount = 0;
+		double seconds = 0;
+
+		// Regions which couldn't be written
+		std::vector<std::pair<WorldPlane::ID, RegionPos>> failedRegions;
+	};
+
+	// Called on the main thread, from poll() or wait()
+	using Callback = std::function<void(const Result &)>;
+
+	static constexpr int DEFAULT_THREADS = 2;
+
+	explicit WorldSaver(int threads = DEFAULT_THREADS): workers_(threads) {}
+	~WorldSaver();
+
+	bool busy() const
+	{
+		return thread_.joinable();
+	}
+
+	void start(Snapshot snapshot, Callback cb);
+
+	// Call regularly from the main thread,
+	// runs the callback once the save is done
+	void poll();
+
+	// Block until the current save, if any, is done
+	void wait();
+
+private:
+	void run();
+	void finish();
+
+	WorkerPool workers_;
+	Snapshot snapshot_;
+	Result result_;
+	Callback callback_;
+	std::atomic<bool> done_ = false;
+	std::thread thread_;
+};
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Swan {
+
+// zlib's levels; 0 means "don't gzip at all" wherever a level is configured
+static constexpr int GZIP_LEVEL_NONE = 0;
+static constexpr int GZIP_LEVEL_FASTEST = 1;
+static constexpr int GZIP_LEVEL_BEST = 9;
+
+/**
+ * Compress a buffer with deflate, in the gzip format.
+ * The output is appended to 'out'. 'level' goes from 1 (fastest) to 9 (smallest).
+ */
+void gzipEncode(std::vector<uint8_t> &out, std::span<const uint8_t> in, int level);
+
+/**
+ * Decompress a buffer produced by gzipEncode.
+ * The output is appended to 'out'.
+ * Returns false if the input is corrupt or truncated.
+ */
+bool gzipDecode(std::vector<uint8_t> &out, std::span<const uint8_t> in);
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../common.h"
+#include "../Clock.h"
 #include "../Entity.h"
 #include "../EntityCollection.h"
 #include "../traits/BodyTrait.h"
@@ -9,6 +10,7 @@
 
 #include <memory>
 #include <span>
+#include <unordered_set>
 #include <vector>
 
 namespace Cygnet {
@@ -17,6 +19,7 @@ class Renderer;
 
 namespace Swan {
 
+class Chunk;
 class WorldPlane;
 class TileSystemImpl;
 
@@ -53,6 +56,7 @@ public:
 		auto ref = it->second->spawn<Ent, Args...>(ctx, std::forward<Args>(args)...);
 		ref->onSpawn(ctx);
 		currentCollection_ = prevCurrentColl;
+		journalSpawn(ref);
 		return ref;
 	}
 
@@ -72,6 +76,7 @@ public:
 		auto ref = it->second->spawnMove(ctx, std::move(ent));
 		ref->onSpawn(ctx);
 		currentCollection_ = prevCurrentColl;
+		journalSpawn(ref);
 		return ref;
 	}
 
@@ -94,17 +99,38 @@ public:
 
 	void draw(Cygnet::Renderer &rnd);
 	void update(float dt);
-	void tick(float dt);
+
+	// Every collection's tick runs before any collection's tick2.
+	// Returns false if the deadline passed before all entities were
+	// ticked; the next call continues with the next entity.
+	bool tick(float dt, RTDeadline deadline);
 
 	EntityCollection *getCollectionOf(std::string_view name);
 
 	void despawnAllTileEntities();
 
+	// Put the entities and tile entities in a chunk which is being
+	// deactivated to sleep in the chunk. They're serialized into it,
+	// and removed without being despawned.
+	// Returns false if the chunk had no entities.
+	bool hibernate(Chunk &chunk);
+
+	// Respawn the entities which went to sleep in a chunk, with their
+	// old IDs. While the collections are being iterated over,
+	// it's put off until they're done.
+	void wake(Chunk &chunk);
+
+	// For journal replay: the entity might be hibernating in some chunk,
+	// in which case it's dropped when it wakes up
+	void despawnHibernating(EntityRef ref);
+
 	void serialize(proto::EntitySystem::Builder w);
 	void deserialize(proto::EntitySystem::Reader r);
 
 private:
 	Context getContext();
+	void journalSpawn(EntityRef ref);
+	void wakePending();
 
 	WorldPlane &plane_;
 
@@ -114,12 +140,24 @@ private:
 	std::unordered_map<std::type_index, EntityCollection *> collectionsByType_;
 	HashMap<EntityCollection *> collectionsByName_;
 	EntityCollection *currentCollection_ = nullptr;
+
+	// How far into the collections the current tick has got,
+	// counting the tick2 pass as a second round
+	size_t tickIndex_ = 0;
+	// Where in that collection to continue from
+	size_t tickEntityIndex_ = 0;
 	std::vector<EntityRef> currentEntityStack_;
 
 	std::unordered_map<TilePos, EntityRef> tileEntities_;
 
 	std::vector<EntityRef> despawnListA_;
 	std::vector<EntityRef> despawnListB_;
+
+	// Chunks which were activated while the collections were busy
+	int iterating_ = 0;
+	std::vector<ChunkPos> pendingWakes_;
+
+	std::unordered_set<EntityRef> hibernatingDespawns_;
 };
 
 class EntitySystem: private EntitySystemImpl {
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "../FastHashSet.h"
+#include "../FluidActivityMap.h"
+#include "../FluidUpdateOrder.h"
+#include "../ChunkIndex.h"
 #include "../common.h"
 #include "../Fluid.h"
 #include "../Clock.h"
+#include "../SparseFluidGrid.h"
+#include "../WorldJournal.h"
 #include "swan.capnp.h"
 
 #include <cygnet/util.h>
@@ -24,6 +29,7 @@ public:
 	FluidSystemImpl(WorldPlane &plane): plane_(plane) {}
 
 	struct TickProgress {
+		bool ongoing = false;
 		size_t updateIndex = 0;
 	};
 
@@ -38,7 +44,7 @@ public:
 	void setSolid(TilePos pos, const FluidCollision &collision);
 	void clearSolid(TilePos pos);
 	void spawnFluidParticle(Vec2 pos, Fluid::ID fluid, Vec2 vel = {});
-	int numUpdates() { return updatesB_.size(); }
+	int numUpdates() { return numUpdates_; }
 	int numParticles() { return particles_.size(); }
 	Fluid &getAtPos(Vec2 pos);
 	bool takeFluidFromRow(TilePos pos, int y, Fluid::ID fluid);
@@ -65,9 +71,16 @@ private:
 		uint8_t remainingTime;
 	};
 
+	// Reference to one fluid cell.
+	// Reading doesn't allocate anything in the chunk's SparseFluidGrid,
+	// the cell is only materialized the first time it's written to
+	// with a value different from what it already has. The chunk is only
+	// marked as having modified fluids once that happens.
 	class FluidCellRef {
 	public:
-		FluidCellRef(uint8_t *value): value_(value) {}
+		FluidCellRef(Chunk *chunk, Vec2i cell):
+			chunk_(chunk), grid_(&chunk->getFluidData()), cell_(cell)
+		{}
 
 		void setAir();
 		bool isAir();
@@ -79,21 +92,128 @@ private:
 		void setID(Fluid::ID id);
 
 	private:
-		uint8_t *value_;
+		uint8_t get()
+		{
+			return value_ ? *value_ : grid_->get(cell_);
+		}
+
+		void write(uint8_t value)
+		{
+			if (!value_) {
+				if (grid_->get(cell_) == value) {
+					return;
+				}
+				int row = cell_.y / FLUID_RESOLUTION;
+				chunk_->setFluidModified(row, row + 1);
+				value_ = grid_->getForWrite(cell_);
+			}
+			*value_ = value;
+		}
+
+		Chunk *chunk_;
+		SparseFluidGrid *grid_;
+		Vec2i cell_;
+		uint8_t *value_ = nullptr;
 	};
 
+	// The fluid cells around one cell. The center cell's chunk is only
+	// looked up once; cells in the same chunk are addressed relative to
+	// the center, and only cells across a chunk edge need a lookup of
+	// their own.
+	class FluidNeighbourhood {
+	public:
+		FluidNeighbourhood(FluidSystemImpl &fluids, FluidPos pos);
+
+		// For when the chunk is already known. This never looks up
+		// any chunks, as long as only cells in 'chunk' are used.
+		FluidNeighbourhood(FluidSystemImpl &fluids, FluidPos pos, Chunk &chunk);
+
+		FluidCellRef at(int dx, int dy)
+		{
+			Vec2i cell = rel_.add(dx, dy);
+			if (
+				unsigned(cell.x) < unsigned(SparseFluidGrid::WIDTH) &&
+				unsigned(cell.y) < unsigned(SparseFluidGrid::HEIGHT)) {
+				return {chunk_, cell};
+			}
+
+			return fluids_.getFluidCell(pos_.add(dx, dy));
+		}
+
+	private:
+		FluidSystemImpl &fluids_;
+		FluidPos pos_;
+		Chunk *chunk_;
+		Vec2i rel_;
+	};
+
+	// Where applying the rules to a cell leaves its effects.
+	// On the main thread they're passed on every few cells,
+	// a worker keeps them until it's done with its chunk.
+	struct RuleOutput {
+		explicit RuleOutput(FluidActivityMap *moved): moved(moved) {}
+
+		FluidActivityMap *moved;
+
+		// Cells to call triggerUpdateAround for
+		std::vector<FluidPos> triggers;
+		std::vector<FluidParticle> particles;
+		uint32_t rng = 1;
+
+		uint32_t random()
+		{
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			return rng;
+		}
+	};
+
+	// The updates in one chunk which are far enough from its edges that
+	// applying the rules to them doesn't touch any other chunk
+	struct ChunkUpdates {
+		ChunkPos pos;
+		Chunk *chunk = nullptr;
+		std::vector<FluidPos> updates;
+		FluidActivityMap moved;
+		RuleOutput out{&moved};
+	};
+
+	// With fewer updates than this, they're all done on the main thread
+	static constexpr size_t PARALLEL_MIN_UPDATES = 4096;
+
 	void triggerUpdate(FluidPos pos);
 	void triggerUpdateAround(FluidPos pos);
 
-	void applyRules(FluidPos pos);
+	// 'chunk' is the chunk 'pos' is in, or null to look it up
+	void applyRules(FluidPos pos, Chunk *chunk, RuleOutput &out);
+	void flushRuleOutput(RuleOutput &out);
+
+	// Move the updates which aren't near a chunk edge from updatesB_
+	// to chunkUpdates_, and apply the rules to them on the workers
+	void partitionUpdates();
+	void applyRulesParallel();
+
 	FluidCellRef getFluidCell(FluidPos pos);
+	void journalFluid(TilePos pos, WorldJournal::FluidOp op, Fluid::ID fluid);
 
 	WorldPlane &plane_;
-
-	std::unordered_set<FluidPos> updateSet_;
-	std::unordered_set<FluidPos> movedSet_;
+	ChunkIndex::Cache chunkCache_;
+
+	// Cells which are queued in updatesA_, and cells which were
+	// already updated or moved into this tick
+	FluidActivityMap updateMap_;
+	FluidActivityMap movedMap_;
+	RuleOutput serialOutput_{&movedMap_};
+
+	// The first numChunkUpdates_ are in use, the rest are kept for later
+	std::vector<std::unique_ptr<ChunkUpdates>> chunkUpdates_;
+	std::unordered_map<ChunkPos, size_t> chunkUpdatesIndex_;
+	size_t numChunkUpdates_ = 0;
+	size_t numUpdates_ = 0;
 	std::vector<FluidPos> updatesA_;
 	std::vector<FluidPos> updatesB_;
+	FluidUpdateOrder updateOrder_;
 	std::vector<FluidParticle> particles_;
 	TickProgress tickProgress_;
 };
@@ -2,6 +2,7 @@
 
 #include "../Tile.h"
 #include "../common.h"
+#include "../Clock.h"
 
 #include <string_view>
 #include <vector>
@@ -9,6 +10,7 @@
 namespace Swan {
 
 class WorldPlane;
+class Chunk;
 
 struct Raycast {
 	bool hit;
@@ -19,6 +21,11 @@ struct Raycast {
 
 class TileSystemImpl {
 public:
+	struct TickProgress {
+		size_t updateIndex = 0;
+		size_t backgroundUpdateIndex = 0;
+	};
+
 	TileSystemImpl(WorldPlane &plane): plane_(plane) {}
 
 	/*
@@ -81,9 +88,22 @@ public:
 	 */
 
 	void beginTick();
-	void endTick();
+
+	// Run the updates which were scheduled last tick. Returns false if
+	// the deadline passed first; the next call continues from there.
+	bool endTick(RTDeadline deadline);
+
+	// Set a tile when replaying the journal. Unlike setIDWithoutUpdate,
+	// this doesn't run onBreak or onSpawn, or spawn tile entities;
+	// the journal has records of whatever those did the first time.
+	void restoreID(TilePos pos, Tile::ID id);
+	void restoreBackgroundID(TilePos pos, Tile::ID id);
 
 private:
+	void journalTile(TilePos pos, Tile::ID id);
+	void updateLightsAndFluids(
+		TilePos pos, Chunk &chunk, ChunkRelPos rp, Tile &oldTile, Tile &newTile);
+
 	WorldPlane &plane_;
 
 	// Tiles to update the next tick
@@ -94,6 +114,8 @@ private:
 	std::vector<TilePos> scheduledBackgroundUpdatesA_;
 	std::vector<TilePos> scheduledBackgroundUpdatesB_;
 
+	TickProgress tickProgress_;
+
 	// Keep track of whether we're currently running an onSpawn in placeTile.
 	// Helps to avoid recursive tile ID setting issues.
 	bool placingTile_ = false;
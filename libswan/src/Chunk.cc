@@ -1,5 +1,6 @@
 #include "Chunk.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
 #include <vector>
@@ -16,17 +17,45 @@
 #include "capnp/serialize-packed.h"
 #include "kj/io.h"
 #include "rle.h"
+#include "gzip.h"
 #include "swan.capnp.h"
 
 namespace Swan {
 
 static thread_local std::vector<uint8_t> scratchBuffer;
+static thread_local std::vector<uint8_t> fluidScratchBuffer;
+static thread_local std::vector<uint8_t> gzipScratchBuffer;
 
-Chunk::Chunk(ChunkPos pos): pos_(pos)
+// Data compressed with a non-zero gzip level is in the GZIP format,
+// otherwise it's plain RLE
+static proto::Chunk::Compression compressionForLevel(int gzipLevel)
 {
-	data_.reset(new uint8_t[DATA_SIZE]);
+	return gzipLevel > GZIP_LEVEL_NONE
+		? proto::Chunk::Compression::GZIP
+		: proto::Chunk::Compression::RLE;
+}
+
+static std::unique_ptr<uint8_t[]> copyBuffer(std::span<const uint8_t> data)
+{
+	auto buf = std::make_unique<uint8_t[]>(data.size());
+	memcpy(buf.get(), data.data(), data.size());
+	return buf;
+}
+
+static_assert(World::AIR_FLUID_ID == SparseFluidGrid::AIR);
+static_assert(World::SOLID_FLUID_ID == SparseFluidGrid::SOLID);
+
+Chunk::Chunk(ChunkPos pos, ChunkBufferPool &pool, TileStorage storage):
+	pool_(&pool), tileStorage_(storage), pos_(pos)
+{
+	data_ = allocData();
 	memset(getLightData(), 0, LIGHT_DATA_SIZE);
-	memset(getFluidData(), 0, FLUID_DATA_SIZE);
+
+	if (tileStorage_ == TileStorage::PALETTE) {
+		tilePalette_.clear(World::AIR_TILE_ID);
+		backgroundPalette_.clear(World::AIR_TILE_ID);
+		return;
+	}
 
 	Tile::ID *backgroundData = getBackgroundTileData();
 	for (size_t i = 0; i < CHUNK_WIDTH * CHUNK_HEIGHT; ++i) {
@@ -34,50 +63,350 @@ Chunk::Chunk(ChunkPos pos): pos_(pos)
 	}
 }
 
-std::unique_ptr<uint8_t[]> Chunk::compressToBuffer(size_t &len) const
+Chunk::~Chunk()
+{
+	// The job refers to this chunk, so it has to finish first
+	if (codecJob_) {
+		codecJob_->wait();
+	}
+}
+
+std::span<Tile::ID, CHUNK_WIDTH * CHUNK_HEIGHT> Chunk::tileScratch(int layer)
+{
+	static thread_local Tile::ID scratch[2][CHUNK_WIDTH * CHUNK_HEIGHT];
+	return scratch[layer];
+}
+
+ChunkBufferPool::Buffer Chunk::allocData()
 {
+	return pool_->allocate(DATA_SIZE - tileDataOffset());
+}
+
+uint8_t *Chunk::flattenFluidData() const
+{
+	fluidScratchBuffer.resize(FLUID_DATA_SIZE);
+	fluidData_.unpack(fluidScratchBuffer);
+	return fluidScratchBuffer.data();
+}
+
+uint8_t *Chunk::flattenFluidRows(int begin, int end) const
+{
+	fluidScratchBuffer.resize(FLUID_DATA_SIZE);
+	fluidData_.unpackRows(fluidScratchBuffer, begin, end);
+	return fluidScratchBuffer.data() + begin * FLUID_RESOLUTION * SparseFluidGrid::WIDTH;
+}
+
+void Chunk::setTileStorage(TileStorage storage)
+{
+	if (storage == tileStorage_) {
+		return;
+	}
+
+	finishCodec(false);
+
+	// A compressed chunk has no tile arrays to convert,
+	// it will just use the new storage once it's decompressed
 	if (isCompressed()) {
-		return nullptr;
+		tileStorage_ = storage;
+		return;
+	}
+
+	auto oldData = std::move(data_);
+	size_t oldOffset = tileDataOffset();
+	tileStorage_ = storage;
+	data_ = allocData();
+	memcpy(
+		getLightData(), oldData.get() + LIGHT_DATA_OFFSET - oldOffset,
+		DATA_SIZE - LIGHT_DATA_OFFSET);
+
+	if (tileStorage_ == TileStorage::PALETTE) {
+		tilePalette_.pack({
+			(Tile::ID *)(oldData.get() + TILE_DATA_OFFSET),
+			CHUNK_WIDTH * CHUNK_HEIGHT});
+		backgroundPalette_.pack({
+			(Tile::ID *)(oldData.get() + BACKGROUND_TILE_DATA_OFFSET),
+			CHUNK_WIDTH * CHUNK_HEIGHT});
+	} else {
+		tilePalette_.unpack({getTileData(), CHUNK_WIDTH * CHUNK_HEIGHT});
+		backgroundPalette_.unpack({getBackgroundTileData(), CHUNK_WIDTH * CHUNK_HEIGHT});
+		tilePalette_.reset();
+		backgroundPalette_.reset();
 	}
+}
 
+// Encode flat arrays of tiles, background tiles and fluids in the RLE format,
+// and gzip the result if 'gzipLevel' is above GZIP_LEVEL_NONE
+static std::unique_ptr<uint8_t[]> encodeLayers(
+	std::span<const Tile::ID> tiles, std::span<const Tile::ID> background,
+	std::span<const uint8_t> fluid, int gzipLevel, size_t &len)
+{
 	capnp::MallocMessageBuilder mb;
 	auto root = mb.initRoot<proto::ChunkRLEData>();
 
 	scratchBuffer.clear();
-	rleEncode16SRO(scratchBuffer, {getTileData(), CHUNK_WIDTH * CHUNK_HEIGHT});
-	auto tiles = root.initTiles(scratchBuffer.size());
-	memcpy(&tiles.front(), scratchBuffer.data(), scratchBuffer.size());
+	rleEncode16SRO(scratchBuffer, tiles);
+	auto tilesData = root.initTiles(scratchBuffer.size());
+	memcpy(&tilesData.front(), scratchBuffer.data(), scratchBuffer.size());
 
 	scratchBuffer.clear();
-	rleEncode16SRO(scratchBuffer, {getBackgroundTileData(), CHUNK_WIDTH * CHUNK_HEIGHT});
-	auto background = root.initBackground(scratchBuffer.size());
-	memcpy(&background.front(), scratchBuffer.data(), scratchBuffer.size());
+	rleEncode16SRO(scratchBuffer, background);
+	auto backgroundData = root.initBackground(scratchBuffer.size());
+	memcpy(&backgroundData.front(), scratchBuffer.data(), scratchBuffer.size());
 
 	scratchBuffer.clear();
-	rleEncode8(scratchBuffer, {getFluidData(), FLUID_DATA_SIZE});
-	auto fluid = root.initFluid(scratchBuffer.size());
-	memcpy(&fluid.front(), scratchBuffer.data(), scratchBuffer.size());
+	rleEncode8(scratchBuffer, fluid);
+	auto fluidData = root.initFluid(scratchBuffer.size());
+	memcpy(&fluidData.front(), scratchBuffer.data(), scratchBuffer.size());
 
 	kj::VectorOutputStream out;
 	capnp::writePackedMessage(out, mb);
 	auto arr = out.getArray();
 
-	auto data = std::make_unique<uint8_t[]>(arr.size());
+	if (gzipLevel > GZIP_LEVEL_NONE) {
+		gzipScratchBuffer.clear();
+		gzipEncode(gzipScratchBuffer, {&arr.front(), arr.size()}, gzipLevel);
+		len = gzipScratchBuffer.size();
+		return copyBuffer(gzipScratchBuffer);
+	}
+
 	len = arr.size();
-	memcpy(&data[0], &arr.front(), arr.size());
+	return copyBuffer({&arr.front(), arr.size()});
+}
+
+// The reverse of encodeLayers
+static void decodeLayers(
+	std::span<const uint8_t> data, proto::Chunk::Compression compression,
+	std::span<Tile::ID> tiles, std::span<Tile::ID> background,
+	std::span<uint8_t> fluid)
+{
+	if (compression == proto::Chunk::Compression::GZIP) {
+		gzipScratchBuffer.clear();
+		if (!gzipDecode(gzipScratchBuffer, data)) {
+			throw std::runtime_error("Corrupt gzipped chunk");
+		}
+		data = gzipScratchBuffer;
+	}
+
+	kj::ArrayInputStream stream(kj::ArrayPtr(data.data(), data.size()));
+	capnp::PackedMessageReader reader(stream);
+	auto root = reader.getRoot<proto::ChunkRLEData>();
+
+	auto tilesData = root.getTiles();
+	rleDecode16SRO(tiles, {tilesData.begin(), tilesData.size()});
+	auto backgroundData = root.getBackground();
+	rleDecode16SRO(background, {backgroundData.begin(), backgroundData.size()});
+	auto fluidData = root.getFluid();
+	rleDecode8(fluid, {fluidData.begin(), fluidData.size()});
+}
+
+// Tiles which don't exist anymore turn into air
+static Tile::ID remapTile(Tile::ID tile, std::span<const Tile::ID> tileMap)
+{
+	return tile < tileMap.size() ? tileMap[tile] : World::AIR_TILE_ID;
+}
+
+static void remapTiles(std::span<Tile::ID> tiles, std::span<const Tile::ID> tileMap)
+{
+	for (Tile::ID &tile: tiles) {
+		tile = remapTile(tile, tileMap);
+	}
+}
+
+static void putVarint(std::vector<uint8_t> &out, size_t val)
+{
+	while (val >= 0x80) {
+		out.push_back(uint8_t(val) | 0x80);
+		val >>= 7;
+	}
+	out.push_back(uint8_t(val));
+}
+
+static size_t getVarint(std::span<const uint8_t> &in)
+{
+	size_t val = 0;
+	for (int shift = 0; shift < 32; shift += 7) {
+		if (in.empty()) {
+			break;
+		}
+
+		uint8_t byte = in.front();
+		in = in.subspan(1);
+		val |= size_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return val;
+		}
+	}
 
-	return data;
+	throw std::runtime_error("Corrupt chunk delta");
 }
 
-void Chunk::compress()
+// A delta layer is a sequence of runs of tiles which differ from the base:
+// the number of unchanged tiles before the run, the length of the run,
+// and then every tile in the run. All of those are LEB128 varints.
+static void encodeDiff(
+	std::vector<uint8_t> &out,
+	std::span<const Tile::ID> base, std::span<const Tile::ID> tiles)
 {
+	size_t i = 0;
+	while (i < tiles.size()) {
+		size_t start = i;
+		while (i < tiles.size() && tiles[i] == base[i]) {
+			i += 1;
+		}
+
+		if (i == tiles.size()) {
+			break;
+		}
+
+		size_t runStart = i;
+		while (i < tiles.size() && tiles[i] != base[i]) {
+			i += 1;
+		}
+
+		putVarint(out, runStart - start);
+		putVarint(out, i - runStart);
+		for (size_t j = runStart; j < i; ++j) {
+			putVarint(out, tiles[j]);
+		}
+	}
+}
+
+// The tiles in a delta come from the save, so they may need remapping;
+// the base tiles are freshly generated, so they don't
+static void applyDiff(
+	std::span<Tile::ID> tiles, std::span<const uint8_t> in,
+	const Chunk::TileMap &tileMap)
+{
+	size_t i = 0;
+	while (!in.empty()) {
+		i += getVarint(in);
+		size_t len = getVarint(in);
+		if (i + len > tiles.size()) {
+			throw std::runtime_error("Corrupt chunk delta");
+		}
+
+		for (size_t end = i + len; i < end; ++i) {
+			Tile::ID tile = getVarint(in);
+			tiles[i] = tileMap ? remapTile(tile, *tileMap) : tile;
+		}
+	}
+}
+
+static std::unique_ptr<uint8_t[]> encodeDelta(
+	std::span<const Tile::ID> baseTiles, std::span<const Tile::ID> baseBackground,
+	std::span<const Tile::ID> tiles, std::span<const Tile::ID> background,
+	std::span<const uint8_t> fluid, size_t &len)
+{
+	capnp::MallocMessageBuilder mb;
+	auto root = mb.initRoot<proto::ChunkDelta>();
+
+	scratchBuffer.clear();
+	encodeDiff(scratchBuffer, baseTiles, tiles);
+	if (!scratchBuffer.empty()) {
+		auto tilesData = root.initTiles(scratchBuffer.size());
+		memcpy(&tilesData.front(), scratchBuffer.data(), scratchBuffer.size());
+	}
+
+	scratchBuffer.clear();
+	encodeDiff(scratchBuffer, baseBackground, background);
+	if (!scratchBuffer.empty()) {
+		auto backgroundData = root.initBackground(scratchBuffer.size());
+		memcpy(&backgroundData.front(), scratchBuffer.data(), scratchBuffer.size());
+	}
+
+	scratchBuffer.clear();
+	rleEncode8(scratchBuffer, fluid);
+	auto fluidData = root.initFluid(scratchBuffer.size());
+	memcpy(&fluidData.front(), scratchBuffer.data(), scratchBuffer.size());
+
+	kj::VectorOutputStream out;
+	capnp::writePackedMessage(out, mb);
+	auto arr = out.getArray();
+	len = arr.size();
+	return copyBuffer({&arr.front(), arr.size()});
+}
+
+// Decode data in any of the compressed formats into flat arrays,
+// with tile IDs from an older save remapped through 'tileMap'
+static void decodeChunkData(
+	std::span<const uint8_t> data, proto::Chunk::Compression compression,
+	ChunkPos pos, const Chunk::TileMap &tileMap,
+	const Chunk::Regenerator &regenerator,
+	std::span<Tile::ID> tiles, std::span<Tile::ID> background,
+	std::span<uint8_t> fluid)
+{
+	if (compression != proto::Chunk::Compression::DELTA) {
+		decodeLayers(data, compression, tiles, background, fluid);
+		if (tileMap) {
+			remapTiles(tiles, *tileMap);
+			remapTiles(background, *tileMap);
+		}
+		return;
+	}
+
+	if (!regenerator) {
+		throw std::runtime_error("Delta chunk, but the world gen can't regenerate");
+	}
+
+	(*regenerator)(pos, tiles, background);
+
+	kj::ArrayInputStream stream(kj::ArrayPtr(data.data(), data.size()));
+	capnp::PackedMessageReader reader(stream);
+	auto root = reader.getRoot<proto::ChunkDelta>();
+
+	auto tilesData = root.getTiles();
+	applyDiff(tiles, {tilesData.begin(), tilesData.size()}, tileMap);
+	auto backgroundData = root.getBackground();
+	applyDiff(background, {backgroundData.begin(), backgroundData.size()}, tileMap);
+	auto fluidData = root.getFluid();
+	rleDecode8(fluid, {fluidData.begin(), fluidData.size()});
+}
+
+std::unique_ptr<uint8_t[]> Chunk::compressToBuffer(size_t &len, int gzipLevel) const
+{
+	if (isCompressed()) {
+		return nullptr;
+	}
+
+	std::unique_ptr<uint8_t[]> buf;
+	readTiles([&](std::span<const Tile::ID> tiles) {
+		readBackgroundTiles([&](std::span<const Tile::ID> background) {
+			buf = encodeLayers(
+				tiles, background, {flattenFluidData(), FLUID_DATA_SIZE},
+				gzipLevel, len);
+		});
+	});
+
+	return buf;
+}
+
+void Chunk::compress(int gzipLevel)
+{
+	finishCodec(true);
 	if (isCompressed()) {
 		return;
 	}
 
 	size_t len;
-	data_ = compressToBuffer(len);
-	compressedSize_ = len;
+	auto data = compressToBuffer(len, gzipLevel);
+	applyCompressed(std::move(data), len, compressionForLevel(gzipLevel));
+}
+
+void Chunk::applyCompressed(
+	std::unique_ptr<uint8_t[]> data, size_t size,
+	proto::Chunk::Compression compression)
+{
+	compressedData_ = std::move(data);
+	compressedBacking_.reset();
+	compressedPtr_ = compressedData_.get();
+	tileMap_.reset();
+	regenerator_.reset();
+	compressedSize_ = size;
+	compression_ = compression;
+	data_.reset();
+	tilePalette_.reset();
+	backgroundPalette_.reset();
+	fluidData_.reset();
 
 	if (entities_.empty()) {
 		// Properly free entities array memory
@@ -96,64 +425,192 @@ void Chunk::compress()
 
 void Chunk::decompress()
 {
+	finishCodec(false);
 	if (!isCompressed()) {
 		return;
 	}
 
-	auto compressedData = std::move(data_);
-	size_t compressedSize = compressedSize_;
+	beginDecompress();
+	try {
+		decodeCompressed();
+	} catch (...) {
+		abortDecompress();
+		throw;
+	}
+	endDecompress();
+}
+
+void Chunk::beginDecompress()
+{
+	data_ = allocData();
+
+	// Pooled buffers aren't cleared, and lighting isn't part of the compressed data
+	memset(data_.get() + LIGHT_DATA_OFFSET - tileDataOffset(), 0, LIGHT_DATA_SIZE);
+}
+
+void Chunk::decodeCompressed()
+{
+	std::span<Tile::ID> tiles, background;
+	if (tileStorage_ == TileStorage::FLAT) {
+		tiles = {(Tile::ID *)(data_.get() + layerOffset(0)), CHUNK_WIDTH * CHUNK_HEIGHT};
+		background = {(Tile::ID *)(data_.get() + layerOffset(1)), CHUNK_WIDTH * CHUNK_HEIGHT};
+	} else {
+		tiles = tileScratch(0);
+		background = tileScratch(1);
+	}
+
+	// Chunks which were loaded from a save with different tile IDs
+	// get their tiles remapped the first time they're decompressed
+	fluidScratchBuffer.resize(FLUID_DATA_SIZE);
+	decodeChunkData(
+		compressedBytes(), compression_, pos_, tileMap_, regenerator_,
+		tiles, background, fluidScratchBuffer);
+
+	if (tileStorage_ == TileStorage::PALETTE) {
+		tilePalette_.pack(tiles);
+		backgroundPalette_.pack(background);
+	}
 
-	data_ = std::make_unique<uint8_t[]>(DATA_SIZE);
+	fluidData_.pack(fluidScratchBuffer);
+}
+
+void Chunk::abortDecompress()
+{
+	data_.reset();
+	tilePalette_.reset();
+	backgroundPalette_.reset();
+	fluidData_.reset();
+}
+
+void Chunk::endDecompress()
+{
+	tileMap_.reset();
+	regenerator_.reset();
+	compressedData_.reset();
+	compressedBacking_.reset();
+	compressedPtr_ = nullptr;
 	compressedSize_ = -1;
+}
 
-	kj::ArrayInputStream stream(kj::ArrayPtr(compressedData.get(), compressedSize));
-	capnp::PackedMessageReader reader(stream);
-	auto root = reader.getRoot<proto::ChunkRLEData>();
+void Chunk::detachCompressedData()
+{
+	finishCodec(true);
+	if (!isCompressed() || !compressedBacking_) {
+		return;
+	}
+
+	compressedData_ = copyBuffer(compressedBytes());
+	compressedPtr_ = compressedData_.get();
+	compressedBacking_.reset();
+}
+
+bool Chunk::compressAsync(WorkerPool &workers, int gzipLevel)
+{
+	if (hasPendingCodec() || isCompressed()) {
+		return false;
+	}
+
+	codecState_ = CodecState::COMPRESSING;
+	codecResultCompression_ = compressionForLevel(gzipLevel);
+	codecJob_ = workers.submit([this, gzipLevel] {
+		codecResult_ = compressToBuffer(codecResultSize_, gzipLevel);
+	});
+	return true;
+}
+
+bool Chunk::decompressAsync(WorkerPool &workers)
+{
+	if (hasPendingCodec() || !isCompressed()) {
+		return false;
+	}
+
+	// The buffer has to come from the pool on the main thread
+	beginDecompress();
+	codecState_ = CodecState::DECOMPRESSING;
+	codecJob_ = workers.submit([this] {
+		decodeCompressed();
+	});
+	return true;
+}
+
+bool Chunk::pollCodec()
+{
+	if (!hasPendingCodec() || !codecJob_->done()) {
+		return false;
+	}
+
+	finishCodec(true);
+	return true;
+}
+
+void Chunk::finishCodec(bool keepCompressed)
+{
+	if (!hasPendingCodec()) {
+		return;
+	}
 
-	auto tiles = root.getTiles();
-	rleDecode16SRO(
-		{getTileData(), CHUNK_WIDTH * CHUNK_HEIGHT},
-		{&tiles.front(), tiles.size()});
-	auto background = root.getBackground();
-	rleDecode16SRO(
-		{getBackgroundTileData(), CHUNK_WIDTH * CHUNK_HEIGHT},
-		{&background.front(), background.size()});
-	auto fluid = root.getFluid();
-	rleDecode8(
-		{getFluidData(), FLUID_DATA_SIZE},
-		{&fluid.front(), fluid.size()});
+	codecJob_->wait();
+	auto job = std::move(codecJob_);
+
+	CodecState state = codecState_;
+	codecState_ = CodecState::IDLE;
+	if (job->failed()) {
+		codecResult_.reset();
+		if (state == CodecState::DECOMPRESSING) {
+			abortDecompress();
+			job->rethrow();
+		}
+
+		if (keepCompressed) {
+			warn << "Failed to compress chunk " << pos_ << ", keeping it as it is";
+		}
+		return;
+	}
+
+	if (state == CodecState::DECOMPRESSING) {
+		endDecompress();
+	} else if (keepCompressed) {
+		applyCompressed(
+			std::move(codecResult_), codecResultSize_, codecResultCompression_);
+	}
+
+	codecResult_.reset();
 }
 
 void Chunk::draw(Ctx &ctx, Cygnet::Renderer &rnd)
 {
-	if (isCompressed()) {
+	if (!isActive()) {
 		return;
 	}
 
 	if (!isRendered_) {
 		ZoneScopedN("Chunk render activate");
-		renderChunk_ = rnd.createChunk(getTileData(), getBackgroundTileData());
-		renderChunkFluid_ = rnd.createChunkFluid(getFluidData());
-		renderChunkShadow_ = rnd.createChunkShadow(getLightData());
-
-		// Populate fluid masks
-		for (int y = 0; y < CHUNK_HEIGHT; ++y) {
-			auto *row = getTileData() + (y * CHUNK_WIDTH);
-			for (int x = 0; x < CHUNK_WIDTH; ++x) {
-				Tile::ID id = row[x];
-				auto &tile = ctx.world.getTileByID(id);
-				auto mask = tile.more->fluidMask;
-				if (!mask) {
-					continue;
+		readTiles([&](std::span<const Tile::ID> tiles) {
+			readBackgroundTiles([&](std::span<const Tile::ID> background) {
+				renderChunk_ = rnd.createChunk(tiles.data(), background.data());
+			});
+
+			// Populate fluid masks
+			for (int y = 0; y < CHUNK_HEIGHT; ++y) {
+				auto *row = tiles.data() + (y * CHUNK_WIDTH);
+				for (int x = 0; x < CHUNK_WIDTH; ++x) {
+					Tile::ID id = row[x];
+					auto &tile = ctx.world.getTileByID(id);
+					auto mask = tile.more->fluidMask;
+					if (!mask) {
+						continue;
+					}
+
+					ChunkRelPos rp = {x, y};
+					fluidMasks_.push_back({rp, Cygnet::Renderer::DrawMask {
+						.pos = pos_.scale(CHUNK_WIDTH, CHUNK_HEIGHT) + rp,
+						.mask = mask,
+					}});
 				}
-
-				ChunkRelPos rp = {x, y};
-				fluidMasks_.push_back({rp, Cygnet::Renderer::DrawMask {
-					.pos = pos_.scale(CHUNK_WIDTH, CHUNK_HEIGHT) + rp,
-					.mask = mask,
-				}});
 			}
-		}
+		});
+		renderChunkFluid_ = rnd.createChunkFluid(flattenFluidData());
+		renderChunkShadow_ = rnd.createChunkShadow(getLightData());
 		fluidMaskMap_.reserve(fluidMasks_.size());
 		for (size_t i = 0; i < fluidMasks_.size(); ++i) {
 			fluidMaskMap_[fluidMasks_[i].first] = i;
@@ -161,7 +618,8 @@ void Chunk::draw(Ctx &ctx, Cygnet::Renderer &rnd)
 
 		isRendered_ = true;
 		needLightRender_ = false;
-		isFluidModified_ = false;
+		fluidDirtyBegin_ = CHUNK_HEIGHT;
+		fluidDirtyEnd_ = 0;
 	}
 
 	{
@@ -190,10 +648,14 @@ void Chunk::draw(Ctx &ctx, Cygnet::Renderer &rnd)
 		needLightRender_ = false;
 	}
 
-	if (isFluidModified_) {
+	if (fluidDirtyBegin_ < fluidDirtyEnd_) {
 		ZoneScopedN("Chunk fluid render");
-		rnd.modifyChunkFluid(renderChunkFluid_, getFluidData());
-		isFluidModified_ = false;
+		rnd.modifyChunkFluidRows(
+			renderChunkFluid_, flattenFluidRows(fluidDirtyBegin_, fluidDirtyEnd_),
+			fluidDirtyBegin_ * FLUID_RESOLUTION,
+			(fluidDirtyEnd_ - fluidDirtyBegin_) * FLUID_RESOLUTION);
+		fluidDirtyBegin_ = CHUNK_HEIGHT;
+		fluidDirtyEnd_ = 0;
 	}
 
 	Vec2 pos = (Vec2)pos_ * Vec2{CHUNK_WIDTH, CHUNK_HEIGHT};
@@ -212,47 +674,175 @@ void Chunk::draw(Ctx &ctx, Cygnet::Renderer &rnd)
 	}
 }
 
-void Chunk::serialize(proto::Chunk::Builder w) const
+Chunk::Snapshot Chunk::snapshot() const
+{
+	if (isCompressed()) {
+		std::shared_ptr<const void> owner = compressedBacking_;
+		if (!owner) {
+			owner = compressedData_;
+		}
+
+		return {
+			.pos = pos_,
+			.owner = std::move(owner),
+			.data = compressedBytes(),
+			.compression = compression_,
+			.tileMap = tileMap_,
+			.regenerator = regenerator_,
+			.entities = hibernatingEntities_,
+		};
+	}
+
+	// RLE is cheap enough to do right away, gzip can happen later
+	size_t len;
+	std::shared_ptr<const uint8_t[]> buf = compressToBuffer(len, GZIP_LEVEL_NONE);
+	return {
+		.pos = pos_,
+		.owner = buf,
+		.data = {buf.get(), len},
+		.compression = proto::Chunk::Compression::RLE,
+		.tileMap = nullptr,
+		.regenerator = nullptr,
+		.entities = hibernatingEntities_,
+	};
+}
+
+std::vector<Chunk::Snapshot> Chunk::snapshotAll(
+	std::span<Chunk *const> chunks, WorkerPool &workers)
+{
+	ZoneScopedN("Chunk snapshotAll");
+
+	// One job per chunk would mostly be queueing overhead
+	constexpr size_t BATCH_SIZE = 32;
+
+	std::vector<Snapshot> snapshots(chunks.size());
+	std::vector<size_t> active;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		if (chunks[i]->isCompressed()) {
+			snapshots[i] = chunks[i]->snapshot();
+		} else {
+			active.push_back(i);
+		}
+	}
+
+	std::vector<WorkerPool::JobPtr> jobs;
+	for (size_t start = 0; start < active.size(); start += BATCH_SIZE) {
+		size_t end = std::min(start + BATCH_SIZE, active.size());
+		jobs.push_back(workers.submit([&, start, end] {
+			for (size_t i = start; i < end; ++i) {
+				snapshots[active[i]] = chunks[active[i]]->snapshot();
+			}
+		}));
+	}
+
+	for (auto &job: jobs) {
+		job->wait();
+	}
+
+	for (auto &job: jobs) {
+		job->rethrow();
+	}
+
+	return snapshots;
+}
+
+void Chunk::serialize(
+	const Snapshot &snapshot, proto::Chunk::Builder w, int gzipLevel, bool delta)
 {
 	using Compression = proto::Chunk::Compression;
 	std::unique_ptr<uint8_t[]> compressionBuf;
 
-	uint8_t *dataPtr = nullptr;
+	const uint8_t *dataPtr = nullptr;
 	size_t dataLen = 0;
-	Compression compression = Compression::NONE;
+	Compression compression = compressionForLevel(gzipLevel);
+	bool isDelta = snapshot.compression == Compression::DELTA;
+	delta = delta && snapshot.regenerator;
+
+	// A delta which doesn't need fixing up can be saved as it is
+	if (delta && isDelta && !snapshot.tileMap) {
+		compression = Compression::DELTA;
+		dataPtr = snapshot.data.data();
+		dataLen = snapshot.data.size();
+	}
 
-	// If the chunk is already compressed,
-	// just re-use the buffer
-	if (isCompressed()) {
-		dataPtr = data_.get();
-		dataLen = compressedSize_;
-		compression = Compression::RLE;
+	// Making or applying a delta needs the layers decoded,
+	// and so does fixing up tile IDs from an older save
+	else if (delta || isDelta || snapshot.tileMap) {
+		auto tiles = tileScratch(0);
+		auto background = tileScratch(1);
+		fluidScratchBuffer.resize(FLUID_DATA_SIZE);
+		decodeChunkData(
+			snapshot.data, snapshot.compression, snapshot.pos,
+			snapshot.tileMap, snapshot.regenerator,
+			tiles, background, fluidScratchBuffer);
+		compressionBuf = encodeLayers(
+			tiles, background, fluidScratchBuffer, gzipLevel, dataLen);
+		dataPtr = compressionBuf.get();
+
+		// Heavily modified chunks are smaller in full
+		if (delta) {
+			static thread_local Tile::ID base[2][CHUNK_WIDTH * CHUNK_HEIGHT];
+			(*snapshot.regenerator)(snapshot.pos, base[0], base[1]);
+
+			size_t deltaLen;
+			auto deltaBuf = encodeDelta(
+				base[0], base[1], tiles, background, fluidScratchBuffer, deltaLen);
+			if (deltaLen < dataLen) {
+				compressionBuf = std::move(deltaBuf);
+				dataPtr = compressionBuf.get();
+				dataLen = deltaLen;
+				compression = Compression::DELTA;
+			}
+		}
 	}
 
-	// If not, we try to compress it.
-	// If we don't gain anything by compressing,
-	// just use it uncompressed.
+	// If the data is already in the right format, just use it
+	else if (snapshot.compression == compression) {
+		dataPtr = snapshot.data.data();
+		dataLen = snapshot.data.size();
+	}
+
+	// If it's in the wrong format, convert it
 	else {
-		compressionBuf = compressToBuffer(dataLen);
-		dataPtr = compressionBuf.get();
-		compression = Compression::RLE;
+		gzipScratchBuffer.clear();
+		if (compression == Compression::GZIP) {
+			gzipEncode(gzipScratchBuffer, snapshot.data, gzipLevel);
+		} else if (!gzipDecode(gzipScratchBuffer, snapshot.data)) {
+			throw std::runtime_error("Corrupt gzipped chunk");
+		}
+
+		dataPtr = gzipScratchBuffer.data();
+		dataLen = gzipScratchBuffer.size();
 	}
 
 	auto pos = w.initPos();
-	pos.setX(pos_.x);
-	pos.setY(pos_.y);
+	pos.setX(snapshot.pos.x);
+	pos.setY(snapshot.pos.y);
 
 	w.setCompression(compression);
 	auto d = w.initData(dataLen);
 	memcpy(&d.front(), dataPtr, dataLen);
+
+	if (snapshot.entities) {
+		w.setEntities({snapshot.entities->data(), snapshot.entities->size()});
+	}
 }
 
-void Chunk::deserialize(proto::Chunk::Reader r, std::span<Tile::ID> tileMap)
+void Chunk::deserialize(
+	proto::Chunk::Reader r, TileMap tileMap, std::shared_ptr<const void> backing,
+	Regenerator regenerator)
 {
 	isModified_ = true;
+	needsSave_ = true;
 	pos_ = {r.getPos().getX(), r.getPos().getY()};
 
-	bool wasCompressed = false;
+	hibernatingEntities_ = nullptr;
+	if (r.hasEntities()) {
+		auto entities = r.getEntities();
+		hibernatingEntities_ = std::make_shared<const std::vector<uint8_t>>(
+			entities.begin(), entities.end());
+	}
+
 	auto data = r.getData();
 	switch (r.getCompression()) {
 	case proto::Chunk::Compression::NONE:
@@ -265,52 +855,53 @@ void Chunk::deserialize(proto::Chunk::Reader r, std::span<Tile::ID> tileMap)
 		decompress();
 
 		static_assert(std::endian::native == std::endian::little);
-		memcpy(data_.get(), &data.front(), data.size());
+		writeTiles([&](std::span<Tile::ID> tiles) {
+			memcpy(tiles.data(), &data.front() + TILE_DATA_OFFSET, TILE_DATA_SIZE);
+			if (tileMap) {
+				remapTiles(tiles, *tileMap);
+			}
+		});
+		writeBackgroundTiles([&](std::span<Tile::ID> tiles) {
+			memcpy(
+				tiles.data(), &data.front() + BACKGROUND_TILE_DATA_OFFSET,
+				BACKGROUND_TILE_DATA_SIZE);
+			if (tileMap) {
+				remapTiles(tiles, *tileMap);
+			}
+		});
+		fluidData_.pack({
+			&data.front() + TILE_DATA_SIZE + BACKGROUND_TILE_DATA_SIZE,
+			FLUID_DATA_SIZE});
 		deactivateTimer_ = DEACTIVATE_INTERVAL;
 		break;
 
-	case proto::Chunk::Compression::GZIP:
-		warn << "Unsupported chunk compression: GZIP";
-		decompress();
-		deactivateTimer_ = DEACTIVATE_INTERVAL;
-		break;
+	case proto::Chunk::Compression::DELTA:
+		if (!regenerator) {
+			throw std::runtime_error("Delta chunk, but the world gen can't regenerate");
+		}
+		[[fallthrough]];
 
+	case proto::Chunk::Compression::GZIP:
 	case proto::Chunk::Compression::RLE:
-		data_ = std::make_unique<uint8_t[]>(data.size());
-		memcpy(data_.get(), &data.front(), data.size());
-		compressedSize_ = data.size();
-		deactivateTimer_ = DEACTIVATE_INTERVAL;
-
-		decompress();
-		wasCompressed = true;
-		break;
-	}
-
-	// Fix up foreground tiles
-	std::span<Tile::ID> tileData(getTileData(), CHUNK_WIDTH * CHUNK_HEIGHT);
-	for (Tile::ID &tile: tileData) {
-		if (tile > tileMap.size()) {
-			tile = 0;
-		}
-		else {
-			tile = tileMap[tile];
+		// The chunk stays compressed in whatever format it was saved in,
+		// and its tiles are remapped once it's decompressed.
+		// If 'backing' keeps the saved data alive, it's even used in place.
+		if (backing) {
+			applyCompressed(nullptr, data.size(), r.getCompression());
+			compressedBacking_ = std::move(backing);
+			compressedPtr_ = data.begin();
+		} else {
+			applyCompressed(
+				copyBuffer({data.begin(), data.size()}), data.size(),
+				r.getCompression());
 		}
-	}
 
-	// Fix up background tiles
-	tileData = {getBackgroundTileData(), CHUNK_WIDTH * CHUNK_HEIGHT};
-	for (Tile::ID &tile: tileData) {
-		if (tile > tileMap.size()) {
-			tile = 0;
-		}
-		else {
-			tile = tileMap[tile];
+		tileMap_ = std::move(tileMap);
+		if (r.getCompression() == proto::Chunk::Compression::DELTA) {
+			regenerator_ = std::move(regenerator);
 		}
-	}
-
-	if (wasCompressed) {
-		compress();
 		deactivateTimer_ = 0;
+		break;
 	}
 }
 
@@ -320,7 +911,6 @@ Chunk::TickAction Chunk::tick(float dt)
 
 	deactivateTimer_ -= dt;
 	if (deactivateTimer_ <= 0) {
-		assert(entities_.size() == 0);
 		if (isModified_) {
 			return TickAction::DEACTIVATE;
 		}
@@ -334,45 +924,71 @@ Chunk::TickAction Chunk::tick(float dt)
 
 void Chunk::setFluidID(ChunkRelPos pos, Fluid::ID fluid)
 {
-	auto xStart = pos.x * FLUID_RESOLUTION;
-	auto yStart = pos.y * FLUID_RESOLUTION;
-	for (auto y = yStart; y < yStart + FLUID_RESOLUTION; ++y) {
-		auto *row = getFluidData() + (y * CHUNK_WIDTH * FLUID_RESOLUTION);
-		memset(row + xStart, fluid, FLUID_RESOLUTION);
-	}
-	isFluidModified_ = true;
+	getFluidData().fillTile(pos, fluid);
+	setFluidModified(pos.y, pos.y + 1);
 }
 
 void Chunk::setFluidSolid(ChunkRelPos pos, const FluidCollision &set)
 {
-	for (int y = 0; y < FLUID_RESOLUTION; ++y) {
-		auto *row = getFluidData() +
-			(pos.y * FLUID_RESOLUTION + y) * CHUNK_WIDTH * FLUID_RESOLUTION +
-			pos.x * FLUID_RESOLUTION;
-		for (int x = 0; x < FLUID_RESOLUTION; ++x) {
-			if (set[y * FLUID_RESOLUTION + x]) {
-				row[x] = World::SOLID_FLUID_ID;
-			} else if (row[x] == World::SOLID_FLUID_ID) {
-				row[x] = World::AIR_FLUID_ID;
-			}
+	if (set.all()) {
+		getFluidData().fillTile(pos, World::SOLID_FLUID_ID);
+		setFluidModified(pos.y, pos.y + 1);
+		return;
+	} else if (set.none()) {
+		clearFluidSolid(pos);
+		return;
+	}
+
+	uint8_t *block = getFluidData().blockForWrite(pos);
+	for (size_t i = 0; i < SparseFluidGrid::BLOCK_SIZE; ++i) {
+		if (set[i]) {
+			block[i] = World::SOLID_FLUID_ID;
+		} else if (block[i] == World::SOLID_FLUID_ID) {
+			block[i] = World::AIR_FLUID_ID;
+		}
+	}
+	setFluidModified(pos.y, pos.y + 1);
+}
+
+void Chunk::initFluidSolidRow(int y, std::span<Tile *const, CHUNK_WIDTH> tiles)
+{
+	auto &fluids = getFluidData();
+	bool modified = false;
+	for (int x = 0; x < CHUNK_WIDTH; ++x) {
+		Tile *tile = tiles[x];
+		if (tile->isSolid()) {
+			fluids.fillTile({x, y}, World::SOLID_FLUID_ID);
+			modified = true;
+		} else if (tile->more->fluidCollision) {
+			setFluidSolid({x, y}, *tile->more->fluidCollision);
 		}
 	}
-	isFluidModified_ = true;
+
+	if (modified) {
+		setFluidModified(y, y + 1);
+	}
 }
 
 void Chunk::clearFluidSolid(ChunkRelPos pos)
 {
-	for (int y = 0; y < FLUID_RESOLUTION; ++y) {
-		auto *row = getFluidData() +
-			(pos.y * FLUID_RESOLUTION + y) * CHUNK_WIDTH * FLUID_RESOLUTION +
-			pos.x * FLUID_RESOLUTION;
-		for (int x = 0; x < FLUID_RESOLUTION; ++x) {
-			if (row[x] == World::SOLID_FLUID_ID) {
-				row[x] = World::AIR_FLUID_ID;
-			}
+	auto &fluids = getFluidData();
+	if (!fluids.peekBlock(pos)) {
+		Vec2i cell = pos * FLUID_RESOLUTION;
+		if (fluids.get(cell) == World::SOLID_FLUID_ID) {
+			fluids.fillTile(pos, World::AIR_FLUID_ID);
+			setFluidModified(pos.y, pos.y + 1);
+		}
+		return;
+	}
+
+	uint8_t *block = fluids.blockForWrite(pos);
+	for (size_t i = 0; i < SparseFluidGrid::BLOCK_SIZE; ++i) {
+		if (block[i] == World::SOLID_FLUID_ID) {
+			block[i] = World::AIR_FLUID_ID;
 		}
 	}
-	isFluidModified_ = true;
+	fluids.collapseTile(pos);
+	setFluidModified(pos.y, pos.y + 1);
 }
 
 void Chunk::setFluidMask(ChunkRelPos pos, Cygnet::RenderMask mask)
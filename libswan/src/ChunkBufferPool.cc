@@ -0,0 +1,91 @@
+#include "ChunkBufferPool.h"
+
+#include <algorithm>
+
+#include "OS.h"
+#include <swan/log.h>
+
+namespace Swan {
+
+// Keep buffers cache line aligned
+static constexpr size_t BUFFER_ALIGN = 64;
+
+ChunkBufferPool::~ChunkBufferPool()
+{
+	if (stats_.buffersInUse > 0) {
+		warn << "Chunk buffer pool destroyed with "
+			<< stats_.buffersInUse << " buffers still in use";
+	}
+
+	for (auto &slab: slabs_) {
+		if (slab.fromOS) {
+			OS::freePages(slab.mem, slab.size);
+		} else {
+			delete[] slab.mem;
+		}
+	}
+}
+
+ChunkBufferPool::Buffer ChunkBufferPool::allocate(size_t size)
+{
+	size = (size + BUFFER_ALIGN - 1) & ~(BUFFER_ALIGN - 1);
+	auto &sc = sizeClass(size);
+	if (sc.free.empty()) {
+		grow(sc);
+	}
+
+	uint8_t *buf = sc.free.back();
+	sc.free.pop_back();
+
+	stats_.buffersInUse += 1;
+	stats_.bytesInUse += size;
+	stats_.highWaterBytes = std::max(stats_.highWaterBytes, stats_.bytesInUse);
+	return Buffer(buf, {this, size});
+}
+
+ChunkBufferPool::SizeClass &ChunkBufferPool::sizeClass(size_t size)
+{
+	for (auto &sc: classes_) {
+		if (sc.size == size) {
+			return sc;
+		}
+	}
+
+	return classes_.emplace_back(SizeClass{size, {}});
+}
+
+void ChunkBufferPool::grow(SizeClass &sc)
+{
+	size_t count = std::max(SLAB_SIZE / sc.size, size_t(1));
+	size_t slabSize = std::max(SLAB_SIZE, sc.size);
+
+	Slab slab;
+	slab.size = slabSize;
+	slab.mem = (uint8_t *)OS::allocPages(slabSize);
+	slab.fromOS = slab.mem != nullptr;
+	if (!slab.fromOS) {
+		slab.mem = new uint8_t[slabSize];
+	}
+
+	slabs_.push_back(slab);
+	stats_.slabBytes += slabSize;
+
+	// Push in reverse so that buffers get handed out front to back
+	sc.free.reserve(sc.free.size() + count);
+	for (size_t i = count; i > 0; --i) {
+		sc.free.push_back(slab.mem + (i - 1) * sc.size);
+	}
+}
+
+void ChunkBufferPool::release(uint8_t *buf, size_t size)
+{
+	if (!buf) {
+		return;
+	}
+
+	sizeClass(size).free.push_back(buf);
+	stats_.buffersInUse -= 1;
+	stats_.bytesInUse -= size;
+}
+
+}
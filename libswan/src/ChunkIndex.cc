@@ -0,0 +1,90 @@
+#include "ChunkIndex.h"
+
+namespace Swan {
+
+Chunk &ChunkIndex::insert(Chunk &&chunk)
+{
+	ChunkPos pos = chunk.pos();
+	Region &region = getOrCreateRegion(regionKey(pos));
+	auto &slot = region.chunks[localIndex(pos)];
+	if (slot) {
+		return *slot;
+	}
+
+	slot = std::make_unique<Chunk>(std::move(chunk));
+	region.count += 1;
+	size_ += 1;
+	return *slot;
+}
+
+void ChunkIndex::erase(ChunkPos pos)
+{
+	Region *region = findRegion(regionKey(pos));
+	if (!region) {
+		return;
+	}
+
+	auto &slot = region->chunks[localIndex(pos)];
+	if (!slot) {
+		return;
+	}
+
+	slot.reset();
+	region->count -= 1;
+	size_ -= 1;
+	invalidateCaches();
+}
+
+void ChunkIndex::clear()
+{
+	slots_.clear();
+	regions_.clear();
+	size_ = 0;
+	invalidateCaches();
+}
+
+ChunkIndex::Region &ChunkIndex::getOrCreateRegion(uint64_t key)
+{
+	Region *region = findRegion(key);
+	if (region) {
+		return *region;
+	}
+
+	// Keep the load factor at or below 50%
+	if ((regions_.size() + 1) * 2 > slots_.size()) {
+		rehash(slots_.empty() ? 16 : slots_.size() * 2);
+	}
+
+	region = regions_.emplace_back(std::make_unique<Region>()).get();
+
+	size_t mask = slots_.size() - 1;
+	size_t index = hashKey(key) & mask;
+	while (slots_[index].region) {
+		index = (index + 1) & mask;
+	}
+
+	slots_[index] = {key, region};
+	return *region;
+}
+
+void ChunkIndex::rehash(size_t newCap)
+{
+	std::vector<Slot> oldSlots(newCap, Slot{0, nullptr});
+	oldSlots.swap(slots_);
+
+	size_t mask = slots_.size() - 1;
+	for (const Slot &slot: oldSlots) {
+		if (!slot.region) {
+			continue;
+		}
+
+		size_t index = hashKey(slot.key) & mask;
+		while (slots_[index].region) {
+			index = (index + 1) & mask;
+		}
+
+		slots_[index] = slot;
+	}
+}
+
+}
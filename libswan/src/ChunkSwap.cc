@@ -0,0 +1,142 @@
+#include "ChunkSwap.h"
+
+#include <swan/log.h>
+
+namespace Swan {
+
+void ChunkSwap::setPath(std::filesystem::path path)
+{
+	if (path == path_) {
+		return;
+	}
+
+	close();
+	path_ = std::move(path);
+}
+
+void ChunkSwap::close()
+{
+	if (file_.is_open()) {
+		file_.close();
+		std::error_code err;
+		std::filesystem::remove(path_, err);
+	}
+
+	entries_.clear();
+	free_.clear();
+	end_ = 0;
+	stats_.liveBytes = 0;
+	stats_.fileBytes = 0;
+}
+
+std::vector<std::pair<ChunkPos, bool>> ChunkSwap::list() const
+{
+	std::vector<std::pair<ChunkPos, bool>> list;
+	list.reserve(entries_.size());
+	for (auto &[pos, entry]: entries_) {
+		list.emplace_back(pos, entry.needsSave);
+	}
+
+	return list;
+}
+
+bool ChunkSwap::put(ChunkPos pos, std::span<const unsigned char> data, bool needsSave)
+{
+	if (data.size() % sizeof(uint64_t) != 0) {
+		return false;
+	}
+
+	if (!file_.is_open()) {
+		if (path_.empty()) {
+			return false;
+		}
+
+		// Whatever an earlier game left behind is of no use
+		file_.open(path_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file_) {
+			warn << "Failed to create chunk swap file " << path_;
+			file_ = {};
+			return false;
+		}
+	}
+
+	if (auto it = entries_.find(pos); it != entries_.end()) {
+		Entry old = it->second;
+		entries_.erase(it);
+		stats_.liveBytes -= old.size;
+		release(old.offset, old.size);
+	}
+
+	// Reuse the smallest free extent which fits, or grow the file
+	size_t offset;
+	if (auto it = free_.lower_bound(data.size()); it != free_.end()) {
+		auto [size, off] = *it;
+		free_.erase(it);
+		offset = off;
+		if (size > data.size()) {
+			free_.emplace(size - data.size(), off + data.size());
+		}
+	} else {
+		offset = end_;
+		end_ += data.size();
+	}
+
+	file_.seekp(offset);
+	file_.write((const char *)data.data(), data.size());
+	file_.flush();
+	if (!file_) {
+		warn << "Failed to write to chunk swap file " << path_;
+		file_.clear();
+		release(offset, data.size());
+		return false;
+	}
+
+	entries_[pos] = {offset, data.size(), needsSave};
+	stats_.evictions += 1;
+	stats_.liveBytes += data.size();
+	stats_.fileBytes = end_;
+	return true;
+}
+
+std::optional<ChunkSwap::Page> ChunkSwap::take(ChunkPos pos)
+{
+	auto it = entries_.find(pos);
+	if (it == entries_.end()) {
+		return std::nullopt;
+	}
+
+	// The swap holds the only copy of the chunk,
+	// so it's only let go of once it has been read back
+	Entry entry = it->second;
+	Page page;
+	page.words.resize(entry.size / sizeof(uint64_t));
+	page.needsSave = entry.needsSave;
+	file_.seekg(entry.offset);
+	file_.read((char *)page.words.data(), entry.size);
+	if (!file_) {
+		warn << "Failed to read chunk " << pos << " from " << path_;
+		file_.clear();
+		return std::nullopt;
+	}
+
+	entries_.erase(it);
+	stats_.liveBytes -= entry.size;
+	release(entry.offset, entry.size);
+	stats_.faults += 1;
+	return page;
+}
+
+void ChunkSwap::release(size_t offset, size_t size)
+{
+	// Once nothing is left, the file can start over from the beginning
+	if (entries_.empty()) {
+		free_.clear();
+		end_ = 0;
+		stats_.fileBytes = 0;
+		return;
+	}
+
+	free_.emplace(size, offset);
+}
+
+}
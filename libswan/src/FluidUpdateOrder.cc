@@ -0,0 +1,146 @@
+#include "FluidUpdateOrder.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace Swan {
+
+namespace {
+
+constexpr int CHUNK_X_SHIFT = std::countr_zero(unsigned(CHUNK_WIDTH * FLUID_RESOLUTION));
+constexpr int BAND_SHIFT = std::countr_zero(unsigned(FluidUpdateOrder::BAND_ROWS));
+
+static_assert(std::has_single_bit(unsigned(CHUNK_WIDTH * FLUID_RESOLUTION)));
+static_assert(std::has_single_bit(unsigned(FluidUpdateOrder::BAND_ROWS)));
+static_assert((CHUNK_HEIGHT * FLUID_RESOLUTION) % FluidUpdateOrder::BAND_ROWS == 0);
+
+// The splitmix64 finalizer
+uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+}
+
+uint64_t FluidUpdateOrder::bucketOf(FluidPos pos)
+{
+	// Bands never straddle chunks, so the band index along y
+	// identifies the chunk row too
+	return
+		(uint64_t(uint32_t(pos.x >> CHUNK_X_SHIFT)) << 32) |
+		uint64_t(uint32_t(pos.y >> BAND_SHIFT));
+}
+
+void FluidUpdateOrder::shuffle(std::vector<FluidPos> &updates, uint64_t seed)
+{
+	uint64_t rng = seed;
+	auto random = [&] {
+		rng += 0x9e3779b97f4a7c15ull;
+		return mix(rng);
+	};
+
+	// Count the updates in each bucket. Updates tend to come in clusters,
+	// so the previous update's bucket is checked before the table.
+	std::fill(tableValues_.begin(), tableValues_.end(), EMPTY);
+	counts_.clear();
+	updateBuckets_.resize(updates.size());
+	uint64_t lastBucket = 0;
+	uint32_t lastIndex = EMPTY;
+	for (size_t i = 0; i < updates.size(); ++i) {
+		uint64_t bucket = bucketOf(updates[i]);
+		if (lastIndex == EMPTY || bucket != lastBucket) {
+			lastBucket = bucket;
+			lastIndex = bucketIndex(bucket);
+		}
+
+		updateBuckets_[i] = lastIndex;
+		counts_[lastIndex] += 1;
+	}
+
+	// Lay the buckets out in a random order
+	bucketOrder_.resize(counts_.size());
+	for (size_t i = 0; i < bucketOrder_.size(); ++i) {
+		bucketOrder_[i] = uint32_t(i);
+	}
+	for (size_t i = bucketOrder_.size(); i > 1; --i) {
+		std::swap(bucketOrder_[i - 1], bucketOrder_[random() % i]);
+	}
+
+	starts_.resize(counts_.size());
+	uint32_t offset = 0;
+	for (uint32_t b: bucketOrder_) {
+		starts_[b] = offset;
+		offset += counts_[b];
+	}
+
+	// Put each update in its bucket, using the starts as cursors
+	out_.resize(updates.size());
+	for (size_t i = 0; i < updates.size(); ++i) {
+		out_[starts_[updateBuckets_[i]]++] = updates[i];
+	}
+
+	// Then shuffle each bucket
+	uint32_t begin = 0;
+	for (uint32_t b: bucketOrder_) {
+		uint32_t count = counts_[b];
+		FluidPos *bucket = out_.data() + begin;
+		for (uint32_t i = count; i > 1; --i) {
+			std::swap(bucket[i - 1], bucket[random() % i]);
+		}
+		begin += count;
+	}
+
+	std::swap(updates, out_);
+}
+
+uint32_t FluidUpdateOrder::bucketIndex(uint64_t bucket)
+{
+	if ((counts_.size() + 1) * 2 > tableValues_.size()) {
+		growTable();
+	}
+
+	size_t mask = tableValues_.size() - 1;
+	size_t slot = mix(bucket) & mask;
+	while (tableValues_[slot] != EMPTY) {
+		if (tableKeys_[slot] == bucket) {
+			return tableValues_[slot];
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	uint32_t index = uint32_t(counts_.size());
+	tableKeys_[slot] = bucket;
+	tableValues_[slot] = index;
+	counts_.push_back(0);
+	return index;
+}
+
+void FluidUpdateOrder::growTable()
+{
+	auto oldKeys = std::move(tableKeys_);
+	auto oldValues = std::move(tableValues_);
+	size_t size = std::max(oldValues.size() * 2, size_t(1024));
+	tableKeys_.assign(size, 0);
+	tableValues_.assign(size, EMPTY);
+
+	size_t mask = size - 1;
+	for (size_t i = 0; i < oldValues.size(); ++i) {
+		if (oldValues[i] == EMPTY) {
+			continue;
+		}
+
+		size_t slot = mix(oldKeys[i]) & mask;
+		while (tableValues_[slot] != EMPTY) {
+			slot = (slot + 1) & mask;
+		}
+		tableKeys_[slot] = oldKeys[i];
+		tableValues_[slot] = oldValues[i];
+	}
+}
+
+}
@@ -6,7 +6,8 @@
 #include <cstdlib>
 #include <fstream>
 #include <math.h>
-#include <sstream>
+#include <optional>
+#include <string.h>
 #include <time.h>
 #include <memory>
 #include <imgui/imgui.h>
@@ -14,6 +15,7 @@
 #include <stb/stb_image_write.h>
 
 #include <capnp/message.h>
+#include <capnp/serialize.h>
 #include <capnp/serialize-packed.h>
 
 #ifndef SWAN_HEADLESS
@@ -22,6 +24,7 @@
 #endif
 
 #include "Clock.h"
+#include "OS.h"
 #include "swan.capnp.h"
 
 #include "traits/InventoryTrait.h"
@@ -31,6 +34,13 @@ namespace Swan {
 
 static constexpr float TICK_DELTA = 1.0 / 20.0;
 
+// The journal is flushed every this many ticks, or once a batch grows past
+// JOURNAL_BATCH_SIZE. When the journal grows past JOURNAL_COMPACT_SIZE,
+// it's folded into the save, so that loading doesn't have to replay it all.
+static constexpr int JOURNAL_FLUSH_TICKS = 20;
+static constexpr size_t JOURNAL_BATCH_SIZE = 64 * 1024;
+static constexpr size_t JOURNAL_COMPACT_SIZE = 8 * 1024 * 1024;
+
 static std::string formatNow()
 {
 	time_t now = std::time(nullptr);
@@ -52,12 +62,39 @@ Game::Game(std::function<bool()> recompileMods):
 	}
 }
 
+Game::~Game()
+{
+	// The saver may be regenerating chunks with the world's world gen,
+	// so it has to finish before the world goes away
+	saver_.wait();
+}
+
+// Region files live in a directory next to the world file
+static std::filesystem::path regionDir(const std::string &worldPath)
+{
+	return cat(worldPath, ".regions");
+}
+
+// Journals from before 'epoch' are already part of the save
+static void removeOldJournals(const std::string &worldPath, uint64_t epoch)
+{
+	for (auto &[journalEpoch, path]: WorldJournal::find(worldPath)) {
+		if (journalEpoch < epoch) {
+			std::error_code err;
+			std::filesystem::remove(path, err);
+		}
+	}
+}
+
 void Game::createWorld(
 	std::string worldPath, const std::string &worldgen,
 	uint32_t seed, std::span<std::string> modPaths)
 {
 	ScopedTimer timer("create world");
 
+	// A save in progress may still be using the old world's world gen
+	saver_.wait();
+
 	world_ = std::make_unique<World>(this, seed, modPaths);
 	initInputHandler();
 	initCommandHandler();
@@ -71,6 +108,13 @@ void Game::createWorld(
 	world_->spawnPlayer();
 	hasSortedItems_ = false;
 	worldPath_ = std::move(worldPath);
+
+	// Journals left behind by another world in the same place don't apply
+	removeOldJournals(worldPath_, UINT64_MAX);
+	if (!journal_.open(WorldJournal::path(worldPath_, 0), 0)) {
+		warn << "Failed to start a journal, changes won't survive a crash!";
+	}
+	world_->journal_ = &journal_;
 }
 
 void Game::loadWorld(
@@ -78,24 +122,31 @@ void Game::loadWorld(
 {
 	ScopedTimer timer("load world");
 
-	std::ifstream f(worldPath, std::ios::binary);
-	if (!f) {
+	// A save in progress may still be using the old world's world gen,
+	// and whatever the previous world recorded belongs in its journal
+	saver_.wait();
+	journal_.close();
+
+	OS::MappedFile file;
+	if (!file.open(worldPath)) {
 		warn << "Failed to open " << worldPath << '!';
 		return;
 	}
 
-	std::stringstream ss;
-	ss << f.rdbuf();
-	f.close();
-	if (!f) {
-		warn << "Failed to load " << worldPath << '!';
-		return;
+	// New saves are unpacked, and read straight out of the mapping.
+	// Old saves are packed, so they have to be unpacked as they're read.
+	std::unique_ptr<capnp::MessageReader> reader;
+	std::optional<kj::ArrayInputStream> stream;
+	constexpr auto &magic = WorldSaver::WORLD_MAGIC;
+	if (file.size() >= sizeof(magic) && memcmp(file.data(), magic, sizeof(magic)) == 0) {
+		size_t words = (file.size() - sizeof(magic)) / sizeof(capnp::word);
+		reader = std::make_unique<capnp::FlatArrayMessageReader>(kj::ArrayPtr(
+			(const capnp::word *)(file.data() + sizeof(magic)), words));
+	} else {
+		stream.emplace(kj::ArrayPtr(file.data(), file.size()));
+		reader = std::make_unique<capnp::PackedMessageReader>(*stream);
 	}
 
-	auto data = std::move(ss).str();
-	kj::ArrayInputStream stream({(unsigned char *)data.data(), data.size()});
-	capnp::PackedMessageReader reader(stream);
-
 	world_ = std::make_unique<World>(this, 0, modPaths);
 	initInputHandler();
 	initCommandHandler();
@@ -104,8 +155,29 @@ void Game::loadWorld(
 		mod.mod_->start(*world_);
 	}
 
-	auto world = reader.getRoot<proto::World>();
-	world_->deserialize(world);
+	auto world = reader->getRoot<proto::World>();
+	world_->deserialize(world, regionDir(worldPath));
+
+	// Replay whatever happened after the save was made,
+	// and keep appending to the newest journal
+	uint64_t epoch = world.getJournalEpoch();
+	removeOldJournals(worldPath, epoch);
+	size_t keep = 0;
+	for (auto &[journalEpoch, path]: WorldJournal::find(worldPath)) {
+		auto contents = WorldJournal::read(path);
+		epoch = journalEpoch;
+		keep = contents ? contents->validSize : 0;
+		if (contents) {
+			info << "Replaying " << contents->records.size() << " changes from " << path;
+			world_->replayJournal(contents->records);
+		}
+	}
+
+	if (!journal_.open(WorldJournal::path(worldPath, epoch), epoch, keep)) {
+		warn << "Failed to open the journal, changes won't survive a crash!";
+	}
+	world_->journal_ = &journal_;
+
 	hasSortedItems_ = false;
 	worldPath_ = std::move(worldPath);
 }
@@ -168,6 +240,24 @@ void Game::drawDebugMenu()
 	ImGui::Checkbox("Show fluid particles", &debug_.fluidParticleLocations);
 	ImGui::Checkbox("Disable shadows", &debug_.disableShadows);
 
+	bool paletteTiles = chunkTileStorage_ == Chunk::TileStorage::PALETTE;
+	if (ImGui::Checkbox("Palette tile storage", &paletteTiles)) {
+		chunkTileStorage_ = paletteTiles
+			? Chunk::TileStorage::PALETTE
+			: Chunk::TileStorage::FLAT;
+		world_->currentPlane().setTileStorage(chunkTileStorage_);
+	}
+
+	ImGui::SliderInt(
+		"Chunk memory gzip level", &chunkMemoryGzipLevel_,
+		GZIP_LEVEL_NONE, GZIP_LEVEL_BEST);
+	ImGui::SliderInt(
+		"Chunk save gzip level", &chunkSaveGzipLevel_,
+		GZIP_LEVEL_NONE, GZIP_LEVEL_BEST);
+	ImGui::Checkbox("Save chunks as world gen deltas", &chunkSaveDeltas_);
+	ImGui::SliderInt("Chunk memory budget (MiB)", &chunkMemoryBudgetMiB_, 16, 8192);
+	ImGui::SliderFloat("Chunk init budget (ms)", &chunkInitBudgetMs_, 0.1, 16);
+
 	ImGui::Checkbox("Hand-break any tile", &debug_.handBreakAny);
 	ImGui::Checkbox("God mode", &debug_.godMode);
 	ImGui::Checkbox("Infinite items", &debug_.infiniteItems);
@@ -345,6 +435,27 @@ void Game::drawPerfMenu()
 		world_->currentPlane().getActiveChunkCount());
 	ImGui::Text("Chunk memory:  %.02f MiB",
 		world_->currentPlane().getChunkDataMemUsage() / double(1024 * 1024));
+	auto &bufStats = world_->currentPlane().getChunkBufferStats();
+	ImGui::Text("Chunk buffers: %zu (%.02f MiB, peak %.02f MiB, slabs %.02f MiB)",
+		bufStats.buffersInUse,
+		bufStats.bytesInUse / double(1024 * 1024),
+		bufStats.highWaterBytes / double(1024 * 1024),
+		bufStats.slabBytes / double(1024 * 1024));
+	ImGui::Text("Chunk codec:   %zu chunks pending, %zu worker threads",
+		world_->currentPlane().getPendingCodecCount(), workers_.threadCount());
+	auto &genStats = world_->currentPlane().getGenStats();
+	ImGui::Text("Chunk gen:     %zu generating, %zu in background, %zu stalls",
+		world_->currentPlane().getGeneratingChunkCount(),
+		genStats.background, genStats.stalls);
+	ImGui::Text("Chunk init:    %zu queued",
+		world_->currentPlane().getChunkInitQueueSize());
+	auto &swapStats = world_->currentPlane().getChunkSwapStats();
+	ImGui::Text("Chunk paging:  %zu paged out (%.02f MiB, file %.02f MiB), %zu out / %zu in",
+		world_->currentPlane().getPagedOutChunkCount(),
+		swapStats.liveBytes / double(1024 * 1024),
+		swapStats.fileBytes / double(1024 * 1024),
+		swapStats.evictions, swapStats.faults);
+	ImGui::Text("Save:          %s", saver_.busy() ? "writing" : "idle");
 }
 
 void Game::draw()
@@ -562,6 +673,7 @@ void Game::screenshot(const char *path, int w, int h)
 void Game::update(float dt)
 {
 	inputHandler_.beginFrame();
+	saver_.poll();
 
 	if (pauseAction_) {
 		paused_ = !paused_;
@@ -697,11 +809,24 @@ void Game::tick()
 
 	tickCount_ += 1;
 
-	if (triggerSave_) {
-		save();
+	// If the previous save is still being written, try again next tick
+	if (triggerSave_ && saveAsync([this](bool ok) {
+		popupMessage_ = ok ? "Saved!" : "Save failed!";
+		popupMessageTimer_ = 2;
+	})) {
 		triggerSave_ = false;
 	}
 
+	if (
+		tickCount_ % JOURNAL_FLUSH_TICKS == 0 ||
+		journal_.pendingBytes() >= JOURNAL_BATCH_SIZE) {
+		journal_.flush();
+	}
+
+	if (journal_.size() >= JOURNAL_COMPACT_SIZE && saveAsync()) {
+		info << "Folding " << (journal_.size() >> 10) << " KiB journal into the save";
+	}
+
 	perf_.tickCount += 1;
 	if (perf_.tickCount >= 20) {
 		perf_.entityTickTime.capture(perf_.tickCount);
@@ -716,49 +841,90 @@ void Game::tick()
 	}
 }
 
-void Game::save()
+bool Game::saveAsync(std::function<void(bool ok)> done)
 {
-	ScopedTimer timer("save world");
+	if (saver_.busy() || tickInProgress_) {
+		return false;
+	}
 
-	if (tickInProgress_) {
-		info << "Completing current tick...";
-		if (world_->tick(TICK_DELTA, RTDeadline(2))) {
-			tickInProgress_ = false;
+	ScopedTimer timer("snapshot world");
+
+	WorldSaver::Snapshot snapshot{
+		.worldPath = worldPath_,
+		.world = std::make_unique<capnp::MallocMessageBuilder>(),
+		.regions = {},
+		.gzipLevel = chunkSaveGzipLevel_,
+		.deltaChunks = chunkSaveDeltas_,
+	};
+	auto world = snapshot.world->initRoot<proto::World>();
+	world_->serialize(world, regionDir(worldPath_), snapshot.regions);
+
+	// Everything journaled so far is in the snapshot, so start a new journal.
+	// The old one is only removed once the save is on disk.
+	uint64_t epoch = journal_.epoch() + 1;
+	world.setJournalEpoch(epoch);
+	if (!journal_.open(WorldJournal::path(worldPath_, epoch), epoch)) {
+		warn << "Failed to start a new journal, changes won't survive a crash!";
+	}
+
+	info << "Saving " << snapshot.regions.size() << " regions to " << worldPath_ << "...";
+	saver_.start(std::move(snapshot), [
+		this, done = std::move(done), worldPath = worldPath_, epoch
+	](auto &result) {
+		for (auto &[id, pos]: result.failedRegions) {
+			WorldPlane *plane = world_ ? world_->getPlane(id) : nullptr;
+			if (plane) {
+				plane->markRegionUnsaved(pos);
+			}
+		}
+
+		if (result.ok) {
+			info
+				<< "Saved " << result.regionCount << " regions in "
+				<< int(result.seconds * 1000) << "ms";
+			removeOldJournals(worldPath, epoch);
 		} else {
-			warn << "Failed to complete tick in 2 seconds!";
+			warn << "Failed to save the world!";
 		}
-	}
 
-	info << "Serializing world...";
-	capnp::MallocMessageBuilder mb;
-	auto world = mb.initRoot<proto::World>();
-	world_->serialize(world);
-	kj::VectorOutputStream out;
-	capnp::writePackedMessage(out, mb);
+		if (done) {
+			done(result.ok);
+		}
+	});
 
-	info << "Writing " << (out.getArray().size() / 1024) << "k to " << worldPath_ << "...";
-	auto tmpPath = cat(worldPath_, ".tmp");
-	std::ofstream f(tmpPath, std::ios::binary);
-	if (!f) {
-		warn << "Failed to open " << tmpPath << " for writing!";
-		return;
-	}
+	return true;
+}
 
-	f.write((char *)&out.getArray().front(), out.getArray().size());
-	f.close();
-	if (!f) {
-		warn << "Failed write to " << tmpPath << '!';
-		return;
+void Game::save()
+{
+	ScopedTimer timer("save world");
+
+	// There's only room for one save at a time
+	saver_.wait();
+
+	// The tick has to be finished before the world can be snapshotted,
+	// however long that takes; this save might be the last chance
+	if (tickInProgress_) {
+		info << "Completing current tick...";
+		RTClock clock;
+		bool warned = false;
+		while (!world_->tick(TICK_DELTA, RTDeadline(2))) {
+			if (!warned) {
+				warn << "Current tick is taking more than 2 seconds to complete!";
+				warned = true;
+			}
+		}
+		tickInProgress_ = false;
+		if (warned) {
+			info << "Completed current tick in " << clock.duration() << "s";
+		}
 	}
 
-	std::error_code ec;
-	std::filesystem::rename(tmpPath, worldPath_, ec);
-	if (ec) {
-		warn << "Failed to commit file: " << ec.message();
+	if (!saveAsync()) {
+		warn << "Failed to start saving the world!";
 		return;
 	}
-
-	info << "Done!";
+	saver_.wait();
 }
 
 CommandSpec *Game::matchCommand(std::span<CowStr> tokens, std::vector<CowStr> &out)
@@ -1,6 +1,8 @@
 #include "OS.h"
 
+#include <algorithm>
 #include <stdexcept>
+#include <swan/log.h>
 
 #if defined(__MINGW32__)
 #define WIN32_LEAN_AND_MEAN
@@ -9,6 +11,12 @@
 #else
 #include <unistd.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
 #endif
 
 namespace Swan {
@@ -41,6 +49,166 @@ void *Dynlib::getVoid(const std::string &name)
 	FARPROC fp = GetProcAddress((HINSTANCE)handle_, name.c_str());
 	return (void *)fp;
 }
+
+void *allocPages(size_t size)
+{
+	return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void freePages(void *ptr, size_t)
+{
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+bool MappedFile::open(const std::filesystem::path &path)
+{
+	close();
+
+	HANDLE file = CreateFileW(
+		path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// The view keeps the file mapping alive on its own
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) {
+		return false;
+	}
+
+	data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data_) {
+		return false;
+	}
+
+	size_ = size.QuadPart;
+	return true;
+}
+
+bool writeFileDurably(
+	const std::filesystem::path &path,
+	std::span<const std::span<const unsigned char>> parts)
+{
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+
+	HANDLE file = CreateFileW(
+		tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		warn << "Failed to open " << tmpPath << " for writing: " << GetLastError();
+		return false;
+	}
+
+	for (auto part: parts) {
+		while (!part.empty()) {
+			DWORD n = 0;
+			DWORD len = std::min(part.size(), size_t(1) << 30);
+			if (!WriteFile(file, part.data(), len, &n, nullptr)) {
+				warn << "Failed write to " << tmpPath << ": " << GetLastError();
+				CloseHandle(file);
+				return false;
+			}
+			part = part.subspan(n);
+		}
+	}
+
+	if (!FlushFileBuffers(file)) {
+		warn << "Failed to flush " << tmpPath << ": " << GetLastError();
+		CloseHandle(file);
+		return false;
+	}
+	CloseHandle(file);
+
+	if (!MoveFileExW(
+			tmpPath.c_str(), path.c_str(),
+			MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		warn << "Failed to move " << tmpPath << " into place: " << GetLastError();
+		return false;
+	}
+
+	return true;
+}
+
+bool AppendFile::open(const std::filesystem::path &path, size_t keep)
+{
+	close();
+
+	HANDLE file = CreateFileW(
+		path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		warn << "Failed to open " << path << " for writing: " << GetLastError();
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	LARGE_INTEGER end;
+	end.QuadPart = std::min<LONGLONG>(size.QuadPart, keep);
+	if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+		warn << "Failed to truncate " << path << ": " << GetLastError();
+		CloseHandle(file);
+		return false;
+	}
+
+	handle_ = (intptr_t)file;
+	size_ = end.QuadPart;
+	return true;
+}
+
+bool AppendFile::append(std::span<const unsigned char> data)
+{
+	HANDLE file = (HANDLE)handle_;
+	while (!data.empty()) {
+		DWORD n = 0;
+		DWORD len = std::min(data.size(), size_t(1) << 30);
+		if (!WriteFile(file, data.data(), len, &n, nullptr)) {
+			warn << "Failed append: " << GetLastError();
+			return false;
+		}
+		data = data.subspan(n);
+		size_ += n;
+	}
+
+	if (!FlushFileBuffers(file)) {
+		warn << "Failed to flush: " << GetLastError();
+		return false;
+	}
+
+	return true;
+}
+
+void AppendFile::close()
+{
+	if (handle_ != -1) {
+		CloseHandle((HANDLE)handle_);
+		handle_ = -1;
+		size_ = 0;
+	}
+}
+
+void MappedFile::close()
+{
+	if (data_) {
+		UnmapViewOfFile(data_);
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
 #else
 #ifdef __APPLE__
 #define DYNLIB_EXT ".dylib"
@@ -66,6 +234,206 @@ void *Dynlib::getVoid(const std::string &name)
 {
 	return dlsym(handle_, name.c_str());
 }
+
+#ifdef MADV_HUGEPAGE
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+void *allocPages(size_t size)
+{
+	// Transparent huge pages only back aligned 2MiB ranges,
+	// so map a bit extra and trim off the unaligned ends
+	size_t mapSize = size + HUGE_PAGE_SIZE;
+	void *mem = mmap(
+		nullptr, mapSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		return nullptr;
+	}
+
+	uintptr_t start = (uintptr_t)mem;
+	uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	if (aligned > start) {
+		munmap(mem, aligned - start);
+	}
+	size_t tail = (start + mapSize) - (aligned + size);
+	if (tail > 0) {
+		munmap((void *)(aligned + size), tail);
+	}
+
+	// This is only a hint; it's fine if the kernel says no
+	madvise((void *)aligned, size, MADV_HUGEPAGE);
+	return (void *)aligned;
+}
+#else
+void *allocPages(size_t size)
+{
+	void *mem = mmap(
+		nullptr, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return mem == MAP_FAILED ? nullptr : mem;
+}
+#endif
+
+void freePages(void *ptr, size_t size)
+{
+	munmap(ptr, size);
+}
+
+bool MappedFile::open(const std::filesystem::path &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	// The mapping stays valid after the fd is closed
+	void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		return false;
+	}
+
+	data_ = mem;
+	size_ = st.st_size;
+	return true;
+}
+
+bool writeFileDurably(
+	const std::filesystem::path &path,
+	std::span<const std::span<const unsigned char>> parts)
+{
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		warn << "Failed to open " << tmpPath << " for writing: " << strerror(errno);
+		return false;
+	}
+
+	for (auto part: parts) {
+		while (!part.empty()) {
+			ssize_t n = ::write(fd, part.data(), part.size());
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0) {
+				warn << "Failed write to " << tmpPath << ": " << strerror(errno);
+				::close(fd);
+				return false;
+			}
+			part = part.subspan(n);
+		}
+	}
+
+	if (fsync(fd) < 0) {
+		warn << "Failed to flush " << tmpPath << ": " << strerror(errno);
+		::close(fd);
+		return false;
+	}
+	::close(fd);
+
+	if (rename(tmpPath.c_str(), path.c_str()) < 0) {
+		warn << "Failed to move " << tmpPath << " into place: " << strerror(errno);
+		return false;
+	}
+
+	// Make the rename itself durable too
+	auto dir = path.parent_path();
+	int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+	if (dirfd >= 0) {
+		fsync(dirfd);
+		::close(dirfd);
+	}
+
+	return true;
+}
+
+bool AppendFile::open(const std::filesystem::path &path, size_t keep)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		warn << "Failed to open " << path << " for writing: " << strerror(errno);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		::close(fd);
+		return false;
+	}
+
+	off_t end = std::min<off_t>(st.st_size, keep);
+	if (ftruncate(fd, end) < 0 || lseek(fd, end, SEEK_SET) < 0) {
+		warn << "Failed to truncate " << path << ": " << strerror(errno);
+		::close(fd);
+		return false;
+	}
+
+	// Make sure the file itself survives a crash, not just its contents
+	if (st.st_size == 0) {
+		auto dir = path.parent_path();
+		int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+		if (dirfd >= 0) {
+			fsync(dirfd);
+			::close(dirfd);
+		}
+	}
+
+	handle_ = fd;
+	size_ = end;
+	return true;
+}
+
+bool AppendFile::append(std::span<const unsigned char> data)
+{
+	int fd = handle_;
+	while (!data.empty()) {
+		ssize_t n = ::write(fd, data.data(), data.size());
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			warn << "Failed append: " << strerror(errno);
+			return false;
+		}
+		data = data.subspan(n);
+		size_ += n;
+	}
+
+	if (fsync(fd) < 0) {
+		warn << "Failed to flush: " << strerror(errno);
+		return false;
+	}
+
+	return true;
+}
+
+void AppendFile::close()
+{
+	if (handle_ != -1) {
+		::close(handle_);
+		handle_ = -1;
+		size_ = 0;
+	}
+}
+
+void MappedFile::close()
+{
+	if (data_) {
+		munmap(data_, size_);
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
 #endif
 
 Dynlib::Dynlib(Dynlib &&dl) noexcept: handle_(dl.handle_)
@@ -80,6 +448,50 @@ Dynlib &Dynlib::operator=(Dynlib &&dl) noexcept
 	return *this;
 }
 
+MappedFile::MappedFile(MappedFile &&mf) noexcept:
+	data_(mf.data_), size_(mf.size_)
+{
+	mf.data_ = nullptr;
+	mf.size_ = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&mf) noexcept
+{
+	close();
+	data_ = mf.data_;
+	size_ = mf.size_;
+	mf.data_ = nullptr;
+	mf.size_ = 0;
+	return *this;
+}
+
+AppendFile::AppendFile(AppendFile &&af) noexcept:
+	handle_(af.handle_), size_(af.size_)
+{
+	af.handle_ = -1;
+	af.size_ = 0;
+}
+
+AppendFile::~AppendFile()
+{
+	close();
+}
+
+AppendFile &AppendFile::operator=(AppendFile &&af) noexcept
+{
+	close();
+	handle_ = af.handle_;
+	size_ = af.size_;
+	af.handle_ = -1;
+	af.size_ = 0;
+	return *this;
+}
+
 }
 
 }
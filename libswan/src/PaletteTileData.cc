@@ -0,0 +1,180 @@
+#include "PaletteTileData.h"
+
+#include <assert.h>
+
+namespace Swan {
+
+PaletteTileData::PaletteTileData(ID fill)
+{
+	clear(fill);
+}
+
+void PaletteTileData::set(size_t index, ID id)
+{
+	uint64_t val;
+	if (bits_ == DIRECT_BITS) {
+		val = id;
+	} else {
+		int idx = findOrInsert(id);
+
+		// The palette is full, so re-pack with the new ID in place.
+		// That gets us a wider index, and gets rid of unused entries.
+		if (idx < 0) {
+			ID tmp[SIZE];
+			unpack(tmp);
+			tmp[index] = id;
+			pack(tmp);
+			return;
+		}
+
+		// With a single-entry palette, there's nothing to write
+		if (bits_ == 0) {
+			return;
+		}
+
+		val = idx;
+	}
+
+	size_t bit = index * bits_;
+	uint64_t &word = words_[bit / 64];
+	word &= ~(mask() << (bit % 64));
+	word |= val << (bit % 64);
+}
+
+void PaletteTileData::pack(std::span<const ID> in)
+{
+	assert(in.size() == SIZE);
+
+	// Consecutive tiles are usually the same,
+	// so only look through the palette when the ID changes
+	palette_.clear();
+	palette_.push_back(in[0]);
+	ID prev = in[0];
+	for (ID id: in) {
+		if (id == prev) {
+			continue;
+		}
+
+		prev = id;
+		bool found = false;
+		for (ID p: palette_) {
+			if (p == id) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			palette_.push_back(id);
+			if (palette_.size() > 256) {
+				break;
+			}
+		}
+	}
+
+	int bits = 0;
+	while ((size_t(1) << bits) < palette_.size()) {
+		bits = bits == 0 ? 1 : bits * 2;
+	}
+	resize(bits);
+
+	if (bits_ == 0) {
+		return;
+	}
+
+	if (bits_ == DIRECT_BITS) {
+		std::vector<ID>().swap(palette_);
+		for (size_t i = 0; i < SIZE; ++i) {
+			size_t bit = i * bits_;
+			words_[bit / 64] |= uint64_t(in[i]) << (bit % 64);
+		}
+		return;
+	}
+
+	palette_.shrink_to_fit();
+	ID prevID = palette_[0];
+	uint64_t prevIdx = 0;
+	for (size_t i = 0; i < SIZE; ++i) {
+		if (in[i] != prevID) {
+			prevID = in[i];
+			prevIdx = findOrInsert(prevID);
+		}
+
+		size_t bit = i * bits_;
+		words_[bit / 64] |= prevIdx << (bit % 64);
+	}
+}
+
+void PaletteTileData::unpack(std::span<ID> out) const
+{
+	assert(out.size() == SIZE);
+
+	if (bits_ == 0) {
+		for (ID &id: out) {
+			id = palette_[0];
+		}
+		return;
+	}
+
+	size_t perWord = 64 / bits_;
+	uint64_t m = mask();
+	size_t i = 0;
+	for (uint64_t word: words_) {
+		if (bits_ == DIRECT_BITS) {
+			for (size_t j = 0; j < perWord; ++j) {
+				out[i++] = word & m;
+				word >>= bits_;
+			}
+		} else {
+			for (size_t j = 0; j < perWord; ++j) {
+				out[i++] = palette_[word & m];
+				word >>= bits_;
+			}
+		}
+	}
+}
+
+void PaletteTileData::clear(ID fill)
+{
+	std::vector<ID>(1, fill).swap(palette_);
+	std::vector<uint64_t>().swap(words_);
+	bits_ = 0;
+}
+
+void PaletteTileData::reset()
+{
+	std::vector<ID>().swap(palette_);
+	std::vector<uint64_t>().swap(words_);
+	bits_ = 0;
+}
+
+size_t PaletteTileData::getMemUsage() const
+{
+	return
+		palette_.capacity() * sizeof(ID) +
+		words_.capacity() * sizeof(uint64_t);
+}
+
+int PaletteTileData::findOrInsert(ID id)
+{
+	for (size_t i = 0; i < palette_.size(); ++i) {
+		if (palette_[i] == id) {
+			return int(i);
+		}
+	}
+
+	if (palette_.size() >= (size_t(1) << bits_)) {
+		return -1;
+	}
+
+	palette_.push_back(id);
+	return int(palette_.size() - 1);
+}
+
+void PaletteTileData::resize(int bits)
+{
+	bits_ = bits;
+	std::vector<uint64_t>(SIZE * bits / 64, 0).swap(words_);
+}
+
+}
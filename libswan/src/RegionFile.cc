@@ -0,0 +1,140 @@
+#include "RegionFile.h"
+
+#include <bit>
+#include <string.h>
+
+#include <swan/log.h>
+#include <swan/util.h>
+
+namespace Swan {
+
+static_assert(std::endian::native == std::endian::little);
+
+static constexpr char MAGIC[4] = {'S', 'W', 'R', 'G'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t INDEX_SIZE = RegionFile::SIZE * RegionFile::SIZE;
+
+// The header is two words, and every index entry is one word
+static constexpr size_t HEADER_WORDS = 2;
+static constexpr size_t DATA_START = HEADER_WORDS + INDEX_SIZE;
+
+static size_t localIndex(ChunkPos pos)
+{
+	constexpr int mask = RegionFile::SIZE - 1;
+	return (pos.y & mask) * RegionFile::SIZE + (pos.x & mask);
+}
+
+std::filesystem::path RegionFile::path(
+	const std::filesystem::path &dir, RegionPos pos)
+{
+	return dir / cat("r.", pos.x, '.', pos.y, ".swr");
+}
+
+bool RegionReader::load(const std::filesystem::path &path)
+{
+	file_.reset();
+	entries_.clear();
+
+	auto file = std::make_shared<OS::MappedFile>();
+	if (!file->open(path)) {
+		warn << "Failed to open " << path << '!';
+		return false;
+	}
+
+	size_t size = file->size();
+	if (size % sizeof(capnp::word) != 0 || size < DATA_START * sizeof(capnp::word)) {
+		warn << "Region file " << path << " has a bad size";
+		return false;
+	}
+
+	uint32_t header[4];
+	memcpy(header, file->data(), sizeof(header));
+	if (
+		memcmp(&header[0], MAGIC, sizeof(MAGIC)) != 0 ||
+		header[1] != VERSION || header[2] != RegionFile::SIZE) {
+		warn << "Region file " << path << " has a bad header";
+		return false;
+	}
+
+	size_t wordCount = size / sizeof(capnp::word);
+	entries_.resize(INDEX_SIZE);
+	memcpy(
+		entries_.data(), file->data() + HEADER_WORDS * sizeof(capnp::word),
+		INDEX_SIZE * sizeof(Entry));
+	for (auto &entry: entries_) {
+		if (entry.length == 0) {
+			continue;
+		}
+
+		if (entry.offset < DATA_START || entry.offset + uint64_t(entry.length) > wordCount) {
+			warn << "Region file " << path << " has a bad index";
+			entries_.clear();
+			return false;
+		}
+	}
+
+	file_ = std::move(file);
+	return true;
+}
+
+size_t RegionReader::chunkCount() const
+{
+	size_t count = 0;
+	for (auto &entry: entries_) {
+		if (entry.length > 0) {
+			count += 1;
+		}
+	}
+
+	return count;
+}
+
+RegionWriter::RegionWriter()
+{
+	chunks_.resize(INDEX_SIZE);
+}
+
+void RegionWriter::setChunk(ChunkPos pos, capnp::MessageBuilder &mb)
+{
+	chunks_[localIndex(pos)] = capnp::messageToFlatArray(mb);
+}
+
+bool RegionWriter::write(const std::filesystem::path &path) const
+{
+	static_assert(sizeof(capnp::word) == 8);
+
+	uint32_t header[4] = {0, VERSION, RegionFile::SIZE, 0};
+	memcpy(&header[0], MAGIC, sizeof(MAGIC));
+
+	std::vector<uint32_t> index(INDEX_SIZE * 2);
+	size_t offset = DATA_START;
+	for (size_t i = 0; i < INDEX_SIZE; ++i) {
+		if (chunks_[i].size() == 0) {
+			continue;
+		}
+
+		index[i * 2] = offset;
+		index[i * 2 + 1] = chunks_[i].size();
+		offset += chunks_[i].size();
+	}
+
+	if (offset > UINT32_MAX) {
+		warn << "Region " << path << " is too big!";
+		return false;
+	}
+
+	std::vector<std::span<const unsigned char>> parts;
+	parts.reserve(2 + INDEX_SIZE);
+	parts.push_back({(const unsigned char *)header, sizeof(header)});
+	parts.push_back({(const unsigned char *)index.data(), index.size() * sizeof(uint32_t)});
+	for (auto &chunk: chunks_) {
+		if (chunk.size() > 0) {
+			auto bytes = chunk.asBytes();
+			parts.push_back({bytes.begin(), bytes.size()});
+		}
+	}
+
+	return OS::writeFileDurably(path, parts);
+}
+
+}
@@ -0,0 +1,199 @@
+#include "SparseFluidGrid.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace Swan {
+
+void SparseFluidGrid::fillTile(Vec2i tile, uint8_t value)
+{
+	size_t t = tile.y * CHUNK_WIDTH + tile.x;
+	if (value != AIR && value != SOLID) {
+		memset(blockForWrite(t), value, BLOCK_SIZE);
+		return;
+	}
+
+	if (!index_) {
+		if (fill_ == value) {
+			return;
+		}
+
+		allocIndex();
+	}
+
+	uint16_t &e = index_[t];
+	if (e >= FIRST_BLOCK) {
+		freeBlocks_.push_back(e);
+	}
+	e = value;
+}
+
+void SparseFluidGrid::collapseTile(Vec2i tile)
+{
+	const uint8_t *b = peekBlock(tile);
+	if (!b) {
+		return;
+	}
+
+	uint8_t first = b[0];
+	if (first != AIR && first != SOLID) {
+		return;
+	}
+
+	for (size_t i = 1; i < BLOCK_SIZE; ++i) {
+		if (b[i] != first) {
+			return;
+		}
+	}
+
+	fillTile(tile, first);
+}
+
+void SparseFluidGrid::pack(std::span<const uint8_t> in)
+{
+	assert(in.size() == SIZE);
+
+	reset();
+	allocIndex();
+
+	bool allSame = true;
+	for (int ty = 0; ty < CHUNK_HEIGHT; ++ty) {
+		for (int tx = 0; tx < CHUNK_WIDTH; ++tx) {
+			const uint8_t *src = &in[
+				ty * FLUID_RESOLUTION * WIDTH + tx * FLUID_RESOLUTION];
+
+			uint8_t first = src[0];
+			bool uniform = first == AIR || first == SOLID;
+			for (int y = 0; uniform && y < FLUID_RESOLUTION; ++y) {
+				for (int x = 0; x < FLUID_RESOLUTION; ++x) {
+					if (src[y * WIDTH + x] != first) {
+						uniform = false;
+						break;
+					}
+				}
+			}
+
+			uint16_t &e = index_[ty * CHUNK_WIDTH + tx];
+			if (uniform) {
+				e = first;
+			} else {
+				e = allocBlock();
+				uint8_t *dest = block(e);
+				for (int y = 0; y < FLUID_RESOLUTION; ++y) {
+					memcpy(
+						&dest[y * FLUID_RESOLUTION], &src[y * WIDTH],
+						FLUID_RESOLUTION);
+				}
+			}
+
+			if (e != index_[0]) {
+				allSame = false;
+			}
+		}
+	}
+
+	// Entirely air or entirely solid chunks don't need an index
+	if (allSame && index_[0] < FIRST_BLOCK) {
+		fill_ = index_[0];
+		index_.reset();
+	}
+}
+
+void SparseFluidGrid::unpack(std::span<uint8_t> out) const
+{
+	unpackRows(out, 0, CHUNK_HEIGHT);
+}
+
+void SparseFluidGrid::unpackRows(std::span<uint8_t> out, int begin, int end) const
+{
+	assert(out.size() == SIZE);
+	assert(begin >= 0 && begin <= end && end <= CHUNK_HEIGHT);
+
+	if (!index_) {
+		memset(
+			&out[begin * FLUID_RESOLUTION * WIDTH], fill_,
+			(end - begin) * FLUID_RESOLUTION * WIDTH);
+		return;
+	}
+
+	for (int ty = begin; ty < end; ++ty) {
+		for (int tx = 0; tx < CHUNK_WIDTH; ++tx) {
+			uint8_t *dest = &out[
+				ty * FLUID_RESOLUTION * WIDTH + tx * FLUID_RESOLUTION];
+
+			uint16_t e = index_[ty * CHUNK_WIDTH + tx];
+			if (e < FIRST_BLOCK) {
+				for (int y = 0; y < FLUID_RESOLUTION; ++y) {
+					memset(&dest[y * WIDTH], e, FLUID_RESOLUTION);
+				}
+			} else {
+				const uint8_t *src = block(e);
+				for (int y = 0; y < FLUID_RESOLUTION; ++y) {
+					memcpy(
+						&dest[y * WIDTH], &src[y * FLUID_RESOLUTION],
+						FLUID_RESOLUTION);
+				}
+			}
+		}
+	}
+}
+
+void SparseFluidGrid::reset()
+{
+	index_.reset();
+	fill_ = AIR;
+	std::vector<std::unique_ptr<uint8_t[]>>().swap(pages_);
+	std::vector<uint16_t>().swap(freeBlocks_);
+	blockSlots_ = 0;
+}
+
+size_t SparseFluidGrid::getMemUsage() const
+{
+	size_t size = pages_.size() * BLOCKS_PER_PAGE * BLOCK_SIZE;
+	size += freeBlocks_.capacity() * sizeof(uint16_t);
+	if (index_) {
+		size += CHUNK_WIDTH * CHUNK_HEIGHT * sizeof(uint16_t);
+	}
+	return size;
+}
+
+uint8_t *SparseFluidGrid::blockForWrite(size_t tile)
+{
+	if (!index_) {
+		allocIndex();
+	}
+
+	uint16_t &e = index_[tile];
+	if (e < FIRST_BLOCK) {
+		uint8_t value = uint8_t(e);
+		e = allocBlock();
+		memset(block(e), value, BLOCK_SIZE);
+	}
+
+	return block(e);
+}
+
+void SparseFluidGrid::allocIndex()
+{
+	index_ = std::make_unique<uint16_t[]>(CHUNK_WIDTH * CHUNK_HEIGHT);
+	for (size_t i = 0; i < CHUNK_WIDTH * CHUNK_HEIGHT; ++i) {
+		index_[i] = fill_;
+	}
+}
+
+uint16_t SparseFluidGrid::allocBlock()
+{
+	if (!freeBlocks_.empty()) {
+		uint16_t e = freeBlocks_.back();
+		freeBlocks_.pop_back();
+		return e;
+	}
+
+	if (blockSlots_ == pages_.size() * BLOCKS_PER_PAGE) {
+		pages_.push_back(std::make_unique<uint8_t[]>(BLOCKS_PER_PAGE * BLOCK_SIZE));
+	}
+
+	return uint16_t(FIRST_BLOCK + blockSlots_++);
+}
+
+}
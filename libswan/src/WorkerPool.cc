@@ -0,0 +1,79 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+namespace Swan {
+
+WorkerPool::WorkerPool(int threads)
+{
+	if (threads <= 0) {
+		threads = std::max(int(std::thread::hardware_concurrency()) - 1, 1);
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		threads_.emplace_back(&WorkerPool::run, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mut_);
+		running_ = false;
+	}
+
+	cond_.notify_all();
+	for (auto &thread: threads_) {
+		thread.join();
+	}
+}
+
+WorkerPool::JobPtr WorkerPool::submit(std::function<void()> func)
+{
+	auto job = std::make_shared<Job>();
+	job->func_ = std::move(func);
+	pending_.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lock(mut_);
+		queue_.push_back(job);
+	}
+
+	cond_.notify_one();
+	return job;
+}
+
+void WorkerPool::run()
+{
+	std::unique_lock<std::mutex> lock(mut_);
+
+	while (true) {
+		cond_.wait(lock, [&] {
+			return queue_.size() > 0 || !running_;
+		});
+
+		// Keep going until the queue is empty, even when shutting down
+		if (queue_.empty()) {
+			return;
+		}
+
+		JobPtr job = std::move(queue_.front());
+		queue_.pop_front();
+		lock.unlock();
+
+		try {
+			job->func_();
+		} catch (...) {
+			job->error_ = std::current_exception();
+		}
+
+		job->func_ = nullptr;
+		pending_.fetch_sub(1, std::memory_order_relaxed);
+		job->done_.store(true, std::memory_order_release);
+		job->done_.notify_all();
+
+		lock.lock();
+	}
+}
+
+}
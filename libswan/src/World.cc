@@ -1,6 +1,7 @@
 #include "World.h"
 
 #include <limits>
+#include <stdlib.h>
 #include <string_view>
 
 #include <swan/log.h>
@@ -8,14 +9,23 @@
 #include "Clock.h"
 #include "assets.h"
 #include "EntityCollectionImpl.h" // IWYU pragma: keep
+#include "traits/PhysicsBodyTrait.h"
 #include "swan/constants.h"
 
 namespace Swan {
 
-static void chunkLine(int l, WorldPlane &plane, ChunkPos &abspos, const Vec2i &dir)
+static void chunkLine(
+	int l, WorldPlane &plane, ChunkPos center, ChunkPos &abspos, const Vec2i &dir)
 {
 	for (int i = 0; i < l; ++i) {
-		plane.slowGetChunk(abspos).keepActive();
+		// The chunks right around the player have to be ready now,
+		// the rest can be decompressed in the background
+		Vec2i dist = abspos - center;
+		if (abs(dist.x) <= 1 && abs(dist.y) <= 1) {
+			plane.slowGetChunk(abspos).keepActive();
+		} else {
+			plane.prefetchChunk(abspos);
+		}
 		abspos += dir;
 	}
 }
@@ -455,17 +465,50 @@ void World::ChunkRenderer::tick(WorldPlane &plane, ChunkPos abspos)
 	ZoneScopedN("World::ChunkRenderer tick");
 	int l = 0;
 
+	ChunkPos center = abspos;
 	RTClock clock;
 	for (int i = 0; i < 4; ++i) {
-		chunkLine(l, plane, abspos, Vec2i(0, -1));
-		chunkLine(l, plane, abspos, Vec2i(1, 0));
+		chunkLine(l, plane, center, abspos, Vec2i(0, -1));
+		chunkLine(l, plane, center, abspos, Vec2i(1, 0));
 		l += 1;
-		chunkLine(l, plane, abspos, Vec2i(0, 1));
-		chunkLine(l, plane, abspos, Vec2i(-1, 0));
+		chunkLine(l, plane, center, abspos, Vec2i(0, 1));
+		chunkLine(l, plane, center, abspos, Vec2i(-1, 0));
 		l += 1;
 	}
 }
 
+void World::ChunkRenderer::prefetchAhead(WorldPlane &plane, Vec2 pos, Vec2 vel)
+{
+	// When the player is walking, the rings around them are plenty
+	constexpr float MIN_SPEED = 10;
+	constexpr float LOOKAHEAD_SECONDS = 3;
+	if (vel.squareLength() < MIN_SPEED * MIN_SPEED) {
+		return;
+	}
+
+	ZoneScopedN("World::ChunkRenderer prefetchAhead");
+
+	// Walk the path half a chunk at a time,
+	// and get the chunks around every point on it ready
+	Vec2 ahead = vel * LOOKAHEAD_SECONDS;
+	float step = std::min(CHUNK_WIDTH, CHUNK_HEIGHT) / 2.0f;
+	int steps = int(ahead.length() / step) + 1;
+	ChunkPos prev = chunkPos(tilePos(pos));
+	for (int i = 1; i <= steps; ++i) {
+		ChunkPos cpos = chunkPos(tilePos(pos + ahead * (float(i) / steps)));
+		if (cpos == prev) {
+			continue;
+		}
+
+		prev = cpos;
+		for (int y = -1; y <= 1; ++y) {
+			for (int x = -1; x <= 1; ++x) {
+				plane.prefetchChunk(cpos + ChunkPos{x, y});
+			}
+		}
+	}
+}
+
 void World::setWorldGen(std::string gen)
 {
 	defaultWorldGen_ = std::move(gen);
@@ -604,10 +647,17 @@ bool World::tick(float dt, RTDeadline deadline)
 	ZoneScopedN("World tick");
 
 	if (!tickProgress_.ongoing) {
+		auto &plane = *planes_[currentPlane_].plane;
 		chunkRenderer_.tick(
-			*planes_[currentPlane_].plane,
+			plane,
 			ChunkPos((int)player_->pos.x / CHUNK_WIDTH, (int)player_->pos.y / CHUNK_HEIGHT));
 
+		Vec2 vel{};
+		playerRef_.traitThen<PhysicsBodyTrait>([&](PhysicsBody &body) {
+			vel = body.velocity();
+		});
+		chunkRenderer_.prefetchAhead(plane, player_->pos, vel);
+
 		resourceTickCounter_ += 1;
 		if (resourceTickCounter_ >= 2) {
 			resources_.tick();
@@ -639,7 +689,9 @@ bool World::tick(float dt, RTDeadline deadline)
 	}
 }
 
-void World::serialize(proto::World::Builder w)
+void World::serialize(
+	proto::World::Builder w, const std::filesystem::path &regionDir,
+	std::vector<WorldPlane::RegionSnapshot> &regionSnapshots)
 {
 	auto tilesBuilder = w.initTiles(tiles_.size());
 	for (size_t i = 0; i < tiles_.size(); ++i) {
@@ -648,7 +700,9 @@ void World::serialize(proto::World::Builder w)
 
 	auto planesBuilder = w.initPlanes(planes_.size());
 	for (size_t i = 0; i < planes_.size(); ++i) {
-		planes_[i].plane->serialize(planesBuilder[i]);
+		auto &plane = *planes_[i].plane;
+		plane.serialize(
+			planesBuilder[i], regionDir / std::to_string(plane.id_), regionSnapshots);
 		planesBuilder[i].setWorldGen(planes_[i].worldGen);
 	}
 
@@ -657,13 +711,24 @@ void World::serialize(proto::World::Builder w)
 	w.setSeed(seed_);
 }
 
-void World::deserialize(proto::World::Reader r)
+void World::deserialize(proto::World::Reader r, const std::filesystem::path &regionDir)
 {
-	std::vector<Tile::ID> tileMap;
+	// Chunks hold on to the tile map until they're decompressed,
+	// so it's shared, and left out entirely when nothing changed
+	auto tileMap = std::make_shared<std::vector<Tile::ID>>();
 	auto tiles = r.getTiles();
-	tileMap.reserve(tiles.size());
+	tileMap->reserve(tiles.size());
+	bool tileMapIsIdentity = true;
 	for (auto tile: tiles) {
-		tileMap.push_back(getTileID(tile.cStr()));
+		Tile::ID id = getTileID(tile.cStr());
+		if (id != tileMap->size()) {
+			tileMapIsIdentity = false;
+		}
+		tileMap->push_back(id);
+	}
+
+	if (tileMapIsIdentity) {
+		tileMap.reset();
 	}
 
 	// Seed must exist before we deserialize planes
@@ -673,7 +738,8 @@ void World::deserialize(proto::World::Reader r)
 	planes_.clear();
 	planes_.reserve(planes.size());
 	for (auto plane: planes) {
-		addPlane(plane.getWorldGen().cStr()).deserialize(plane, tileMap);
+		auto &p = addPlane(plane.getWorldGen().cStr());
+		p.deserialize(plane, tileMap, regionDir / std::to_string(p.id_));
 	}
 
 	currentPlane_ = r.getCurrentPlane();
@@ -688,4 +754,11 @@ void World::deserialize(proto::World::Reader r)
 	game_->cam_.pos = player_->pos + player_->size / 2;
 }
 
+void World::replayJournal(std::span<const WorldJournal::Record> records)
+{
+	for (auto &plane: planes_) {
+		plane.plane->replay(records);
+	}
+}
+
 }
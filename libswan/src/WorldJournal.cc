@@ -0,0 +1,483 @@
+#include "WorldJournal.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <string.h>
+
+#include <swan/log.h>
+
+namespace Swan {
+
+static_assert(std::endian::native == std::endian::little);
+
+static constexpr char MAGIC[4] = {'S', 'W', 'J', 'L'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = 16;
+
+static constexpr char JOURNAL_SUFFIX[] = ".journal.";
+
+// 32-bit FNV-1a
+static uint32_t checksum(std::span<const unsigned char> data)
+{
+	uint32_t hash = 2166136261u;
+	for (auto ch: data) {
+		hash ^= ch;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+namespace {
+
+// Reads a batch, failing instead of reading out of bounds
+class BatchReader {
+public:
+	BatchReader(std::span<const unsigned char> data): data_(data) {}
+
+	bool done() const { return data_.empty(); }
+	bool failed() const { return failed_; }
+
+	template<typename T>
+	T get()
+	{
+		T val{};
+		if (data_.size() < sizeof(T)) {
+			failed_ = true;
+			data_ = {};
+			return val;
+		}
+
+		memcpy(&val, data_.data(), sizeof(T));
+		data_ = data_.subspan(sizeof(T));
+		return val;
+	}
+
+	std::span<const unsigned char> getBytes(size_t len)
+	{
+		if (data_.size() < len) {
+			failed_ = true;
+			data_ = {};
+			return {};
+		}
+
+		auto bytes = data_.subspan(0, len);
+		data_ = data_.subspan(len);
+		return bytes;
+	}
+
+	std::string getString()
+	{
+		auto bytes = getBytes(get<uint16_t>());
+		return std::string((const char *)bytes.data(), bytes.size());
+	}
+
+	TilePos getPos()
+	{
+		int32_t x = get<int32_t>();
+		int32_t y = get<int32_t>();
+		return {x, y};
+	}
+
+private:
+	std::span<const unsigned char> data_;
+	bool failed_ = false;
+};
+
+}
+
+// Returns false if the batch is corrupt
+static bool readBatch(
+	BatchReader &r, std::vector<WorldJournal::Record> &records,
+	std::vector<std::string> &tileNames, std::vector<std::string> &fluidNames)
+{
+	using Type = WorldJournal::RecordType;
+
+	while (!r.done()) {
+		WorldJournal::Record rec;
+		rec.type = Type(r.get<uint8_t>());
+		rec.plane = r.get<uint16_t>();
+
+		switch (rec.type) {
+		case Type::TILE_NAME: {
+			uint16_t id = r.get<uint16_t>();
+			if (id >= tileNames.size()) {
+				tileNames.resize(id + 1);
+			}
+			tileNames[id] = r.getString();
+			continue;
+		}
+
+		case Type::FLUID_NAME: {
+			uint8_t id = r.get<uint8_t>();
+			if (id >= fluidNames.size()) {
+				fluidNames.resize(id + 1);
+			}
+			fluidNames[id] = r.getString();
+			continue;
+		}
+
+		case Type::SET_TILE:
+		case Type::SET_BACKGROUND: {
+			rec.pos = r.getPos();
+			uint16_t id = r.get<uint16_t>();
+			if (id >= tileNames.size() || tileNames[id].empty()) {
+				return false;
+			}
+			rec.name = tileNames[id];
+			break;
+		}
+
+		case Type::SET_FLUID: {
+			rec.pos = r.getPos();
+			rec.fluidOp = WorldJournal::FluidOp(r.get<uint8_t>());
+			uint8_t id = r.get<uint8_t>();
+			if (id >= fluidNames.size() || fluidNames[id].empty()) {
+				return false;
+			}
+			rec.name = fluidNames[id];
+			break;
+		}
+
+		case Type::SPAWN_ENTITY: {
+			rec.name = r.getString();
+			rec.id = r.get<uint64_t>();
+			auto data = r.getBytes(r.get<uint32_t>());
+			rec.data.assign(data.begin(), data.end());
+			break;
+		}
+
+		case Type::DESPAWN_ENTITY:
+			rec.name = r.getString();
+			rec.id = r.get<uint64_t>();
+			break;
+
+		case Type::SPAWN_TILE_ENTITY:
+			rec.pos = r.getPos();
+			rec.name = r.getString();
+			break;
+
+		case Type::DESPAWN_TILE_ENTITY:
+			rec.pos = r.getPos();
+			break;
+
+		default:
+			return false;
+		}
+
+		if (r.failed()) {
+			return false;
+		}
+
+		records.push_back(std::move(rec));
+	}
+
+	return !r.failed();
+}
+
+std::filesystem::path WorldJournal::path(
+	const std::filesystem::path &worldPath, uint64_t epoch)
+{
+	auto path = worldPath;
+	path += cat(JOURNAL_SUFFIX, epoch);
+	return path;
+}
+
+std::vector<std::pair<uint64_t, std::filesystem::path>> WorldJournal::find(
+	const std::filesystem::path &worldPath)
+{
+	std::vector<std::pair<uint64_t, std::filesystem::path>> journals;
+
+	auto dir = worldPath.parent_path();
+	auto prefix = cat(worldPath.filename().string(), JOURNAL_SUFFIX);
+	std::error_code err;
+	for (auto &entry: std::filesystem::directory_iterator(
+			dir.empty() ? "." : dir, err)) {
+		auto name = entry.path().filename().string();
+		if (!name.starts_with(prefix)) {
+			continue;
+		}
+
+		uint64_t epoch;
+		auto start = name.data() + prefix.size();
+		auto end = name.data() + name.size();
+		auto res = std::from_chars(start, end, epoch);
+		if (res.ec != std::errc() || res.ptr != end || start == end) {
+			continue;
+		}
+
+		journals.push_back({epoch, path(worldPath, epoch)});
+	}
+
+	std::sort(journals.begin(), journals.end());
+	return journals;
+}
+
+std::optional<WorldJournal::Contents> WorldJournal::read(
+	const std::filesystem::path &path)
+{
+	OS::MappedFile file;
+	if (!file.open(path)) {
+		warn << "Failed to open " << path << '!';
+		return std::nullopt;
+	}
+
+	std::span<const unsigned char> data(file.data(), file.size());
+	if (data.size() < HEADER_SIZE || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+		warn << "Journal " << path << " has a bad header";
+		return std::nullopt;
+	}
+
+	uint32_t version;
+	memcpy(&version, data.data() + 4, sizeof(version));
+	if (version != VERSION) {
+		warn << "Journal " << path << " has unknown version " << version;
+		return std::nullopt;
+	}
+
+	Contents contents;
+	memcpy(&contents.epoch, data.data() + 8, sizeof(contents.epoch));
+	contents.validSize = HEADER_SIZE;
+
+	std::vector<std::string> tileNames;
+	std::vector<std::string> fluidNames;
+	std::vector<Record> batch;
+	auto rest = data.subspan(HEADER_SIZE);
+	while (rest.size() >= BATCH_HEADER_SIZE) {
+		uint32_t length, sum;
+		memcpy(&length, rest.data(), sizeof(length));
+		memcpy(&sum, rest.data() + 4, sizeof(sum));
+		if (length == 0 || rest.size() - BATCH_HEADER_SIZE < length) {
+			break;
+		}
+
+		auto records = rest.subspan(BATCH_HEADER_SIZE, length);
+		if (checksum(records) != sum) {
+			break;
+		}
+
+		BatchReader reader(records);
+		batch.clear();
+		if (!readBatch(reader, batch, tileNames, fluidNames)) {
+			warn << "Journal " << path << " has a corrupt batch";
+			break;
+		}
+
+		for (auto &rec: batch) {
+			contents.records.push_back(std::move(rec));
+		}
+
+		rest = rest.subspan(BATCH_HEADER_SIZE + length);
+		contents.validSize += BATCH_HEADER_SIZE + length;
+	}
+
+	if (contents.validSize != data.size()) {
+		info
+			<< "Dropping " << (data.size() - contents.validSize)
+			<< " bytes of incomplete journal from " << path;
+	}
+
+	return contents;
+}
+
+bool WorldJournal::open(
+	const std::filesystem::path &path, uint64_t epoch, size_t keep)
+{
+	close();
+	epoch_ = epoch;
+
+	if (!file_.open(path, keep)) {
+		return false;
+	}
+
+	if (keep > 0 && file_.size() == keep) {
+		return true;
+	}
+
+	// Start over if there wasn't anything to keep
+	file_.close();
+	if (!file_.open(path, 0)) {
+		return false;
+	}
+
+	unsigned char header[HEADER_SIZE];
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	memcpy(header + 4, &VERSION, sizeof(VERSION));
+	memcpy(header + 8, &epoch, sizeof(epoch));
+	if (!file_.append(header)) {
+		file_.close();
+		return false;
+	}
+
+	return true;
+}
+
+void WorldJournal::close()
+{
+	flush();
+	file_.close();
+	batch_.resize(BATCH_HEADER_SIZE);
+	tileNames_.clear();
+	fluidNames_.clear();
+}
+
+template<typename T>
+void WorldJournal::put(T val)
+{
+	auto *ptr = (const unsigned char *)&val;
+	batch_.insert(batch_.end(), ptr, ptr + sizeof(T));
+}
+
+void WorldJournal::putString(std::string_view str)
+{
+	size_t len = std::min(str.size(), size_t(UINT16_MAX));
+	put<uint16_t>(len);
+	batch_.insert(batch_.end(), str.begin(), str.begin() + len);
+}
+
+void WorldJournal::putHeader(RecordType type, uint16_t plane)
+{
+	put<uint8_t>(uint8_t(type));
+	put<uint16_t>(plane);
+}
+
+void WorldJournal::putPos(TilePos pos)
+{
+	put<int32_t>(pos.x);
+	put<int32_t>(pos.y);
+}
+
+void WorldJournal::putTile(
+	RecordType type, uint16_t plane, TilePos pos,
+	uint16_t tile, std::string_view name)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	if (tile >= tileNames_.size()) {
+		tileNames_.resize(tile + 1);
+	}
+	if (!tileNames_[tile]) {
+		putHeader(RecordType::TILE_NAME, 0);
+		put<uint16_t>(tile);
+		putString(name);
+		tileNames_[tile] = true;
+	}
+
+	putHeader(type, plane);
+	putPos(pos);
+	put<uint16_t>(tile);
+}
+
+void WorldJournal::setTile(
+	uint16_t plane, TilePos pos, uint16_t tile, std::string_view name)
+{
+	putTile(RecordType::SET_TILE, plane, pos, tile, name);
+}
+
+void WorldJournal::setBackground(
+	uint16_t plane, TilePos pos, uint16_t tile, std::string_view name)
+{
+	putTile(RecordType::SET_BACKGROUND, plane, pos, tile, name);
+}
+
+void WorldJournal::setFluid(
+	uint16_t plane, TilePos pos, FluidOp op, uint8_t fluid, std::string_view name)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	if (fluid >= fluidNames_.size()) {
+		fluidNames_.resize(fluid + 1);
+	}
+	if (!fluidNames_[fluid]) {
+		putHeader(RecordType::FLUID_NAME, 0);
+		put<uint8_t>(fluid);
+		putString(name);
+		fluidNames_[fluid] = true;
+	}
+
+	putHeader(RecordType::SET_FLUID, plane);
+	putPos(pos);
+	put<uint8_t>(uint8_t(op));
+	put<uint8_t>(fluid);
+}
+
+void WorldJournal::spawnEntity(
+	uint16_t plane, std::string_view coll, uint64_t id,
+	std::span<const unsigned char> data)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	putHeader(RecordType::SPAWN_ENTITY, plane);
+	putString(coll);
+	put<uint64_t>(id);
+	put<uint32_t>(data.size());
+	batch_.insert(batch_.end(), data.begin(), data.end());
+}
+
+void WorldJournal::despawnEntity(
+	uint16_t plane, std::string_view coll, uint64_t id)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	putHeader(RecordType::DESPAWN_ENTITY, plane);
+	putString(coll);
+	put<uint64_t>(id);
+}
+
+void WorldJournal::spawnTileEntity(
+	uint16_t plane, TilePos pos, std::string_view name)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	putHeader(RecordType::SPAWN_TILE_ENTITY, plane);
+	putPos(pos);
+	putString(name);
+}
+
+void WorldJournal::despawnTileEntity(uint16_t plane, TilePos pos)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	putHeader(RecordType::DESPAWN_TILE_ENTITY, plane);
+	putPos(pos);
+}
+
+bool WorldJournal::flush()
+{
+	if (!isOpen() || pendingBytes() == 0) {
+		return true;
+	}
+
+	uint32_t length = pendingBytes();
+	uint32_t sum = checksum(std::span(batch_).subspan(BATCH_HEADER_SIZE));
+	memcpy(batch_.data(), &length, sizeof(length));
+	memcpy(batch_.data() + 4, &sum, sizeof(sum));
+
+	bool ok = file_.append(batch_);
+	batch_.resize(BATCH_HEADER_SIZE);
+
+	// Anything appended after a torn batch would never be read back anyway
+	if (!ok) {
+		warn << "Failed to write the journal, not journaling until the next save";
+		file_.close();
+		tileNames_.clear();
+		fluidNames_.clear();
+	}
+
+	return ok;
+}
+
+}
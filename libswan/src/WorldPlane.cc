@@ -1,8 +1,12 @@
 #include "WorldPlane.h"
 
+#include <algorithm>
+#include <map>
 #include <math.h>
+#include <stdexcept>
 #include <utility>
 #include <capnp/message.h>
+#include <capnp/serialize.h>
 #include <capnp/serialize-packed.h>
 #include <kj/io.h>
 
@@ -19,7 +23,31 @@ WorldPlane::WorldPlane(
 	std::vector<std::unique_ptr<EntityCollection>> &&colls):
 	id_(id), world_(world), worldGen_(std::move(worldGen)),
 	entitySystem_(*this, std::move(colls))
-{}
+{
+	if (!worldGen_->canRegenerate()) {
+		return;
+	}
+
+	regenerator_ = std::make_shared<const Chunk::Regenerator::element_type>([
+		gen = worldGen_.get(), this
+	](ChunkPos pos, std::span<Tile::ID> tiles, std::span<Tile::ID> background) {
+		// Buffer pools aren't thread safe, so every thread gets its own
+		static thread_local ChunkBufferPool pool;
+		Chunk chunk(pos, pool, Chunk::TileStorage::FLAT);
+		gen->genChunk(*this, chunk);
+		chunk.readTiles([&](std::span<const Tile::ID> data) {
+			std::copy(data.begin(), data.end(), tiles.begin());
+		});
+		chunk.readBackgroundTiles([&](std::span<const Tile::ID> data) {
+			std::copy(data.begin(), data.end(), background.begin());
+		});
+	});
+}
+
+WorldPlane::~WorldPlane()
+{
+	cancelGeneration();
+}
 
 Context WorldPlane::getContext()
 {
@@ -33,72 +61,323 @@ Context WorldPlane::getContext()
 
 bool WorldPlane::hasChunk(ChunkPos pos)
 {
-	return chunks_.find(pos) != chunks_.end();
+	return chunks_.contains(pos) || swap_.contains(pos);
 }
 
-// This function will be a bit weird because it's a really fucking hot function.
 Chunk &WorldPlane::getChunk(ChunkPos pos)
 {
-	// First, look through all chunks which have been in use this tick
-	for (auto [chpos, chunk]: tickChunks_) {
-		if (chpos == pos) {
+	return getChunk(pos, chunkCache_);
+}
+
+// This function will be a bit weird because it's a really fucking hot function.
+Chunk &WorldPlane::getChunk(ChunkPos pos, ChunkIndex::Cache &cache)
+{
+	// Chunks which were recently looked up are probably in the cache,
+	// but the cache might also hand us an inactive chunk
+	Chunk *chunk = cache.find(chunks_, pos);
+	if (chunk && chunk->isActive()) {
+		if (suppressChunkKeepalive_ == 0) {
 			chunk->keepActive();
-			return *chunk;
 		}
+		return *chunk;
 	}
 
-	Chunk &chunk = slowGetChunk(pos);
+	Chunk &ch = slowGetChunk(pos);
 	if (suppressChunkKeepalive_ == 0) {
-		chunk.keepActive();
+		ch.keepActive();
 	}
-	tickChunks_.push_back({pos, &chunk});
-	return chunk;
+	return ch;
 }
 
 // Like getChunk, but does not keep chunks active
 Chunk *WorldPlane::subtleGetChunk(ChunkPos pos)
 {
-	// First, look through all chunks which have been in use this tick
-	for (auto [chpos, chunk]: tickChunks_) {
-		if (chpos == pos) {
-			return chunk;
+	return chunkCache_.find(chunks_, pos);
+}
+
+Chunk &WorldPlane::slowGetChunk(ChunkPos pos)
+{
+	ZoneScopedN("WorldPlane slowGetChunk");
+	Chunk *chunk = chunks_.find(pos);
+
+	// The chunk might have been paged out. If it can't be read back,
+	// the swap holds the only copy, so it mustn't be generated over.
+	if (!chunk && swap_.contains(pos)) {
+		chunk = pageInChunk(pos);
+		if (!chunk) {
+			throw std::runtime_error("Failed to page in a chunk");
+		}
+	}
+
+	// Or it might be on its way already, which beats starting over
+	if (!chunk) {
+		if (auto it = generating_.find(pos); it != generating_.end()) {
+			ZoneScopedN("Wait for generated chunk");
+			auto job = std::move(it->second.job);
+			auto gen = std::move(it->second.chunk);
+			generating_.erase(it);
+			job->wait();
+
+			// If it failed, it gets another go on this thread below
+			if (!job->failed()) {
+				chunk = &chunks_.insert(std::move(*gen));
+				addNewChunk(*chunk);
+				genStats_.stalls += 1;
+			}
+		}
+	}
+
+	// Create chunk if that turns out to be necessary
+	if (!chunk) {
+		chunk = &chunks_.insert(
+			Chunk(pos, bufferPool_, world_->game_->chunkTileStorage_));
+
+		worldGen_->genChunk(*this, *chunk);
+		addNewChunk(*chunk);
+		genStats_.stalls += 1;
+	}
+
+	// Otherwise, it might not be active, so let's activate it
+	else if (!chunk->isActive()) {
+		activateChunk(*chunk);
+	}
+
+	return *chunk;
+}
+
+Chunk *WorldPlane::prefetchChunk(ChunkPos pos)
+{
+	Chunk *chunk = chunks_.find(pos);
+	if (!chunk && swap_.contains(pos)) {
+		chunk = pageInChunk(pos);
+
+		// Try again next time, rather than generating over it
+		if (!chunk) {
+			return nullptr;
 		}
 	}
 
-	auto it = chunks_.find(pos);
-	if (it != chunks_.end()) {
-		return &it->second;
+	// World gens which can't generate chunks off the main thread
+	// have to do it right away
+	if (!chunk && !worldGen_->canRegenerate()) {
+		chunk = &slowGetChunk(pos);
+		chunk->keepActive();
+		return chunk;
+	}
+
+	if (!chunk) {
+		if (generating_.contains(pos) || generating_.size() >= MAX_GENERATING_CHUNKS) {
+			return nullptr;
+		}
+
+		// The chunk is generated with flat tiles, and gets the right tile
+		// storage once it's done; palette packing is for the main thread.
+		// Its data buffer has to come from the pool on the main thread too.
+		auto &gen = generating_[pos];
+		gen.chunk = std::make_unique<Chunk>(pos, bufferPool_, Chunk::TileStorage::FLAT);
+		gen.job = world_->game_->workers_.submit([this, chunk = gen.chunk.get()] {
+			worldGen_->genChunk(*this, *chunk);
+		});
+		return nullptr;
+	}
+
+	if (chunk->isActive()) {
+		chunk->keepActive();
+		return chunk;
+	}
+
+	if (chunk->decompressAsync(world_->game_->workers_)) {
+		codecChunks_.push_back(chunk);
 	}
 
 	return nullptr;
 }
 
-Chunk &WorldPlane::slowGetChunk(ChunkPos pos)
+void WorldPlane::activateChunk(Chunk &chunk)
 {
-	ZoneScopedN("WorldPlane slowGetChunk");
-	auto iter = chunks_.find(pos);
+	chunk.setTileStorage(world_->game_->chunkTileStorage_);
+	chunk.keepActive();
+	activeChunks_.push_back(&chunk);
+	lightSystem_.addChunk(chunk.pos(), chunk);
+	entitySystem_.wake(chunk);
+}
 
-	// Create chunk if that turns out to be necessary
-	if (iter == chunks_.end()) {
-		iter = chunks_.emplace(pos, Chunk(pos)).first;
-		Chunk &chunk = iter->second;
+void WorldPlane::addNewChunk(Chunk &chunk)
+{
+	chunk.setTileStorage(world_->game_->chunkTileStorage_);
+	activeChunks_.push_back(&chunk);
+	chunkInitList_.push_back({&chunk, 0});
 
-		worldGen_->genChunk(*this, chunk);
-		activeChunks_.push_back(&chunk);
-		chunkInitList_.push_back(&chunk);
+	// Need to tell the light engine too
+	lightSystem_.addChunk(chunk.pos(), chunk);
+}
 
-		// Need to tell the light engine too
-		lightSystem_.addChunk(pos, chunk);
+// Look up the tiles in a row. Tiles mostly come in runs,
+// so most of them don't need a lookup of their own.
+static void lookupTileRow(
+	World &world, std::span<const Tile::ID> ids, std::span<Tile *, CHUNK_WIDTH> out)
+{
+	Tile::ID prevID = ids[0];
+	Tile *prevTile = &world.getTileByID(prevID);
+	for (int x = 0; x < CHUNK_WIDTH; ++x) {
+		if (ids[x] != prevID) {
+			prevID = ids[x];
+			prevTile = &world.getTileByID(prevID);
+		}
+
+		out[x] = prevTile;
 	}
+}
 
-	// Otherwise, it might not be active, so let's activate it
-	else if (!iter->second.isActive()) {
-		iter->second.keepActive();
-		activeChunks_.push_back(&iter->second);
-		lightSystem_.addChunk(pos, iter->second);
+void WorldPlane::initChunk(Chunk &chunk)
+{
+	for (int row = 0; row < CHUNK_HEIGHT;) {
+		row = initChunkRows(chunk, row);
 	}
+}
 
-	return iter->second;
+int WorldPlane::initChunkRows(Chunk &chunk, int row)
+{
+	ZoneScopedN("Chunk Init");
+	constexpr int ROWS = 8;
+	int end = std::min(row + ROWS, CHUNK_HEIGHT);
+
+	// Only this call's rows are read; with palette storage, reading
+	// the whole layer would unpack the entire chunk every time
+	Tile::ID ids[ROWS][CHUNK_WIDTH];
+	Tile::ID backgroundIDs[ROWS][CHUNK_WIDTH];
+	Tile *tiles[ROWS][CHUNK_WIDTH];
+	Tile *background[ROWS][CHUNK_WIDTH];
+	for (int y = row; y < end; ++y) {
+		for (int x = 0; x < CHUNK_WIDTH; ++x) {
+			ids[y - row][x] = chunk.getTileID({x, y});
+			backgroundIDs[y - row][x] = chunk.getBackgroundTileID({x, y});
+		}
+
+		lookupTileRow(*world_, ids[y - row], tiles[y - row]);
+		lookupTileRow(*world_, backgroundIDs[y - row], background[y - row]);
+		chunk.initFluidSolidRow(y, tiles[y - row]);
+	}
+
+	// An onSpawn might replace tiles which haven't had theirs run yet,
+	// in which case it's the new tile's onSpawn which runs
+	auto ctx = getContext();
+	TilePos base = chunk.topLeft();
+	for (int y = row; y < end; ++y) {
+		for (int x = 0; x < CHUNK_WIDTH; ++x) {
+			Tile *tile = tiles[y - row][x];
+			Tile::ID id = chunk.getTileID({x, y});
+			if (id != ids[y - row][x]) {
+				tile = &world_->getTileByID(id);
+			}
+			if (tile->more->onSpawn) {
+				tile->more->onSpawn(ctx, base + Vec2i{x, y});
+			}
+
+			tile = background[y - row][x];
+			id = chunk.getBackgroundTileID({x, y});
+			if (id != backgroundIDs[y - row][x]) {
+				tile = &world_->getTileByID(id);
+			}
+			if (tile->more->onSpawn) {
+				tile->more->onSpawn(ctx, base + Vec2i{x, y});
+			}
+		}
+	}
+
+	return end;
+}
+
+void WorldPlane::initChunks(RTDeadline deadline)
+{
+	while (!chunkInitList_.empty()) {
+		auto &init = chunkInitList_.front();
+		init.row = initChunkRows(*init.chunk, init.row);
+		if (init.row >= CHUNK_HEIGHT) {
+			chunkInitList_.pop_front();
+		}
+
+		if (deadline.passed()) {
+			break;
+		}
+	}
+}
+
+void WorldPlane::finishChunkInit(Chunk &chunk)
+{
+	auto it = std::find_if(chunkInitList_.begin(), chunkInitList_.end(), [&](auto &init) {
+		return init.chunk == &chunk;
+	});
+	if (it == chunkInitList_.end()) {
+		return;
+	}
+
+	int row = it->row;
+	chunkInitList_.erase(it);
+	while (row < CHUNK_HEIGHT) {
+		row = initChunkRows(chunk, row);
+	}
+}
+
+void WorldPlane::pollGeneratedChunks()
+{
+	ZoneScopedN("WorldPlane poll generated chunks");
+	for (auto it = generating_.begin(); it != generating_.end();) {
+		if (!it->second.job->done()) {
+			++it;
+			continue;
+		}
+
+		// Leave it to be generated on the main thread when it's needed
+		if (it->second.job->failed()) {
+			warn << "Failed to generate chunk " << it->first << " in the background";
+			it = generating_.erase(it);
+			continue;
+		}
+
+		addNewChunk(chunks_.insert(std::move(*it->second.chunk)));
+		it = generating_.erase(it);
+		genStats_.background += 1;
+	}
+}
+
+void WorldPlane::cancelGeneration()
+{
+	for (auto &[pos, gen]: generating_) {
+		gen.job->wait();
+	}
+
+	generating_.clear();
+}
+
+void WorldPlane::pollChunkCodecs()
+{
+	ZoneScopedN("WorldPlane poll chunk codecs");
+	for (size_t i = 0; i < codecChunks_.size();) {
+		Chunk *chunk = codecChunks_[i];
+		bool finished;
+		try {
+			finished = chunk->pollCodec();
+		} catch (std::exception &err) {
+			// Only prefetches end up here, so the chunk can stay compressed;
+			// whoever actually needs it will run into the error again
+			warn << "Failed to decompress chunk " << chunk->pos() << ": " << err.what();
+			finished = false;
+		}
+		if (chunk->hasPendingCodec()) {
+			i += 1;
+			continue;
+		}
+
+		codecChunks_[i] = codecChunks_.back();
+		codecChunks_.pop_back();
+
+		// If the job was cancelled because someone needed the chunk
+		// right away, it has already been activated
+		if (finished && chunk->isActive()) {
+			activateChunk(*chunk);
+		}
+	}
 }
 
 EntityRef WorldPlane::spawnPlayer()
@@ -108,10 +387,13 @@ EntityRef WorldPlane::spawnPlayer()
 
 void WorldPlane::regenerate()
 {
+	cancelGeneration();
+	codecChunks_.clear();
 	activeChunks_.clear();
-	tickChunks_.clear();
 	chunkInitList_.clear();
 	chunks_.clear();
+	pageOutQueue_.clear();
+	swap_.close();
 	entitySystem_.despawnAllTileEntities();
 	lightSystem_.~LightSystem();
 	new (&lightSystem_) LightSystem(*this);
@@ -119,15 +401,216 @@ void WorldPlane::regenerate()
 	new (&fluidSystem_) FluidSystem(*this);
 }
 
+size_t WorldPlane::pregenerate(ChunkPos from, ChunkPos to)
+{
+	ZoneScopedN("WorldPlane pregenerate");
+	auto &game = *world_->game_;
+	cancelGeneration();
+
+	std::vector<ChunkPos> missing;
+	for (int y = from.y; y <= to.y; ++y) {
+		for (int x = from.x; x <= to.x; ++x) {
+			if (!hasChunk({x, y})) {
+				missing.push_back({x, y});
+			}
+		}
+	}
+
+	// Enough chunks at a time to keep the workers busy, but not so many
+	// that all of them have to be in memory uncompressed
+	size_t batchSize = std::max<size_t>(game.workers_.threadCount(), 1) * 16;
+	size_t generated = 0;
+	for (size_t start = 0; start < missing.size(); start += batchSize) {
+		size_t end = std::min(start + batchSize, missing.size());
+
+		// World gens which can't generate chunks off the main thread
+		// have to do it here, one at a time
+		std::vector<std::unique_ptr<Chunk>> batch;
+		std::vector<WorkerPool::JobPtr> jobs;
+		for (size_t i = start; i < end; ++i) {
+			auto &chunk = batch.emplace_back(std::make_unique<Chunk>(
+				missing[i], bufferPool_, Chunk::TileStorage::FLAT));
+			if (worldGen_->canRegenerate()) {
+				jobs.push_back(game.workers_.submit([this, chunk = chunk.get()] {
+					worldGen_->genChunk(*this, *chunk);
+				}));
+			} else {
+				worldGen_->genChunk(*this, *chunk);
+			}
+		}
+
+		for (auto &job: jobs) {
+			job->wait();
+		}
+
+		for (auto &job: jobs) {
+			job->rethrow();
+		}
+
+		// Initializing a chunk can run into a neighbour which doesn't
+		// exist yet, which then gets generated right away
+		std::vector<Chunk *> chunks;
+		for (auto &gen: batch) {
+			if (chunks_.find(gen->pos())) {
+				continue;
+			}
+
+			Chunk &chunk = chunks_.insert(std::move(*gen));
+			chunk.setTileStorage(game.chunkTileStorage_);
+			chunk.markModified();
+			chunks.push_back(&chunk);
+		}
+
+		// Tiles' onSpawn can do anything to the world,
+		// so that has to happen on this thread
+		for (Chunk *chunk: chunks) {
+			initChunk(*chunk);
+		}
+
+		suppressChunkKeepalive_ += 1;
+		for (Chunk *chunk: chunks) {
+			entitySystem_.hibernate(*chunk);
+			chunk->compressAsync(game.workers_, game.chunkMemoryGzipLevel_);
+		}
+		suppressChunkKeepalive_ -= 1;
+
+		for (Chunk *chunk: chunks) {
+			chunk->waitCodec();
+			queuePageOut(*chunk);
+		}
+
+		generated += chunks.size();
+		pageOutChunks(size_t(game.chunkMemoryBudgetMiB_) << 20);
+		info << "Pregenerated " << end << '/' << missing.size() << " chunks";
+	}
+
+	chunks_.invalidateCaches();
+	return generated;
+}
+
+void WorldPlane::setTileStorage(Chunk::TileStorage storage)
+{
+	ZoneScopedN("WorldPlane setTileStorage");
+	chunks_.forEach([&](Chunk &chunk) {
+		chunk.setTileStorage(storage);
+	});
+}
+
 size_t WorldPlane::getChunkDataMemUsage()
 {
 	size_t size = 0;
-	for (const auto &[_, chunk]: chunks_) {
+	chunks_.forEach([&](const Chunk &chunk) {
 		size += chunk.getMemUsage();
-	}
+	});
 	return size;
 }
 
+void WorldPlane::queuePageOut(Chunk &chunk)
+{
+	chunk.compressedStamp_ = ++pageOutStamp_;
+	pageOutQueue_.emplace_back(chunk.pos(), chunk.compressedStamp_);
+
+	// Chunks which keep getting used leave a trail of stale entries
+	if (pageOutQueue_.size() > chunks_.size() * 2 + 64) {
+		std::erase_if(pageOutQueue_, [&](auto &entry) {
+			Chunk *ch = chunks_.find(entry.first);
+			return !ch || ch->compressedStamp_ != entry.second;
+		});
+	}
+}
+
+void WorldPlane::pageOutChunks(size_t budget)
+{
+	size_t usage = getChunkDataMemUsage();
+	if (usage <= budget) {
+		return;
+	}
+
+	ZoneScopedN("WorldPlane page out chunks");
+
+	// Go a bit below the budget, so that this doesn't happen again right away
+	size_t target = budget - budget / 8;
+	size_t count = 0;
+	swap_.setPath(cat(world_->game_->worldPath_, ".swap.", id_));
+	for (size_t n = pageOutQueue_.size(); n > 0 && usage > target; --n) {
+		auto [pos, stamp] = pageOutQueue_.front();
+		pageOutQueue_.pop_front();
+
+		Chunk *chunk = chunks_.find(pos);
+		if (!chunk || chunk->compressedStamp_ != stamp || chunk->isActive()) {
+			continue;
+		}
+
+		// Chunks which are still being compressed, or which are used in place
+		// from a region file and so don't take up memory, stay in line
+		size_t mem = chunk->getMemUsage();
+		if (chunk->hasPendingCodec() || mem == 0) {
+			pageOutQueue_.emplace_back(pos, stamp);
+			continue;
+		}
+
+		if (!pageOutChunk(*chunk)) {
+			pageOutQueue_.emplace_back(pos, stamp);
+			break;
+		}
+
+		usage -= mem;
+		count += 1;
+	}
+
+	if (count > 0) {
+		info << "Paged out " << count << " chunks, down to " << (usage >> 20) << " MiB";
+	}
+}
+
+bool WorldPlane::pageOutChunk(Chunk &chunk)
+{
+	capnp::MallocMessageBuilder mb;
+	try {
+		// Compressed chunks are kept in the format they're in,
+		// with tile IDs from an older save fixed up on the way
+		auto snapshot = chunk.snapshot();
+		snapshot.regenerator = regenerator_;
+		Chunk::serialize(
+			snapshot, mb.initRoot<proto::Chunk>(),
+			world_->game_->chunkMemoryGzipLevel_,
+			snapshot.compression == proto::Chunk::Compression::DELTA);
+	} catch (std::exception &ex) {
+		warn << "Failed to page out chunk " << chunk.pos() << ": " << ex.what();
+		return false;
+	}
+
+	auto words = capnp::messageToFlatArray(mb);
+	auto bytes = words.asBytes();
+	if (!swap_.put(chunk.pos(), {bytes.begin(), bytes.size()}, chunk.needsSave())) {
+		return false;
+	}
+
+	std::erase_if(chunkInitList_, [&](auto &init) {
+		return init.chunk == &chunk;
+	});
+	chunks_.erase(chunk.pos());
+	return true;
+}
+
+Chunk *WorldPlane::pageInChunk(ChunkPos pos)
+{
+	ZoneScopedN("WorldPlane page in chunk");
+	auto page = swap_.take(pos);
+	if (!page) {
+		return nullptr;
+	}
+
+	capnp::FlatArrayMessageReader reader(kj::ArrayPtr(
+		(const capnp::word *)page->words.data(), page->words.size()));
+	Chunk &chunk = deserializeChunk(reader.getRoot<proto::Chunk>(), nullptr);
+	if (!page->needsSave) {
+		chunk.markSaved();
+	}
+
+	return &chunk;
+}
+
 Cygnet::Color WorldPlane::backgroundColor()
 {
 	return worldGen_->backgroundColor(world_->player_->pos);
@@ -150,15 +633,14 @@ void WorldPlane::draw(Cygnet::Renderer &rnd)
 
 	for (int x = -1; x <= 1; ++x) {
 		for (int y = -1; y <= 1; ++y) {
-			auto iter = chunks_.find(pcpos + ChunkPos(x, y));
-			if (iter != chunks_.end()) {
+			Chunk *chunk = chunks_.find(pcpos + ChunkPos(x, y));
+			if (chunk) {
 				ZoneScopedN("Chunk");
-				Chunk &chunk = iter->second;
-				chunk.draw(ctx, rnd);
+				chunk->draw(ctx, rnd);
 
 				if (ctx.game.debug_.drawChunkBoundaries) {
 					Vec2i size = {CHUNK_WIDTH, CHUNK_HEIGHT};
-					rnd.drawRect({chunk.pos() * size, size, {0.7, 0.1, 0.2, 1}});
+					rnd.drawRect({chunk->pos() * size, size, {0.7, 0.1, 0.2, 1}});
 				}
 			}
 		}
@@ -189,41 +671,17 @@ void WorldPlane::update(float dt)
 		worldGen_->update(getContext(), dt);
 	}
 
-	// Just init one chunk per frame
-	if (chunkInitList_.size() > 0) {
-		ZoneScopedN("Chunk Init");
-		Chunk *chunk = chunkInitList_.front();
-		chunkInitList_.pop_front();
+	pollChunkCodecs();
+	pollGeneratedChunks();
 
-		TilePos base = chunk->topLeft();
-		for (int y = 0; y < CHUNK_HEIGHT; ++y) {
-			for (int x = 0; x < CHUNK_WIDTH; ++x) {
-				Tile::ID id = chunk->getTileID({x, y});
-				Tile *tile = &world_->getTileByID(id);
-
-				if (tile->isSolid()) {
-					chunk->setFluidID({x, y}, World::SOLID_FLUID_ID);
-				} else if (tile->more->fluidCollision) {
-					chunk->setFluidSolid({x, y}, *tile->more->fluidCollision);
-				}
-
-				if (tile->more->onSpawn) {
-					tile->more->onSpawn(getContext(), base + Vec2i{x, y});
-				}
-
-				id = chunk->getBackgroundTileID({x, y});
-				tile = &world_->getTileByID(id);
-				if (tile->more->onSpawn) {
-					tile->more->onSpawn(getContext(), base + Vec2i{x, y});
-				}
-			}
-		}
-	}
+	initChunks(RTDeadline(world_->game_->chunkInitBudgetMs_ / 1000.0));
 
 	{
 		ZoneScopedN("Entities");
 		RTClock clock;
+		suppressChunkKeepalive_ += 1;
 		entitySystem_.update(dt);
+		suppressChunkKeepalive_ -= 1;
 		world_->game_->perf_.entityUpdateTime.record(clock.duration());
 	}
 
@@ -235,88 +693,104 @@ void WorldPlane::update(float dt)
 	}
 }
 
-bool WorldPlane::tick(float dt, RTDeadline deadline)
+bool WorldPlane::tickWorldTicks(RTDeadline deadline)
 {
-	ZoneScopedN("WorldPlane tick");
-
-	// Resume fluid processing if we're in the middle of a tick
-	if (tickProgress_ == TickProgress::FLUID_ONGOING) {
-		ZoneScopedN("Fluids (cont.)");
-		if (fluidSystem_.tick(deadline)) {
-			tickProgress_ = TickProgress::IDLE;
-			return true;
-		} else {
-			return false;
-		}
-	}
-
-	auto ctx = getContext();
-
-	// Clear tickChunks_ to prepare for the next tick
-	tickChunks_.clear();
-
-	// Perform world ticks
 	RTClock worldTickClock;
 	suppressChunkKeepalive_ += 1;
-	for (size_t i = 0; i < activeChunks_.size(); ++i) {
-		// Avoid range-based for loop because activeChunks_ might get resized
-		Chunk *chunk = activeChunks_[i];
 
-		// Tick random tiles in the chunk
-		for (size_t i = 0; i < 8; ++i) {
-			size_t randomPos = size_t(random() % (CHUNK_WIDTH * CHUNK_HEIGHT));
-			Tile &randomTile = world_->getTileByID(chunk->getTileData()[randomPos]);
-			if (randomTile.more->onWorldTick) {
-				auto pos = chunk->pos().scale(CHUNK_WIDTH, CHUNK_HEIGHT);
-				pos.x += randomPos % CHUNK_WIDTH;
-				pos.y += randomPos / CHUNK_WIDTH;
-				randomTile.more->onWorldTick(getContext(), pos);
-
-				if (world_->game_->debug_.drawWorldTicks) {
-					world_->game_->renderer_.drawRect({
-						.pos = pos.as<float>(),
-						.size = {1, 1},
-						.fill = {1, 0, 1, 1},
-					});
+	bool done = true;
+	while (tickIndex_ < activeChunks_.size()) {
+		// Avoid range-based for loop because activeChunks_ might get resized
+		for (size_t j = 0; j < 32 && tickIndex_ < activeChunks_.size(); ++j) {
+			Chunk *chunk = activeChunks_[tickIndex_++];
+
+			// Tick random tiles in the chunk
+			for (size_t i = 0; i < 8; ++i) {
+				size_t randomPos = size_t(random() % (CHUNK_WIDTH * CHUNK_HEIGHT));
+				Tile &randomTile = world_->getTileByID(chunk->getTileID({
+					int(randomPos % CHUNK_WIDTH), int(randomPos / CHUNK_WIDTH)}));
+				if (randomTile.more->onWorldTick) {
+					auto pos = chunk->pos().scale(CHUNK_WIDTH, CHUNK_HEIGHT);
+					pos.x += randomPos % CHUNK_WIDTH;
+					pos.y += randomPos / CHUNK_WIDTH;
+					randomTile.more->onWorldTick(getContext(), pos);
+
+					if (world_->game_->debug_.drawWorldTicks) {
+						world_->game_->renderer_.drawRect({
+							.pos = pos.as<float>(),
+							.size = {1, 1},
+							.fill = {1, 0, 1, 1},
+						});
+					}
 				}
 			}
 		}
+
+		if (tickIndex_ < activeChunks_.size() && deadline.passed()) {
+			done = false;
+			break;
+		}
 	}
+
 	suppressChunkKeepalive_ -= 1;
 	world_->game_->perf_.worldTickTime.record(worldTickClock.duration());
+	return done;
+}
 
+bool WorldPlane::tickChunks(float dt, RTDeadline deadline)
+{
 	// Tick all chunks, figure out if any of them should be deleted or compressed
-	bool hasDeletedChunk = false;
-	for (size_t i = 0; i < activeChunks_.size();) {
+	size_t &i = tickIndex_;
+	size_t checked = 0;
+	while (i < activeChunks_.size()) {
+		if (++checked % 64 == 0 && deadline.passed()) {
+			return false;
+		}
+
 		Chunk *chunk = activeChunks_[i];
 
 		auto action = chunk->tick(dt);
 
 		// Only delete/deactivate up to one chunk per tick
-		if (hasDeletedChunk) {
+		if (tickDeletedChunk_) {
 			action = Chunk::TickAction::NOTHING;
 		}
 
+		// The chunk's entities go to sleep along with it,
+		// which means that it has to be kept
+		if (action != Chunk::TickAction::NOTHING) {
+			finishChunkInit(*chunk);
+			suppressChunkKeepalive_ += 1;
+			if (entitySystem_.hibernate(*chunk)) {
+				action = Chunk::TickAction::DEACTIVATE;
+			}
+			suppressChunkKeepalive_ -= 1;
+		}
+
 		switch (action) {
 		case Chunk::TickAction::DEACTIVATE:
-			if (hasDeletedChunk) break;
 			info << "Compressing inactive modified chunk " << chunk->pos();
 			lightSystem_.removeChunk(chunk->pos());
 			chunk->lightGeneration_ = 0;
 			chunk->destroyTextures(world_->game_->renderer_);
-			chunk->compress();
+			if (chunk->compressAsync(
+					world_->game_->workers_,
+					world_->game_->chunkMemoryGzipLevel_)) {
+				codecChunks_.push_back(chunk);
+			}
+			queuePageOut(*chunk);
+			chunks_.invalidateCaches();
 			activeChunks_[i] = activeChunks_.back();
 			activeChunks_.pop_back();
-			hasDeletedChunk = true;
+			tickDeletedChunk_ = true;
 			break;
 
 		case Chunk::TickAction::DELETE:
-			if (hasDeletedChunk) break;
 			info << "Deleting inactive unmodified chunk " << chunk->pos();
 			lightSystem_.removeChunk(chunk->pos());
 			chunk->destroyTextures(world_->game_->renderer_);
+			std::erase(codecChunks_, chunk);
 			chunks_.erase(chunk->pos());
-			tickChunks_.clear();
 			activeChunks_[i] = activeChunks_.back();
 			activeChunks_.pop_back();
 			break;
@@ -327,63 +801,218 @@ bool WorldPlane::tick(float dt, RTDeadline deadline)
 		}
 	}
 
-	// First swap all the A and B buffers,
-	// so that the current frame's stuff is in 'B'...
-	std::swap(nextTickA_, nextTickB_);
-	RTClock tileTickClock;
-	tileSystem_.beginTick();
+	return true;
+}
 
-	// Then run through the 'B' buffers of nextTick
-	for (auto &cb: nextTickB_) {
-		cb(ctx);
+bool WorldPlane::tick(float dt, RTDeadline deadline)
+{
+	ZoneScopedN("WorldPlane tick");
+
+	// Each phase runs until it's done or the deadline passes. In the
+	// latter case, the next call picks up in the same phase, so a tick
+	// which is spread across several frames still runs its parts
+	// in the same order as one which isn't. Every call makes some
+	// progress, even if the deadline passed before it was made.
+	switch (tickProgress_) {
+	case TickProgress::IDLE:
+		tickIndex_ = 0;
+		tickProgress_ = TickProgress::WORLD_TICKS_ONGOING;
+		[[fallthrough]];
+
+	case TickProgress::WORLD_TICKS_ONGOING: {
+		ZoneScopedN("World ticks");
+		if (!tickWorldTicks(deadline)) {
+			return false;
+		}
+
+		tickIndex_ = 0;
+		tickDeletedChunk_ = false;
+		tickProgress_ = TickProgress::CHUNKS_ONGOING;
+		[[fallthrough]];
 	}
-	nextTickB_.clear();
 
-	// ..and the 'B' buffers of the tile system
-	tileSystem_.endTick();
-	world_->game_->perf_.tileTickTime.record(tileTickClock.duration());
+	case TickProgress::CHUNKS_ONGOING: {
+		ZoneScopedN("Chunks");
+		if (!tickChunks(dt, deadline)) {
+			return false;
+		}
 
-	{
-		// Tick entities
+		// Finding out how much memory the chunks use means going through
+		// all of them, so it only happens about once a second
+		if (++pageOutTicks_ >= 20) {
+			pageOutTicks_ = 0;
+			pageOutChunks(size_t(world_->game_->chunkMemoryBudgetMiB_) << 20);
+		}
+
+		// First swap all the A and B buffers,
+		// so that the current frame's stuff is in 'B'...
+		std::swap(nextTickA_, nextTickB_);
+		tileSystem_.beginTick();
+		tickIndex_ = 0;
+		tickProgress_ = TickProgress::NEXT_TICK_ONGOING;
+		[[fallthrough]];
+	}
+
+	case TickProgress::NEXT_TICK_ONGOING: {
+		// Then run through the 'B' buffers of nextTick.
+		// Callbacks which schedule more callbacks add them to 'A'.
+		ZoneScopedN("Next tick");
+		RTClock tileTickClock;
+		auto ctx = getContext();
+		while (tickIndex_ < nextTickB_.size()) {
+			nextTickB_[tickIndex_++](ctx);
+			if (tickIndex_ < nextTickB_.size() && deadline.passed()) {
+				world_->game_->perf_.tileTickTime.record(tileTickClock.duration());
+				return false;
+			}
+		}
+		nextTickB_.clear();
+		tickIndex_ = 0;
+		world_->game_->perf_.tileTickTime.record(tileTickClock.duration());
+		tickProgress_ = TickProgress::TILES_ONGOING;
+		[[fallthrough]];
+	}
+
+	case TickProgress::TILES_ONGOING: {
+		// ..and the 'B' buffers of the tile system
+		ZoneScopedN("Tiles");
+		RTClock tileTickClock;
+		bool done = tileSystem_.endTick(deadline);
+		world_->game_->perf_.tileTickTime.record(tileTickClock.duration());
+		if (!done) {
+			return false;
+		}
+
+		tickProgress_ = TickProgress::ENTITIES_ONGOING;
+		[[fallthrough]];
+	}
+
+	case TickProgress::ENTITIES_ONGOING: {
+		// Tick entities. They don't keep the chunks they're in active,
+		// so that chunks away from the player can go to sleep with them.
 		ZoneScopedN("Entities");
 		RTClock clock;
-		entitySystem_.tick(dt);
+		suppressChunkKeepalive_ += 1;
+		bool done = entitySystem_.tick(dt, deadline);
+		suppressChunkKeepalive_ -= 1;
 		world_->game_->perf_.entityTickTime.record(clock.duration());
+		if (!done) {
+			return false;
+		}
+
+		tickProgress_ = TickProgress::FLUID_ONGOING;
+		[[fallthrough]];
 	}
 
-	{
+	case TickProgress::FLUID_ONGOING: {
 		// Tick fluids, possibly stopping in the middle
 		ZoneScopedN("Fluids");
 		RTClock clock;
-		if (fluidSystem_.tick(deadline)) {
-			tickProgress_ = TickProgress::IDLE;
-		} else {
-			tickProgress_ = TickProgress::FLUID_ONGOING;
-		}
+		bool done = fluidSystem_.tick(deadline);
 		world_->game_->perf_.fluidTickTime.record(clock.duration());
+		if (!done) {
+			return false;
+		}
+
+		tickProgress_ = TickProgress::IDLE;
+		break;
+	}
 	}
 
-	return tickProgress_ == TickProgress::IDLE;
+	return true;
 }
 
-void WorldPlane::serialize(proto::WorldPlane::Builder w)
+void WorldPlane::serialize(
+	proto::WorldPlane::Builder w, const std::filesystem::path &regionDir,
+	std::vector<RegionSnapshot> &regionSnapshots)
 {
 	entitySystem_.serialize(w.initEntitySystem());
 	fluidSystem_.serialize(w.initFluidSystem());
 
-	size_t chunkCount = 0;
-	for (auto &[pos, chunk]: chunks_) {
-		if (chunk.isModified()) {
-			chunkCount += 1;
+	// Only regions with a chunk which changed since the last save
+	// get rewritten, but those have to contain all their modified chunks.
+	// Regions which failed to save last time are retried.
+	std::unordered_set<RegionPos> dirtyRegions = std::move(unsavedRegions_);
+	unsavedRegions_.clear();
+	chunks_.forEach([&](Chunk &chunk) {
+		if (chunk.isModified() && chunk.needsSave()) {
+			dirtyRegions.insert(RegionFile::regionPos(chunk.pos()));
+		}
+	});
+
+	// Paged out chunks in the regions which get rewritten have to come back
+	// in for the save; they get paged out again if there's still no room
+	auto pagedOut = swap_.list();
+	for (auto &[pos, needsSave]: pagedOut) {
+		if (needsSave) {
+			dirtyRegions.insert(RegionFile::regionPos(pos));
+		}
+	}
+	std::unordered_set<RegionPos> incompleteRegions;
+	for (auto &[pos, needsSave]: pagedOut) {
+		RegionPos rp = RegionFile::regionPos(pos);
+		if (dirtyRegions.contains(rp) && !pageInChunk(pos)) {
+			incompleteRegions.insert(rp);
 		}
 	}
 
-	auto chunks = w.initChunks(chunkCount);
-	size_t index = 0;
-	for (auto &[pos, chunk]: chunks_) {
-		if (chunk.isModified()) {
-			chunk.serialize(chunks[index++]);
+	std::unordered_map<RegionPos, size_t> snapshotIndex;
+	for (RegionPos rp: dirtyRegions) {
+		bool incomplete = incompleteRegions.contains(rp);
+		regionSnapshots.push_back({
+			.plane = id_,
+			.pos = rp,
+			.path = RegionFile::path(regionDir, rp),
+			.chunks = {},
+			.incomplete = incomplete,
+		});
+
+		// The region's chunks stay modified, for the next save to try again
+		if (incomplete) {
+			continue;
 		}
+
+		snapshotIndex[rp] = regionSnapshots.size() - 1;
+		savedRegions_.insert(rp);
+	}
+
+	std::vector<Chunk *> savedChunks;
+	std::vector<size_t> savedChunkRegions;
+	chunks_.forEach([&](Chunk &chunk) {
+		auto it = snapshotIndex.find(RegionFile::regionPos(chunk.pos()));
+		if (!chunk.isModified() || it == snapshotIndex.end()) {
+			return;
+		}
+
+		// The chunk might still be using the old region file in place,
+		// which has to be let go of before it's replaced
+		chunk.detachCompressedData();
+		savedChunks.push_back(&chunk);
+		savedChunkRegions.push_back(it->second);
+		chunk.markSaved();
+	});
+
+	// Active chunks have to be encoded, which is spread over the workers
+	auto snapshots = Chunk::snapshotAll(savedChunks, world_->game_->workers_);
+	for (size_t i = 0; i < snapshots.size(); ++i) {
+		snapshots[i].regenerator = regenerator_;
+		regionSnapshots[savedChunkRegions[i]].chunks.push_back(std::move(snapshots[i]));
+	}
+
+	if (!dirtyRegions.empty()) {
+		std::error_code ec;
+		std::filesystem::create_directories(regionDir, ec);
+		if (ec) {
+			warn << "Failed to create " << regionDir << ": " << ec.message();
+		}
+	}
+
+	auto regions = w.initRegions(savedRegions_.size());
+	size_t index = 0;
+	for (RegionPos rp: savedRegions_) {
+		regions[index].setX(rp.x);
+		regions[index].setY(rp.y);
+		index += 1;
 	}
 
 	{
@@ -398,8 +1027,13 @@ void WorldPlane::serialize(proto::WorldPlane::Builder w)
 	}
 }
 
-void WorldPlane::deserialize(proto::WorldPlane::Reader r, std::span<Tile::ID> tileMap)
+void WorldPlane::deserialize(
+	proto::WorldPlane::Reader r, Chunk::TileMap tileMap,
+	const std::filesystem::path &regionDir)
 {
+	// The world gen mustn't change under a chunk it's generating
+	cancelGeneration();
+
 	{
 		// Deserialize world generator
 		auto data = r.getWorldGenData();
@@ -410,24 +1044,152 @@ void WorldPlane::deserialize(proto::WorldPlane::Reader r, std::span<Tile::ID> ti
 		}
 	}
 
+	codecChunks_.clear();
 	chunks_.clear();
 	activeChunks_.clear();
-	tickChunks_.clear();
 	chunkInitList_.clear();
+	savedRegions_.clear();
+	unsavedRegions_.clear();
+	pageOutQueue_.clear();
+	swap_.close();
+
+	// Old saves have their chunks inline; those chunks are left
+	// marked as needing a save, so that they move to region files
 	for (auto chunkR: r.getChunks()) {
-		Chunk tempChunk({0, 0});
-		tempChunk.deserialize(chunkR, tileMap);
-		auto [it, _] = chunks_.emplace(tempChunk.pos(), std::move(tempChunk));
-		auto &chunk = it->second;
+		deserializeChunk(chunkR, tileMap);
+	}
 
-		if (chunk.isActive()) {
-			lightSystem_.addChunk(chunk.pos(), chunk);
-			activeChunks_.push_back(&chunk);
+	for (auto regionR: r.getRegions()) {
+		RegionPos rp{regionR.getX(), regionR.getY()};
+		RegionReader reader;
+		if (!reader.load(RegionFile::path(regionDir, rp))) {
+			warn << "Skipping region " << rp;
+			continue;
 		}
+
+		// Compressed chunks keep the region file mapped
+		// and use their data in place, until they're activated
+		reader.forEachChunk([&](proto::Chunk::Reader chunkR) {
+			deserializeChunk(chunkR, tileMap, reader.backing()).markSaved();
+		});
+		savedRegions_.insert(rp);
 	}
 
 	fluidSystem_.deserialize(r.getFluidSystem());
 	entitySystem_.deserialize(r.getEntitySystem());
+
+	// Chunks which were saved uncompressed are active already, but their
+	// entities couldn't wake up before the entity system was loaded.
+	// Waking them can activate more chunks, so no range-based for loop.
+	for (size_t i = 0; i < activeChunks_.size(); ++i) {
+		entitySystem_.wake(*activeChunks_[i]);
+	}
+}
+
+void WorldPlane::replay(std::span<const WorldJournal::Record> records)
+{
+	using Type = WorldJournal::RecordType;
+	using FluidOp = WorldJournal::FluidOp;
+
+	// Entities which the journal spawns don't necessarily get the same ID
+	// as they did the first time, so despawns have to be translated
+	std::map<std::pair<std::string_view, uint64_t>, EntityRef> spawned;
+
+	for (auto &rec: records) {
+		if (rec.plane != id_) {
+			continue;
+		}
+
+		switch (rec.type) {
+		case Type::SET_TILE:
+			tileSystem_.restoreID(rec.pos, world_->getTileID(rec.name));
+			break;
+
+		case Type::SET_BACKGROUND:
+			tileSystem_.restoreBackgroundID(rec.pos, world_->getTileID(rec.name));
+			break;
+
+		case Type::SET_FLUID: {
+			Fluid::ID fluid = world_->getFluidID(rec.name);
+			if (rec.fluidOp == FluidOp::SET) {
+				fluidSystem_.setInTile(rec.pos, fluid);
+			} else if (rec.fluidOp == FluidOp::SET_PARTIAL) {
+				fluidSystem_.setPartialInTile(rec.pos, fluid);
+			} else {
+				fluidSystem_.replaceInTile(rec.pos, fluid);
+			}
+			break;
+		}
+
+		case Type::SPAWN_ENTITY: {
+			auto ref = entitySystem_.spawn(
+				rec.name, capnp::Data::Reader(rec.data.data(), rec.data.size()));
+			if (ref) {
+				spawned[{rec.name, rec.id}] = ref;
+			}
+			break;
+		}
+
+		case Type::DESPAWN_ENTITY: {
+			EntityRef ref;
+			if (auto it = spawned.find({rec.name, rec.id}); it != spawned.end()) {
+				ref = it->second;
+				spawned.erase(it);
+			} else if (auto *coll = entitySystem_.getCollectionOf(rec.name)) {
+				if (coll->get(rec.id)) {
+					ref = {coll, rec.id};
+				} else {
+					entitySystem_.despawnHibernating({coll, rec.id});
+				}
+			}
+
+			if (ref) {
+				entitySystem_.despawn(ref);
+			}
+			break;
+		}
+
+		case Type::SPAWN_TILE_ENTITY:
+			// Activating the chunk wakes up a tile entity
+			// which might be hibernating in it
+			getChunk(chunkPos(rec.pos));
+			entitySystem_.spawnTileEntity(rec.pos, rec.name);
+			break;
+
+		case Type::DESPAWN_TILE_ENTITY:
+			getChunk(chunkPos(rec.pos));
+			if (entitySystem_.getTileEntity(rec.pos)) {
+				entitySystem_.despawnTileEntity(rec.pos);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+void WorldPlane::markRegionUnsaved(RegionPos pos)
+{
+	unsavedRegions_.insert(pos);
+}
+
+Chunk &WorldPlane::deserializeChunk(
+	proto::Chunk::Reader r, Chunk::TileMap tileMap,
+	std::shared_ptr<const void> backing)
+{
+	Chunk tempChunk({0, 0}, bufferPool_, world_->game_->chunkTileStorage_);
+	tempChunk.deserialize(r, std::move(tileMap), std::move(backing), regenerator_);
+	auto &chunk = chunks_.insert(std::move(tempChunk));
+
+	if (chunk.isActive()) {
+		lightSystem_.addChunk(chunk.pos(), chunk);
+		activeChunks_.push_back(&chunk);
+	} else {
+		queuePageOut(chunk);
+	}
+
+	return chunk;
 }
 
 }
@@ -0,0 +1,145 @@
+#include "WorldSaver.h"
+
+#include <assert.h>
+#include <capnp/serialize.h>
+
+#include <swan/log.h>
+#include "Clock.h"
+#include "OS.h"
+#include "RegionFile.h"
+
+namespace Swan {
+
+static_assert(sizeof(WorldSaver::WORLD_MAGIC) == sizeof(capnp::word));
+
+WorldSaver::~WorldSaver()
+{
+	wait();
+}
+
+void WorldSaver::start(Snapshot snapshot, Callback cb)
+{
+	assert(!busy());
+
+	snapshot_ = std::move(snapshot);
+	result_ = {};
+	callback_ = std::move(cb);
+	done_.store(false, std::memory_order_relaxed);
+	thread_ = std::thread(&WorldSaver::run, this);
+}
+
+void WorldSaver::poll()
+{
+	if (busy() && done_.load(std::memory_order_acquire)) {
+		finish();
+	}
+}
+
+void WorldSaver::wait()
+{
+	if (busy()) {
+		finish();
+	}
+}
+
+void WorldSaver::finish()
+{
+	thread_.join();
+	snapshot_ = {};
+
+	// The callback might start another save
+	auto cb = std::move(callback_);
+	callback_ = nullptr;
+	if (cb) {
+		cb(result_);
+	}
+}
+
+void WorldSaver::run()
+{
+	RTClock clock;
+
+	// Every chunk is encoded by a job of its own, straight into its
+	// region's writer. Regions are written in order as their chunks finish,
+	// while the workers keep encoding the chunks of the next regions.
+	struct RegionJobs {
+		RegionWriter writer;
+		std::vector<WorkerPool::JobPtr> jobs;
+		std::atomic<bool> failed = false;
+	};
+
+	std::vector<RegionJobs> regionJobs(snapshot_.regions.size());
+	for (size_t i = 0; i < snapshot_.regions.size(); ++i) {
+		auto &rj = regionJobs[i];
+		rj.jobs.reserve(snapshot_.regions[i].chunks.size());
+		for (auto &chunk: snapshot_.regions[i].chunks) {
+			rj.jobs.push_back(workers_.submit([this, &rj, &chunk] {
+				try {
+					capnp::MallocMessageBuilder mb;
+					Chunk::serialize(
+						chunk, mb.initRoot<proto::Chunk>(),
+						snapshot_.gzipLevel, snapshot_.deltaChunks);
+					rj.writer.setChunk(chunk.pos, mb);
+				} catch (...) {
+					rj.failed.store(true, std::memory_order_relaxed);
+				}
+
+				// Let go of the chunk data as soon as possible
+				chunk = {};
+			}));
+		}
+	}
+
+	for (size_t i = 0; i < snapshot_.regions.size(); ++i) {
+		auto &region = snapshot_.regions[i];
+		auto &rj = regionJobs[i];
+		for (auto &job: rj.jobs) {
+			job->wait();
+		}
+
+		bool ok;
+		if (region.incomplete) {
+			warn << "Not writing region " << region.path << ", some of its chunks are missing";
+			ok = false;
+		} else if (rj.failed.load(std::memory_order_relaxed)) {
+			warn << "Failed to serialize region " << region.path;
+			ok = false;
+		} else {
+			ok = rj.writer.write(region.path);
+		}
+
+		if (ok) {
+			result_.regionCount += 1;
+		} else {
+			result_.ok = false;
+			result_.failedRegions.push_back({region.plane, region.pos});
+		}
+
+		region.chunks = {};
+		rj.writer = {};
+	}
+
+	// The world file carries the new journal epoch, which tells the next
+	// load that the older journals are in the save. That's not true for
+	// a region which failed, so keep the previous world file instead.
+	if (!result_.failedRegions.empty()) {
+		warn
+			<< "Not writing " << snapshot_.worldPath << ", "
+			<< result_.failedRegions.size() << " regions failed";
+	} else {
+		auto words = capnp::messageToFlatArray(*snapshot_.world);
+		auto bytes = words.asBytes();
+		std::span<const unsigned char> parts[] = {
+			{(const unsigned char *)WORLD_MAGIC, sizeof(WORLD_MAGIC)},
+			{bytes.begin(), bytes.size()},
+		};
+		if (!OS::writeFileDurably(snapshot_.worldPath, parts)) {
+			result_.ok = false;
+		}
+	}
+
+	result_.seconds = clock.duration();
+	done_.store(true, std::memory_order_release);
+}
+
+}
@@ -0,0 +1,72 @@
+#include "gzip.h"
+
+#include <new>
+#include <zlib.h>
+
+namespace Swan {
+
+// Adding 16 to the window bits makes zlib use the gzip format,
+// adding 32 makes inflate accept both gzip and zlib
+static constexpr int GZIP_WINDOW_BITS = 15 + 16;
+static constexpr int AUTO_WINDOW_BITS = 15 + 32;
+
+void gzipEncode(std::vector<uint8_t> &out, std::span<const uint8_t> in, int level)
+{
+	z_stream strm{};
+	if (deflateInit2(
+			&strm, level, Z_DEFLATED, GZIP_WINDOW_BITS,
+			8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw std::bad_alloc();
+	}
+
+	// deflateBound is an upper bound, so this is done in one go
+	size_t start = out.size();
+	out.resize(start + deflateBound(&strm, in.size()));
+
+	strm.next_in = const_cast<Bytef *>(in.data());
+	strm.avail_in = in.size();
+	strm.next_out = out.data() + start;
+	strm.avail_out = out.size() - start;
+	deflate(&strm, Z_FINISH);
+
+	out.resize(out.size() - strm.avail_out);
+	deflateEnd(&strm);
+}
+
+bool gzipDecode(std::vector<uint8_t> &out, std::span<const uint8_t> in)
+{
+	z_stream strm{};
+	if (inflateInit2(&strm, AUTO_WINDOW_BITS) != Z_OK) {
+		throw std::bad_alloc();
+	}
+
+	strm.next_in = const_cast<Bytef *>(in.data());
+	strm.avail_in = in.size();
+
+	// Chunk data usually inflates to a few times its compressed size
+	size_t written = out.size();
+	int ret = Z_OK;
+	while (ret == Z_OK) {
+		if (written == out.size()) {
+			out.resize(written + in.size() * 4 + 256);
+		}
+
+		strm.next_out = out.data() + written;
+		strm.avail_out = out.size() - written;
+		ret = inflate(&strm, Z_NO_FLUSH);
+		written = out.size() - strm.avail_out;
+
+		// Out of input without reaching the end of the stream
+		if (ret == Z_BUF_ERROR && strm.avail_in == 0) {
+			break;
+		} else if (ret == Z_BUF_ERROR) {
+			ret = Z_OK;
+		}
+	}
+
+	out.resize(written);
+	inflateEnd(&strm);
+	return ret == Z_STREAM_END;
+}
+
+}
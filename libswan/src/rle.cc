@@ -1,74 +1,192 @@
 #include "rle.h"
 
+#include <algorithm>
+#include <bit>
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace Swan {
 
-void rleEncode8(std::vector<uint8_t> &out, std::span<const uint8_t> in)
-{
-	if (in.size() == 0) {
-		return;
+// The longest runs which the formats can express
+static constexpr size_t MAX_RUN_8 = 256;
+static constexpr size_t MAX_RUN_16 = 257;
+
+// Runs are written to a small stack buffer first, which gets appended
+// to the output vector whenever it fills up. That avoids both
+// a push_back per byte and zero-filling a worst-case sized vector.
+namespace {
+class RunWriter {
+public:
+	RunWriter(std::vector<uint8_t> &out): out_(out) {}
+
+	~RunWriter()
+	{
+		flush();
 	}
 
-	size_t len = 0;
-	for (size_t i = 1; i < in.size(); ++i) {
-		len += 1;
-		bool encode =
-			(in[i - 1] != in[i]) ||
-			(len == 256);
-		if (!encode) {
-			continue;
+	// Make sure there's space for 'n' more bytes
+	uint8_t *reserve(size_t n)
+	{
+		if (len_ + n > sizeof(buf_)) {
+			flush();
 		}
+		return &buf_[len_];
+	}
+
+	void commit(size_t n)
+	{
+		len_ += n;
+	}
 
-		out.push_back(in[i - 1]);
-		out.push_back(len - 1);
-		len = 0;
+	void flush()
+	{
+		out_.insert(out_.end(), buf_, buf_ + len_);
+		len_ = 0;
 	}
 
-	len += 1;
-	out.push_back(in[in.size() - 1]);
-	out.push_back(len - 1);
+private:
+	std::vector<uint8_t> &out_;
+	uint8_t buf_[4096];
+	size_t len_ = 0;
+};
 }
 
-void rleEncode16SRO(std::vector<uint8_t> &out, std::span<const uint16_t> in)
+// Number of elements at the start of 'in' which are equal to in[0].
+// 'size' must be at least 1.
+static size_t runLength8(const uint8_t *in, size_t size)
 {
-	if (in.size() == 0) {
-		return;
+	uint8_t val = in[0];
+	size_t i = 1;
+
+#if defined(__AVX2__)
+	__m256i v32 = _mm256_set1_epi8(val);
+	while (i + 32 <= size) {
+		__m256i data = _mm256_loadu_si256((const __m256i *)(in + i));
+		uint32_t diff = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, v32)));
+		if (diff) {
+			return i + std::countr_zero(diff);
+		}
+		i += 32;
 	}
+#endif
+
+#if defined(__SSE2__)
+	__m128i v16 = _mm_set1_epi8(val);
+	while (i + 16 <= size) {
+		__m128i data = _mm_loadu_si128((const __m128i *)(in + i));
+		uint32_t diff = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(data, v16))) & 0xffff;
+		if (diff) {
+			return i + std::countr_zero(diff);
+		}
+		i += 16;
+	}
+#endif
 
-	size_t len = 0;
-	for (size_t i = 1; i < in.size(); ++i) {
-		len += 1;
-		bool encode =
-			(in[i - 1] != in[i]) ||
-			(len == 257);
-		if (!encode) {
-			continue;
+	while (i < size && in[i] == val) {
+		i += 1;
+	}
+
+	return i;
+}
+
+// Like runLength8, for 16-bit values.
+// The movemask gives two bits per element, hence the division by 2.
+static size_t runLength16(const uint16_t *in, size_t size)
+{
+	uint16_t val = in[0];
+	size_t i = 1;
+
+#if defined(__AVX2__)
+	__m256i v32 = _mm256_set1_epi16(val);
+	while (i + 16 <= size) {
+		__m256i data = _mm256_loadu_si256((const __m256i *)(in + i));
+		uint32_t diff = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi16(data, v32)));
+		if (diff) {
+			return i + std::countr_zero(diff) / 2;
 		}
+		i += 16;
+	}
+#endif
+
+#if defined(__SSE2__)
+	__m128i v16 = _mm_set1_epi16(val);
+	while (i + 8 <= size) {
+		__m128i data = _mm_loadu_si128((const __m128i *)(in + i));
+		uint32_t diff = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi16(data, v16))) & 0xffff;
+		if (diff) {
+			return i + std::countr_zero(diff) / 2;
+		}
+		i += 8;
+	}
+#endif
 
+	while (i < size && in[i] == val) {
+		i += 1;
+	}
+
+	return i;
+}
+
+static void fill16(uint16_t *out, uint16_t val, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	__m256i v32 = _mm256_set1_epi16(val);
+	for (; i + 16 <= len; i += 16) {
+		_mm256_storeu_si256((__m256i *)(out + i), v32);
+	}
+#endif
+
+#if defined(__SSE2__)
+	__m128i v16 = _mm_set1_epi16(val);
+	for (; i + 8 <= len; i += 8) {
+		_mm_storeu_si128((__m128i *)(out + i), v16);
+	}
+#endif
+
+	for (; i < len; ++i) {
+		out[i] = val;
+	}
+}
+
+void rleEncode8(std::vector<uint8_t> &out, std::span<const uint8_t> in)
+{
+	RunWriter writer(out);
+	size_t i = 0;
+	while (i < in.size()) {
+		size_t len = runLength8(&in[i], std::min(in.size() - i, MAX_RUN_8));
+		uint8_t *dest = writer.reserve(2);
+		dest[0] = in[i];
+		dest[1] = len - 1;
+		writer.commit(2);
+		i += len;
+	}
+}
+
+void rleEncode16SRO(std::vector<uint8_t> &out, std::span<const uint16_t> in)
+{
+	RunWriter writer(out);
+	size_t i = 0;
+	while (i < in.size()) {
+		size_t len = runLength16(&in[i], std::min(in.size() - i, MAX_RUN_16));
+		uint8_t *dest = writer.reserve(3);
 		if (len == 1) {
-			uint16_t val = in[i - 1] | 0x8000;
-			out.push_back(val & 0xff);
-			out.push_back(val >> 8);
+			uint16_t val = in[i] | 0x8000;
+			dest[0] = val & 0xff;
+			dest[1] = val >> 8;
+			writer.commit(2);
 		} else {
-			uint16_t val = in[i - 1] & ~0x8000;
-			out.push_back(val & 0xff);
-			out.push_back(val >> 8);
-			out.push_back(len - 2);
+			uint16_t val = in[i] & ~0x8000;
+			dest[0] = val & 0xff;
+			dest[1] = val >> 8;
+			dest[2] = len - 2;
+			writer.commit(3);
 		}
-		len = 0;
-	}
-
-	len += 1;
-	if (len == 1) {
-		uint16_t val = in[in.size() - 1] | 0x8000;
-		out.push_back(val & 0xff);
-		out.push_back(val >> 8);
-	} else if (len > 1) {
-		uint16_t val = in[in.size() - 1] & ~0x8000;
-		out.push_back(val & 0xff);
-		out.push_back(val >> 8);
-		out.push_back(len - 2);
+		i += len;
 	}
 }
 
@@ -76,7 +194,7 @@ size_t rleDecode8(std::span<uint8_t> out, std::span<const uint8_t> in)
 {
 	size_t outidx = 0;
 	size_t inidx = 0;
-	while (inidx < in.size() - 1) {
+	while (inidx + 1 < in.size()) {
 		uint8_t val = in[inidx++];
 		size_t len = in[inidx++] + 1;
 
@@ -101,7 +219,7 @@ size_t rleDecode16SRO(std::span<uint16_t> out, std::span<const uint8_t> in)
 {
 	size_t outidx = 0;
 	size_t inidx = 0;
-	while (inidx < in.size() - 1) {
+	while (inidx + 1 < in.size()) {
 		uint16_t lo = in[inidx++];
 		uint16_t hi = in[inidx++];
 		uint16_t val = lo | (hi << 8);
@@ -109,24 +227,23 @@ size_t rleDecode16SRO(std::span<uint16_t> out, std::span<const uint8_t> in)
 		if (val & 0x8000) {
 			val &= ~0x8000;
 			len = 1;
-		} else {
+		} else if (inidx < in.size()) {
 			len = size_t(in[inidx++]) + 2;
+		} else {
+			// Truncated input
+			break;
 		}
 
 		// Happy path: just write the data
 		if (outidx + len <= out.size()) {
-			for (size_t i = 0; i < len; ++i) {
-				out[outidx++] = val;
-			}
+			fill16(&out[outidx], val, len);
+			outidx += len;
 			continue;
 		}
 
 		// Sad path: fill the rest with 'val', then increment outidx
 		if (outidx < out.size()) {
-			for (size_t i = outidx; i < out.size(); ++i)
-			while (outidx < out.size()) {
-				out[i] = val;
-			}
+			fill16(&out[outidx], val, out.size() - outidx);
 		}
 		outidx += len;
 	}
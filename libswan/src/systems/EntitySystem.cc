@@ -1,10 +1,15 @@
 #include "systems/EntitySystem.h"
 
 #include "WorldPlane.h"
+#include "World.h"
 #include "swan/log.h"
 #include "traits/TileEntityTrait.h"
 #include "EntityCollectionImpl.h" // IWYU pragma: keep
 
+#include <algorithm>
+#include <capnp/message.h>
+#include <capnp/serialize-packed.h>
+
 namespace Swan {
 
 EntitySystemImpl::EntitySystemImpl(
@@ -38,6 +43,7 @@ EntityRef EntitySystemImpl::spawn(std::string_view name, capnp::Data::Reader dat
 	currentEntityStack_.pop_back();
 
 	currentCollection_ = prevCurrentColl;
+	journalSpawn(ent);
 	return ent;
 }
 
@@ -48,6 +54,10 @@ void EntitySystemImpl::despawn(EntityRef ref)
 		return;
 	}
 
+	if (auto *journal = plane_.world_->journal_) {
+		journal->despawnEntity(plane_.id_, ref.coll_->name(), ref.id_);
+	}
+
 	despawnListA_.push_back(ref);
 }
 
@@ -176,6 +186,10 @@ void EntitySystemImpl::spawnTileEntity(TilePos pos, std::string_view name)
 	currentEntityStack_.push_back(ent);
 	ent->onSpawn(getContext());
 	currentEntityStack_.pop_back();
+
+	if (auto *journal = plane_.world_->journal_) {
+		journal->spawnTileEntity(plane_.id_, pos, name);
+	}
 }
 
 void EntitySystemImpl::despawnTileEntity(TilePos pos)
@@ -186,7 +200,12 @@ void EntitySystemImpl::despawnTileEntity(TilePos pos)
 		warn << "Didn't find expected tile entity at " << pos;
 	}
 	else {
-		despawn(it->second);
+		// Tile entities are journaled by position, not by ID
+		if (auto *journal = plane_.world_->journal_) {
+			journal->despawnTileEntity(plane_.id_, pos);
+		}
+
+		despawnListA_.push_back(it->second);
 		tileEntities_.erase(pos);
 	}
 }
@@ -194,19 +213,31 @@ void EntitySystemImpl::despawnTileEntity(TilePos pos)
 void EntitySystemImpl::draw(Cygnet::Renderer &rnd)
 {
 	auto ctx = getContext();
+	iterating_ += 1;
 	for (auto &coll: collections_) {
 		coll->draw(ctx, rnd);
 	}
+	iterating_ -= 1;
+	wakePending();
 }
 
 void EntitySystemImpl::update(float dt)
 {
 	auto ctx = getContext();
+	iterating_ += 1;
 	for (auto &coll: collections_) {
 		currentCollection_ = coll.get();
 		coll->update(ctx, dt);
 	}
 	currentCollection_ = nullptr;
+	iterating_ -= 1;
+	wakePending();
+
+	// Erasing entities swaps the last one into the hole, which would make
+	// a paused tick skip it, so despawns wait until the tick is done
+	if (tickIndex_ != 0 || tickEntityIndex_ != 0) {
+		return;
+	}
 
 	auto despawnList = std::move(despawnListA_);
 	despawnListA_ = std::move(despawnListB_);
@@ -223,21 +254,43 @@ void EntitySystemImpl::update(float dt)
 	despawnListB_ = std::move(despawnList);
 }
 
-void EntitySystemImpl::tick(float dt)
+bool EntitySystemImpl::tick(float dt, RTDeadline deadline)
 {
 	auto ctx = getContext();
+	iterating_ += 1;
+
+	bool done = true;
+	while (tickIndex_ < collections_.size() * 2) {
+		EntityCollection *coll;
+		if (tickIndex_ < collections_.size()) {
+			coll = collections_[tickIndex_].get();
+			currentCollection_ = coll;
+			tickEntityIndex_ = coll->tick(ctx, dt, tickEntityIndex_, deadline);
+		} else {
+			coll = collections_[tickIndex_ - collections_.size()].get();
+			currentCollection_ = coll;
+			tickEntityIndex_ = coll->tick2(ctx, dt, tickEntityIndex_, deadline);
+		}
 
-	for (auto &coll: collections_) {
-		currentCollection_ = coll.get();
-		coll->tick(ctx, dt);
+		if (tickEntityIndex_ >= coll->size()) {
+			tickIndex_ += 1;
+			tickEntityIndex_ = 0;
+		}
+
+		if (tickIndex_ < collections_.size() * 2 && deadline.passed()) {
+			done = false;
+			break;
+		}
 	}
 
-	for (auto &coll: collections_) {
-		currentCollection_ = coll.get();
-		coll->tick2(ctx, dt);
+	if (done) {
+		tickIndex_ = 0;
 	}
 
 	currentCollection_ = nullptr;
+	iterating_ -= 1;
+	wakePending();
+	return done;
 }
 
 EntityCollection *EntitySystemImpl::getCollectionOf(std::string_view name)
@@ -263,6 +316,179 @@ void EntitySystemImpl::despawnAllTileEntities()
 	}
 }
 
+bool EntitySystemImpl::hibernate(Chunk &chunk)
+{
+	ZoneScopedN("EntitySystem hibernate");
+
+	// Entities which are about to be despawned are left alone,
+	// and so is the player
+	auto isStaying = [&](EntityRef ref) {
+		return
+			!ref || ref == plane_.world_->playerRef_ ||
+			std::find(despawnListA_.begin(), despawnListA_.end(), ref) != despawnListA_.end() ||
+			std::find(despawnListB_.begin(), despawnListB_.end(), ref) != despawnListB_.end();
+	};
+
+	std::vector<std::pair<TilePos, EntityRef>> tileEnts;
+	for (auto &[pos, ref]: tileEntities_) {
+		if (chunkPos(pos) == chunk.pos() && !isStaying(ref)) {
+			tileEnts.emplace_back(pos, ref);
+		}
+	}
+
+	// A tile entity could have a body too, but it only goes to sleep once
+	std::vector<EntityRef> ents;
+	for (auto &ref: chunk.entities_) {
+		bool isTileEnt = std::any_of(tileEnts.begin(), tileEnts.end(), [&](auto &te) {
+			return te.second == ref;
+		});
+		if (!isTileEnt && !isStaying(ref)) {
+			ents.push_back(ref);
+		}
+	}
+
+	if (ents.empty() && tileEnts.empty()) {
+		return false;
+	}
+
+	auto ctx = getContext();
+	capnp::MallocMessageBuilder mb;
+	auto root = mb.initRoot<proto::ChunkEntities>();
+
+	auto entsW = root.initEntities(ents.size());
+	for (size_t i = 0; i < ents.size(); ++i) {
+		auto ref = ents[i];
+		auto data = ref.coll_->serializeEntity(ctx, ref.id_);
+		entsW[i].setCollection(ref.coll_->name());
+		entsW[i].setId(ref.id_);
+		entsW[i].setData({data.begin(), data.size()});
+		ref.coll_->erase(ctx, ref.id_);
+	}
+
+	auto tileEntsW = root.initTileEntities(tileEnts.size());
+	for (size_t i = 0; i < tileEnts.size(); ++i) {
+		auto [pos, ref] = tileEnts[i];
+		auto data = ref.coll_->serializeEntity(ctx, ref.id_);
+		auto posW = tileEntsW[i].initPos();
+		posW.setX(pos.x);
+		posW.setY(pos.y);
+		tileEntsW[i].setCollection(ref.coll_->name());
+		tileEntsW[i].setId(ref.id_);
+		tileEntsW[i].setData({data.begin(), data.size()});
+		ref.coll_->erase(ctx, ref.id_);
+		tileEntities_.erase(pos);
+	}
+
+	kj::VectorOutputStream out;
+	capnp::writePackedMessage(out, mb);
+	auto arr = out.getArray();
+	chunk.hibernateEntities(
+		std::make_shared<const std::vector<uint8_t>>(arr.begin(), arr.end()));
+	return true;
+}
+
+void EntitySystemImpl::wake(Chunk &chunk)
+{
+	if (!chunk.hasHibernatingEntities()) {
+		return;
+	}
+
+	// Restoring entities while a collection is being iterated over
+	// could move the entities out from under it
+	if (iterating_ > 0) {
+		pendingWakes_.push_back(chunk.pos());
+		return;
+	}
+
+	ZoneScopedN("EntitySystem wake");
+	auto entities = chunk.wakeEntities();
+	auto ctx = getContext();
+	auto *prevCurrentColl = currentCollection_;
+	std::vector<EntityRef> woken;
+
+	auto restore = [&](capnp::Text::Reader name, uint64_t id, capnp::Data::Reader data) {
+		auto *coll = getCollectionOf(name.cStr());
+		if (!coll) {
+			return EntityRef{};
+		}
+
+		EntityRef ref{coll, id};
+		if (hibernatingDespawns_.erase(ref) > 0) {
+			return EntityRef{};
+		}
+
+		currentCollection_ = coll;
+		ref = coll->restore(ctx, id, data);
+		if (ref) {
+			woken.push_back(ref);
+		}
+		return ref;
+	};
+
+	try {
+		kj::ArrayInputStream stream({entities->data(), entities->size()});
+		capnp::PackedMessageReader reader(stream);
+		auto r = reader.getRoot<proto::ChunkEntities>();
+
+		for (auto ent: r.getEntities()) {
+			restore(ent.getCollection(), ent.getId(), ent.getData());
+		}
+
+		for (auto tileEnt: r.getTileEntities()) {
+			TilePos pos = {tileEnt.getPos().getX(), tileEnt.getPos().getY()};
+			if (auto it = tileEntities_.find(pos); it != tileEntities_.end()) {
+				warn << "Tile entity already exists in " << pos << ": " << it->second.collection()->name();
+				continue;
+			}
+
+			auto ref = restore(tileEnt.getCollection(), tileEnt.getId(), tileEnt.getData());
+			if (!ref) {
+				continue;
+			}
+
+			ref.traitThen<TileEntityTrait>([&](TileEntity &ent) {
+				ent.pos = pos;
+			});
+			tileEntities_[pos] = ref;
+		}
+	} catch (std::exception &ex) {
+		warn << "Failed to wake entities in chunk " << chunk.pos() << ": " << ex.what();
+	}
+
+	// Just like after a world is loaded,
+	// entities might have to catch up with what changed around them
+	for (auto &ref: woken) {
+		currentEntityStack_.push_back(ref);
+		ref->onWorldLoaded(ctx);
+		currentEntityStack_.pop_back();
+	}
+
+	currentCollection_ = prevCurrentColl;
+}
+
+void EntitySystemImpl::despawnHibernating(EntityRef ref)
+{
+	hibernatingDespawns_.insert(ref);
+}
+
+void EntitySystemImpl::wakePending()
+{
+	if (pendingWakes_.empty()) {
+		return;
+	}
+
+	auto pending = std::move(pendingWakes_);
+	pendingWakes_.clear();
+	for (auto pos: pending) {
+		// The chunk might have been deactivated again in the meantime,
+		// in which case its entities stay asleep
+		Chunk *chunk = plane_.subtleGetChunk(pos);
+		if (chunk && chunk->isActive()) {
+			wake(*chunk);
+		}
+	}
+}
+
 void EntitySystemImpl::serialize(proto::EntitySystem::Builder w)
 {
 	auto ctx = getContext();
@@ -286,6 +512,16 @@ void EntitySystemImpl::serialize(proto::EntitySystem::Builder w)
 		posW.setY(pos.y);
 		ref.serialize(entW.initRef());
 	}
+
+	// The chunks these are hibernating in still have them,
+	// so they have to be remembered until the chunks wake up
+	auto despawns = w.initHibernatingDespawns(hibernatingDespawns_.size());
+	index = 0;
+	for (auto &ref: hibernatingDespawns_) {
+		despawns[index].setCollection(ref.coll_->name());
+		despawns[index].setId(ref.id_);
+		index += 1;
+	}
 }
 
 void EntitySystemImpl::deserialize(proto::EntitySystem::Reader r)
@@ -305,6 +541,14 @@ void EntitySystemImpl::deserialize(proto::EntitySystem::Reader r)
 	}
 
 	tileEntities_.clear();
+	pendingWakes_.clear();
+	hibernatingDespawns_.clear();
+	for (auto despawn: r.getHibernatingDespawns()) {
+		if (auto *coll = getCollectionOf(despawn.getCollection().cStr())) {
+			hibernatingDespawns_.insert({coll, despawn.getId()});
+		}
+	}
+
 	for (auto tileEnt: r.getTileEntities()) {
 		Vec2i pos = {
 			tileEnt.getPos().getX(),
@@ -333,4 +577,17 @@ Context EntitySystemImpl::getContext() {
 	return plane_.getContext();
 }
 
+void EntitySystemImpl::journalSpawn(EntityRef ref)
+{
+	auto *journal = plane_.world_->journal_;
+	if (!journal || !ref) {
+		return;
+	}
+
+	auto ctx = getContext();
+	auto data = ref.coll_->serializeEntity(ctx, ref.id_);
+	journal->spawnEntity(
+		plane_.id_, ref.coll_->name(), ref.id_, {data.begin(), data.size()});
+}
+
 }
@@ -5,7 +5,10 @@
 #include "Game.h"
 #include "cygnet/Renderer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <climits>
+#include <memory>
 #include <stdexcept>
 
 namespace Swan {
@@ -77,17 +80,17 @@ FluidPos worldPosToFluidPos(Vec2 pos)
 
 void FluidSystemImpl::FluidCellRef::setAir()
 {
-	*value_ = 0;
+	write(0);
 }
 
 bool FluidSystemImpl::FluidCellRef::isAir()
 {
-	return *value_ == 0;
+	return get() == 0;
 }
 
 bool FluidSystemImpl::FluidCellRef::isSolid()
 {
-	return *value_ == 1;
+	return get() == 1;
 }
 
 void FluidSystemImpl::FluidCellRef::set(Fluid::ID id, int vx)
@@ -103,12 +106,12 @@ void FluidSystemImpl::FluidCellRef::set(Fluid::ID id, int vx)
 		mode = 0;
 	}
 
-	*value_ = (mode << 6) | int(id);
+	write((mode << 6) | int(id));
 }
 
 int FluidSystemImpl::FluidCellRef::vx()
 {
-	int mode = *value_ >> 6;
+	int mode = get() >> 6;
 	if (mode == 1) {
 		return -1;
 	}
@@ -133,17 +136,17 @@ void FluidSystemImpl::FluidCellRef::setVX(int vx)
 		mode = 0;
 	}
 
-	*value_ = (*value_ & 0x3f) | (mode << 6);
+	write((get() & 0x3f) | (mode << 6));
 }
 
 Fluid::ID FluidSystemImpl::FluidCellRef::id()
 {
-	return Fluid::ID(*value_ & 0x3f);
+	return Fluid::ID(get() & 0x3f);
 }
 
 void FluidSystemImpl::FluidCellRef::setID(Fluid::ID id)
 {
-	*value_ = (*value_ & 0xc0) | id;
+	write((get() & 0xc0) | id);
 }
 
 void FluidSystemImpl::triggerUpdateInTile(TilePos tpos)
@@ -162,15 +165,16 @@ void FluidSystemImpl::triggerUpdateInTile(TilePos tpos)
 
 void FluidSystemImpl::setInTile(TilePos pos, Fluid::ID fluid)
 {
-	auto &chunk = plane_.getChunk(chunkPos(pos));
+	journalFluid(pos, WorldJournal::FluidOp::SET, fluid);
+
+	auto &chunk = plane_.getChunk(chunkPos(pos), chunkCache_);
 	auto relPos = chunkRelPos(pos);
 
-	uint8_t *data = chunk.getFluidData();
-	for (size_t y = 0; y < FLUID_RESOLUTION; ++y) {
-		uint8_t *row = &data[
-			(relPos.y * FLUID_RESOLUTION + y) * CHUNK_WIDTH * FLUID_RESOLUTION];
+	// Tiles which are all air or all solid don't contain any fluid
+	const uint8_t *block = chunk.getFluidData().peekBlock(relPos);
+	for (size_t y = 0; block && y < FLUID_RESOLUTION; ++y) {
 		for (size_t x = 0; x < FLUID_RESOLUTION; ++x) {
-			Fluid::ID id = row[relPos.x * FLUID_RESOLUTION + x] & 0x3f;
+			Fluid::ID id = block[y * FLUID_RESOLUTION + x] & 0x3f;
 			if (id == World::AIR_FLUID_ID || id == World::SOLID_FLUID_ID) {
 				continue;
 			}
@@ -196,43 +200,54 @@ void FluidSystemImpl::setInTile(TilePos pos, Fluid::ID fluid)
 
 void FluidSystemImpl::setPartialInTile(TilePos pos, Fluid::ID fluid)
 {
-	auto &chunk = plane_.getChunk(chunkPos(pos));
+	journalFluid(pos, WorldJournal::FluidOp::SET_PARTIAL, fluid);
+
+	auto &chunk = plane_.getChunk(chunkPos(pos), chunkCache_);
 	auto relPos = chunkRelPos(pos);
-	auto *data = chunk.getFluidData();
+	uint8_t *block = chunk.getFluidData().blockForWrite(relPos);
 
 	for (size_t y = FLUID_RESOLUTION / 2; y < FLUID_RESOLUTION; ++y) {
-		int gridY = relPos.y * FLUID_RESOLUTION + y;
-		auto *pos = &data[gridY * FLUID_RESOLUTION * CHUNK_WIDTH];
 		for (size_t x = 0; x < FLUID_RESOLUTION; ++x) {
-			pos[relPos.x * FLUID_RESOLUTION + x] = fluid;
+			block[y * FLUID_RESOLUTION + x] = fluid;
 		}
 	}
+	chunk.setFluidModified(relPos.y, relPos.y + 1);
 }
 
 void FluidSystemImpl::replaceInTile(TilePos pos, Fluid::ID fluid)
 {
-	auto &chunk = plane_.getChunk(chunkPos(pos));
+	journalFluid(pos, WorldJournal::FluidOp::REPLACE, fluid);
+
+	auto &chunk = plane_.getChunk(chunkPos(pos), chunkCache_);
 	auto relPos = chunkRelPos(pos);
 
 	chunk.setFluidID(relPos, fluid);
 	triggerUpdateInTile(pos);
 }
 
+void FluidSystemImpl::journalFluid(
+	TilePos pos, WorldJournal::FluidOp op, Fluid::ID fluid)
+{
+	if (auto *journal = plane_.world_->journal_) {
+		journal->setFluid(
+			plane_.id_, pos, op, fluid, plane_.world_->getFluidByID(fluid).name);
+	}
+}
+
 void FluidSystemImpl::setSolid(TilePos pos, const FluidCollision &set)
 {
-	auto &chunk = plane_.getChunk(chunkPos(pos));
+	auto &chunk = plane_.getChunk(chunkPos(pos), chunkCache_);
 	auto relPos = chunkRelPos(pos);
 
-	uint8_t *data = chunk.getFluidData();
-	for (size_t y = 0; y < FLUID_RESOLUTION; ++y) {
-		uint8_t *row = &data[
-			(relPos.y * FLUID_RESOLUTION + y) * CHUNK_WIDTH * FLUID_RESOLUTION];
+	// Tiles which are all air or all solid don't contain any fluid
+	const uint8_t *block = chunk.getFluidData().peekBlock(relPos);
+	for (size_t y = 0; block && y < FLUID_RESOLUTION; ++y) {
 		for (size_t x = 0; x < FLUID_RESOLUTION; ++x) {
 			if (!set[y * FLUID_RESOLUTION + x]) {
 				continue;
 			}
 
-			Fluid::ID id = row[relPos.x * FLUID_RESOLUTION + x] & 0x3f;
+			Fluid::ID id = block[y * FLUID_RESOLUTION + x] & 0x3f;
 			if (id == World::AIR_FLUID_ID || id == World::SOLID_FLUID_ID) {
 				continue;
 			}
@@ -258,7 +273,7 @@ void FluidSystemImpl::setSolid(TilePos pos, const FluidCollision &set)
 
 void FluidSystemImpl::clearSolid(TilePos pos)
 {
-	auto &chunk = plane_.getChunk(chunkPos(pos));
+	auto &chunk = plane_.getChunk(chunkPos(pos), chunkCache_);
 	auto relPos = chunkRelPos(pos);
 	chunk.clearFluidSolid(relPos);
 	triggerUpdateInTile(pos);
@@ -415,8 +430,9 @@ void FluidSystemImpl::update(float dt)
 		int vy = particle.vel.y < -0.1 ? -1 : 1;
 
 		FluidPos pos = worldPosToFluidPos(particle.pos);
-		FluidCellRef nearbyX = getFluidCell(pos.add(vx, 0));
-		FluidCellRef nearbyY = getFluidCell(pos.add(0, vy));
+		FluidNeighbourhood cells(*this, pos);
+		FluidCellRef nearbyX = cells.at(vx, 0);
+		FluidCellRef nearbyY = cells.at(0, vy);
 
 		if (nearbyX.isAir() && nearbyY.isAir()) {
 			particle.vel += (particle.vel * -0.9) * dt;
@@ -426,7 +442,7 @@ void FluidSystemImpl::update(float dt)
 			continue;
 		}
 
-		FluidCellRef self = getFluidCell(pos);
+		FluidCellRef self = cells.at(0, 0);
 		if (self.isAir()) {
 			self.set(particle.id, vx);
 			spawnMist(particle);
@@ -454,7 +470,7 @@ void FluidSystemImpl::update(float dt)
 			continue;
 		}
 
-		auto invNearbyY = getFluidCell(pos.add(0, -vy));
+		auto invNearbyY = cells.at(0, -vy);
 		if (invNearbyY.isAir()) {
 			invNearbyY.set(particle.id, vx);
 			spawnMist(particle);
@@ -468,7 +484,7 @@ void FluidSystemImpl::update(float dt)
 			particle.vel.x *= -1;
 		}
 
-		FluidCellRef oppositeNearbyY = getFluidCell(pos.add(0, -vy));
+		FluidCellRef oppositeNearbyY = cells.at(0, -vy);
 		if (nearbyY.isSolid() && !oppositeNearbyY.isSolid()) {
 			particle.vel.y *= -1;
 		} else {
@@ -482,9 +498,9 @@ void FluidSystemImpl::update(float dt)
 
 bool FluidSystemImpl::tick(RTDeadline deadline)
 {
-	if (tickProgress_.updateIndex == 0) {
-		updateSet_.clear();
-		movedSet_.clear();
+	if (!tickProgress_.ongoing) {
+		updateMap_.clear();
+		movedMap_.clear();
 		updatesB_.clear();
 		std::swap(updatesA_, updatesB_);
 
@@ -502,35 +518,164 @@ bool FluidSystemImpl::tick(RTDeadline deadline)
 			i += 1;
 		}
 
-		// Randomize update order
-		for (size_t i = 1; i < updatesB_.size(); ++i) {
-			size_t newIndex = random() % (updatesB_.size() - i) + i;
-			if (i != newIndex) {
-				std::swap(updatesB_[i], updatesB_[newIndex]);
+		// Randomize update order, keeping updates which are close
+		// to each other together
+		updateOrder_.shuffle(updatesB_, (uint64_t(random()) << 31) ^ uint64_t(random()));
+
+		numUpdates_ = updatesB_.size();
+		serialOutput_.rng = uint32_t(random()) | 1;
+		tickProgress_.ongoing = true;
+
+		// When lots of fluid is moving, the updates inside of chunks
+		// are done in parallel. Updates near chunk edges are left
+		// in updatesB_, and are done afterwards.
+		if (
+				updatesB_.size() >= PARALLEL_MIN_UPDATES &&
+				plane_.world_->game_->workers_.threadCount() > 0) {
+			partitionUpdates();
+			applyRulesParallel();
+			if (deadline.passed() && !updatesB_.empty()) {
+				return false;
 			}
 		}
-
 	}
 
 	// Run the updates
-	RTClock clock;
 	size_t index = tickProgress_.updateIndex;
 	size_t lim = updatesB_.size();
 	while (index < lim) {
 		for (size_t j = 0; j < 100 && index < lim; ++j) {
-			applyRules(updatesB_[index++]);
+			applyRules(updatesB_[index++], nullptr, serialOutput_);
 		}
+		flushRuleOutput(serialOutput_);
 
-		if (deadline.passed()) {
+		if (deadline.passed() && index < lim) {
 			tickProgress_.updateIndex = index;
 			return false;
 		}
 	}
 
-	tickProgress_.updateIndex = 0;
+	tickProgress_ = {};
 	return true;
 }
 
+void FluidSystemImpl::partitionUpdates()
+{
+	ZoneScopedN("Fluid partition");
+	constexpr int W = SparseFluidGrid::WIDTH;
+	constexpr int H = SparseFluidGrid::HEIGHT;
+
+	chunkUpdatesIndex_.clear();
+	numChunkUpdates_ = 0;
+
+	// The shuffled order is kept within each chunk
+	size_t edgeCount = 0;
+	for (FluidPos pos: updatesB_) {
+		ChunkPos cpos;
+		Vec2i rel;
+		fluidPosToWorldPos(pos, cpos, rel);
+
+		// applyRules looks one cell to the sides and two cells down
+		if (rel.x < 1 || rel.x >= W - 1 || rel.y >= H - 2) {
+			updatesB_[edgeCount++] = pos;
+			continue;
+		}
+
+		auto [it, inserted] = chunkUpdatesIndex_.try_emplace(cpos, numChunkUpdates_);
+		if (inserted) {
+			if (numChunkUpdates_ == chunkUpdates_.size()) {
+				chunkUpdates_.push_back(std::make_unique<ChunkUpdates>());
+			}
+
+			auto &cu = *chunkUpdates_[numChunkUpdates_++];
+			cu.pos = cpos;
+			cu.updates.clear();
+		}
+
+		chunkUpdates_[it->second]->updates.push_back(pos);
+	}
+
+	updatesB_.resize(edgeCount);
+}
+
+void FluidSystemImpl::applyRulesParallel()
+{
+	ZoneScopedN("Fluid parallel rules");
+	auto &workers = plane_.world_->game_->workers_;
+	auto begin = chunkUpdates_.begin();
+	auto end = begin + numChunkUpdates_;
+	if (begin == end) {
+		return;
+	}
+
+	// Looking up a chunk might load or generate it,
+	// which has to happen on the main thread
+	for (auto it = begin; it != end; ++it) {
+		auto &cu = **it;
+		cu.chunk = &plane_.getChunk(cu.pos, chunkCache_);
+		cu.out.rng = uint32_t(random()) | 1;
+	}
+
+	// Biggest chunks first, so that no thread is left
+	// with a lot of work at the end
+	std::sort(begin, end, [](auto &a, auto &b) {
+		return a->updates.size() > b->updates.size();
+	});
+
+	// The main thread works through the chunks along with the workers.
+	// Workers which only get to start once the chunks are all taken
+	// return straight away, so the main thread doesn't have to wait
+	// for whatever else is in the worker queue.
+	struct Progress {
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+	};
+	auto progress = std::make_shared<Progress>();
+	size_t count = numChunkUpdates_;
+	auto work = [this, progress, count] {
+		size_t i;
+		while ((i = progress->next.fetch_add(1)) < count) {
+			auto &cu = *chunkUpdates_[i];
+			for (FluidPos pos: cu.updates) {
+				applyRules(pos, cu.chunk, cu.out);
+			}
+
+			if (progress->done.fetch_add(1) + 1 == count) {
+				progress->done.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = std::min(workers.threadCount(), count - 1);
+	for (size_t i = 0; i < helpers; ++i) {
+		workers.submit(work);
+	}
+	work();
+
+	size_t done;
+	while ((done = progress->done.load()) < count) {
+		progress->done.wait(done);
+	}
+
+	for (auto it = begin; it != end; ++it) {
+		auto &cu = **it;
+		movedMap_.merge(cu.moved);
+		cu.moved.clear();
+		flushRuleOutput(cu.out);
+	}
+}
+
+void FluidSystemImpl::flushRuleOutput(RuleOutput &out)
+{
+	for (FluidPos pos: out.triggers) {
+		triggerUpdateAround(pos);
+	}
+	out.triggers.clear();
+
+	particles_.insert(particles_.end(), out.particles.begin(), out.particles.end());
+	out.particles.clear();
+}
+
 void FluidSystemImpl::serialize(proto::FluidSystem::Builder w)
 {
 	auto updatesW = w.initUpdates(updatesA_.size());
@@ -576,12 +721,9 @@ void FluidSystemImpl::deserialize(proto::FluidSystem::Reader r)
 
 void FluidSystemImpl::triggerUpdate(FluidPos pos)
 {
-	if (updateSet_.contains(pos)) {
-		return;
+	if (updateMap_.insert(pos)) {
+		updatesA_.push_back(pos);
 	}
-
-	updateSet_.insert(pos);
-	updatesA_.push_back(pos);
 }
 
 void FluidSystemImpl::triggerUpdateAround(FluidPos pos)
@@ -598,14 +740,16 @@ void FluidSystemImpl::triggerUpdateAround(FluidPos pos)
 	triggerUpdate(pos.add(1, 1));
 }
 
-void FluidSystemImpl::applyRules(FluidPos pos)
+void FluidSystemImpl::applyRules(FluidPos pos, Chunk *chunk, RuleOutput &out)
 {
-	if (movedSet_.contains(pos)) {
+	if (!out.moved->insert(pos)) {
 		return;
 	}
-	movedSet_.insert(pos);
 
-	FluidCellRef self = getFluidCell(pos);
+	FluidNeighbourhood cells = chunk ?
+		FluidNeighbourhood(*this, pos, *chunk) :
+		FluidNeighbourhood(*this, pos);
+	FluidCellRef self = cells.at(0, 0);
 	Fluid::ID id = self.id();
 	if (id <= World::SOLID_FLUID_ID || id >= World::INVALID_FLUID_ID) {
 		return;
@@ -614,16 +758,16 @@ void FluidSystemImpl::applyRules(FluidPos pos)
 	int vx = self.vx();
 
 	auto belowPos = pos.add(0, 1);
-	FluidCellRef below = getFluidCell(belowPos);
+	FluidCellRef below = cells.at(0, 1);
 	if (below.isAir()) {
-		triggerUpdateAround(pos);
+		out.triggers.push_back(pos);
 
 		if (vx != 0) {
-			FluidCellRef nearbyBelow = getFluidCell(belowPos.add(vx, 0));
-			FluidCellRef nearby = getFluidCell(pos.add(vx, 0));
+			FluidCellRef nearbyBelow = cells.at(vx, 1);
+			FluidCellRef nearby = cells.at(vx, 0);
 			if (nearbyBelow.isAir() && nearby.isAir()) {
 				self.setAir();
-				particles_.push_back({
+				out.particles.push_back({
 					.pos = fluidPosToWorldPos(pos),
 					.vel = {float(vx) * 5, 0},
 					.color = plane_.world_->getFluidByID(id).fg,
@@ -634,11 +778,10 @@ void FluidSystemImpl::applyRules(FluidPos pos)
 			}
 		}
 
-		auto below2Pos = belowPos.add(0, 1);
-		FluidCellRef below2 = getFluidCell(below2Pos);
+		FluidCellRef below2 = cells.at(0, 2);
 		if (below2.isAir()) {
 			self.setAir();
-			particles_.push_back({
+			out.particles.push_back({
 				.pos = fluidPosToWorldPos(pos),
 				.vel = {0, 5},
 				.color = plane_.world_->getFluidByID(id).fg,
@@ -648,10 +791,10 @@ void FluidSystemImpl::applyRules(FluidPos pos)
 			return;
 		}
 
-		triggerUpdateAround(belowPos);
+		out.triggers.push_back(belowPos);
 		self.setAir();
 		below.set(id, self.vx());
-		movedSet_.insert(belowPos);
+		out.moved->insert(belowPos);
 		return;
 	}
 
@@ -661,37 +804,37 @@ void FluidSystemImpl::applyRules(FluidPos pos)
 		if (fluid.density > belowFluid.density) {
 			self.setID(below.id());
 			below.setID(id);
-			triggerUpdateAround(pos);
-			triggerUpdateAround(belowPos);
-			movedSet_.insert(belowPos);
+			out.triggers.push_back(pos);
+			out.triggers.push_back(belowPos);
+			out.moved->insert(belowPos);
 			return;
 		}
 	}
 
 	if (vx == 0) {
 		// 1 or -1
-		int ax = 1 - (random() % 2) * 2;
+		int ax = 1 - (out.random() % 2) * 2;
 		int bx = -ax;
 
 		auto aPos = pos.add(ax, 0);
-		auto a = getFluidCell(aPos);
+		auto a = cells.at(ax, 0);
 		auto aID = a.id();
 		if (aID != World::SOLID_FLUID_ID && aID != id) {
 			self.setID(aID);
 			a.set(id, ax);
-			triggerUpdateAround(pos);
-			triggerUpdateAround(aPos);
+			out.triggers.push_back(pos);
+			out.triggers.push_back(aPos);
 			return;
 		}
 
 		auto bPos = pos.add(bx, 0);
-		auto b = getFluidCell(bPos);
+		auto b = cells.at(bx, 0);
 		auto bID = b.id();
 		if (bID != World::SOLID_FLUID_ID && bID != id) {
 			self.setID(bID);
 			b.set(id, bx);
-			triggerUpdateAround(pos);
-			triggerUpdateAround(bPos);
+			out.triggers.push_back(pos);
+			out.triggers.push_back(bPos);
 			return;
 		}
 
@@ -699,17 +842,17 @@ void FluidSystemImpl::applyRules(FluidPos pos)
 	}
 
 	auto nearbyPos = pos.add(vx, 0);
-	auto nearby = getFluidCell(nearbyPos);
+	auto nearby = cells.at(vx, 0);
 	if (nearby.isAir()) {
-		triggerUpdateAround(pos);
-		triggerUpdateAround(nearbyPos);
+		out.triggers.push_back(pos);
+		out.triggers.push_back(nearbyPos);
 		nearby.set(id, vx);
 		self.setAir();
-		movedSet_.insert(nearbyPos);
+		out.moved->insert(nearbyPos);
 		return;
 	}
 
-	triggerUpdateAround(pos);
+	out.triggers.push_back(pos);
 	self.setVX(0);
 }
 
@@ -719,9 +862,25 @@ FluidSystemImpl::FluidCellRef FluidSystemImpl::getFluidCell(FluidPos pos)
 	Vec2i rel;
 	fluidPosToWorldPos(pos, cpos, rel);
 
-	auto &chunk = plane_.getChunk(cpos);
-	chunk.setFluidModified();
-	return &chunk.getFluidData()[(rel.y * CHUNK_WIDTH * FLUID_RESOLUTION) + rel.x];
+	auto &chunk = plane_.getChunk(cpos, chunkCache_);
+	return {&chunk, rel};
+}
+
+FluidSystemImpl::FluidNeighbourhood::FluidNeighbourhood(
+	FluidSystemImpl &fluids, FluidPos pos):
+	fluids_(fluids), pos_(pos)
+{
+	ChunkPos cpos;
+	fluidPosToWorldPos(pos, cpos, rel_);
+	chunk_ = &fluids.plane_.getChunk(cpos, fluids.chunkCache_);
+}
+
+FluidSystemImpl::FluidNeighbourhood::FluidNeighbourhood(
+	FluidSystemImpl &fluids, FluidPos pos, Chunk &chunk):
+	fluids_(fluids), pos_(pos), chunk_(&chunk)
+{
+	ChunkPos cpos;
+	fluidPosToWorldPos(pos, cpos, rel_);
 }
 
 }
@@ -79,18 +79,20 @@ NewLightChunk LightSystemImpl::computeLightChunk(const Chunk &chunk)
 {
 	NewLightChunk lc;
 
-	for (int y = 0; y < CHUNK_HEIGHT; ++y) {
-		for (int x = 0; x < CHUNK_WIDTH; ++x) {
-			Tile::ID id = chunk.getTileID({x, y});
-			Tile &tile = plane_.world_->getTileByID(id);
-			if (tile.isOpaque()) {
-				lc.blocks[y * CHUNK_HEIGHT + x] = true;
-			}
-			if (tile.more->lightLevel > 0) {
-				lc.lightSources[{x, y}] = tile.more->lightLevel;
+	chunk.readTiles([&](std::span<const Tile::ID> tiles) {
+		for (int y = 0; y < CHUNK_HEIGHT; ++y) {
+			for (int x = 0; x < CHUNK_WIDTH; ++x) {
+				Tile::ID id = tiles[y * CHUNK_WIDTH + x];
+				Tile &tile = plane_.world_->getTileByID(id);
+				if (tile.isOpaque()) {
+					lc.blocks[y * CHUNK_HEIGHT + x] = true;
+				}
+				if (tile.more->lightLevel > 0) {
+					lc.lightSources[{x, y}] = tile.more->lightLevel;
+				}
 			}
 		}
-	}
+	});
 
 	return lc;
 }
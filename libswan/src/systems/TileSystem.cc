@@ -46,6 +46,7 @@ bool TileSystemImpl::setIDWithoutUpdate(TilePos pos, Tile::ID id)
 	// The code which called onSpawn will handle the rest.
 	if (placingTile_) {
 		chunk.setTileID(rp, id);
+		journalTile(pos, id);
 		return true;
 	}
 
@@ -72,39 +73,13 @@ bool TileSystemImpl::setIDWithoutUpdate(TilePos pos, Tile::ID id)
 	}
 
 	chunk.setTileID(rp, id);
-
-	if (!oldTile.isOpaque() && newTile.isOpaque()) {
-		plane_.lights().addSolidBlock(pos);
-	} else if (oldTile.isOpaque() && !newTile.isOpaque()) {
-		plane_.lights().removeSolidBlock(pos);
-	}
-
-	if (newTile.more->lightLevel != oldTile.more->lightLevel) {
-		if (oldTile.more->lightLevel > 0) {
-			plane_.lights().removeLight(pos, oldTile.more->lightLevel);
-		}
-
-		if (newTile.more->lightLevel > 0) {
-			plane_.lights().addLight(pos, newTile.more->lightLevel);
-		}
-	}
-
-	if (oldTile.more->fluidCollision && !newTile.more->fluidCollision) {
-		plane_.fluids().clearSolid(pos);
-	} else if (newTile.more->fluidCollision) {
-		plane_.fluids().setSolid(pos, *newTile.more->fluidCollision);
-	}
+	journalTile(pos, id);
+	updateLightsAndFluids(pos, chunk, rp, oldTile, newTile);
 
 	if (newTile.more->tileEntity && !keepTileEntity) {
 		plane_.entities().spawnTileEntity(pos, newTile.more->tileEntity);
 	}
 
-	if (oldTile.more->fluidMask && !newTile.more->fluidMask) {
-		chunk.clearFluidMask(rp);
-	} else if (newTile.more->fluidMask) {
-		chunk.setFluidMask(rp, newTile.more->fluidMask);
-	}
-
 	// Actually run onSpawn as the last thing we do.
 	// That way, onSpawn can replace the tile and we don't get confused.
 	if (newTile.more->onSpawn) {
@@ -145,6 +120,9 @@ bool TileSystemImpl::setBackgroundIDWithoutUpdate(TilePos pos, Tile::ID id)
 	Tile &newTile = plane_.world_->getTileByID(id);
 
 	chunk.setBackgroundTileID(rp, id);
+	if (auto *journal = plane_.world_->journal_) {
+		journal->setBackground(plane_.id_, pos, id, newTile.name);
+	}
 
 	if (newTile.more->onSpawn) {
 		newTile.more->onSpawn(plane_.getContext(), pos);
@@ -153,6 +131,68 @@ bool TileSystemImpl::setBackgroundIDWithoutUpdate(TilePos pos, Tile::ID id)
 	return true;
 }
 
+void TileSystemImpl::restoreID(TilePos pos, Tile::ID id)
+{
+	Chunk &chunk = plane_.getChunk(chunkPos(pos));
+	ChunkRelPos rp = chunkRelPos(pos);
+
+	Tile::ID old = chunk.getTileID(rp);
+	if (id == old) {
+		return;
+	}
+
+	Tile &newTile = plane_.world_->getTileByID(id);
+	Tile &oldTile = plane_.world_->getTileByID(old);
+
+	chunk.setTileID(rp, id);
+	updateLightsAndFluids(pos, chunk, rp, oldTile, newTile);
+}
+
+void TileSystemImpl::restoreBackgroundID(TilePos pos, Tile::ID id)
+{
+	Chunk &chunk = plane_.getChunk(chunkPos(pos));
+	chunk.setBackgroundTileID(chunkRelPos(pos), id);
+}
+
+void TileSystemImpl::journalTile(TilePos pos, Tile::ID id)
+{
+	if (auto *journal = plane_.world_->journal_) {
+		journal->setTile(plane_.id_, pos, id, plane_.world_->getTileByID(id).name);
+	}
+}
+
+void TileSystemImpl::updateLightsAndFluids(
+	TilePos pos, Chunk &chunk, ChunkRelPos rp, Tile &oldTile, Tile &newTile)
+{
+	if (!oldTile.isOpaque() && newTile.isOpaque()) {
+		plane_.lights().addSolidBlock(pos);
+	} else if (oldTile.isOpaque() && !newTile.isOpaque()) {
+		plane_.lights().removeSolidBlock(pos);
+	}
+
+	if (newTile.more->lightLevel != oldTile.more->lightLevel) {
+		if (oldTile.more->lightLevel > 0) {
+			plane_.lights().removeLight(pos, oldTile.more->lightLevel);
+		}
+
+		if (newTile.more->lightLevel > 0) {
+			plane_.lights().addLight(pos, newTile.more->lightLevel);
+		}
+	}
+
+	if (oldTile.more->fluidCollision && !newTile.more->fluidCollision) {
+		plane_.fluids().clearSolid(pos);
+	} else if (newTile.more->fluidCollision) {
+		plane_.fluids().setSolid(pos, *newTile.more->fluidCollision);
+	}
+
+	if (oldTile.more->fluidMask && !newTile.more->fluidMask) {
+		chunk.clearFluidMask(rp);
+	} else if (newTile.more->fluidMask) {
+		chunk.setFluidMask(rp, newTile.more->fluidMask);
+	}
+}
+
 Tile &TileSystemImpl::get(TilePos pos)
 {
 	return plane_.world_->getTileByID(getID(pos));
@@ -544,30 +584,54 @@ void TileSystemImpl::beginTick()
 	std::swap(scheduledBackgroundUpdatesA_, scheduledBackgroundUpdatesB_);
 }
 
-void TileSystemImpl::endTick()
+bool TileSystemImpl::endTick(RTDeadline deadline)
 {
 	auto ctx = plane_.getContext();
 
-	for (auto &pos: scheduledUpdatesB_) {
-		auto *tile = &get(pos);
-		if (tile->more->onTileUpdate) {
-			tile->more->onTileUpdate(ctx, pos);
+	// Updates scheduled while these run go in the 'A' buffers,
+	// so the 'B' buffers stay put between calls
+	size_t index = tickProgress_.updateIndex;
+	while (index < scheduledUpdatesB_.size()) {
+		for (size_t j = 0; j < 16 && index < scheduledUpdatesB_.size(); ++j) {
+			auto pos = scheduledUpdatesB_[index++];
+			auto *tile = &get(pos);
+			if (tile->more->onTileUpdate) {
+				tile->more->onTileUpdate(ctx, pos);
+			}
+
+			tile = &getBackground(pos);
+			if (tile->more->onTileUpdate) {
+				tile->more->onTileUpdate(ctx, pos);
+			}
 		}
 
-		tile = &getBackground(pos);
-		if (tile->more->onTileUpdate) {
-			tile->more->onTileUpdate(ctx, pos);
+		if (deadline.passed()) {
+			tickProgress_.updateIndex = index;
+			return false;
 		}
 	}
-	scheduledUpdatesB_.clear();
+	tickProgress_.updateIndex = index;
 
-	for (auto &pos: scheduledBackgroundUpdatesB_) {
-		auto *tile = maybeGetBackground(pos);
-		if (tile && tile->more->onTileUpdate) {
-			tile->more->onTileUpdate(ctx, pos);
+	index = tickProgress_.backgroundUpdateIndex;
+	while (index < scheduledBackgroundUpdatesB_.size()) {
+		for (size_t j = 0; j < 16 && index < scheduledBackgroundUpdatesB_.size(); ++j) {
+			auto pos = scheduledBackgroundUpdatesB_[index++];
+			auto *tile = maybeGetBackground(pos);
+			if (tile && tile->more->onTileUpdate) {
+				tile->more->onTileUpdate(ctx, pos);
+			}
+		}
+
+		if (deadline.passed()) {
+			tickProgress_.backgroundUpdateIndex = index;
+			return false;
 		}
 	}
+
+	scheduledUpdatesB_.clear();
 	scheduledBackgroundUpdatesB_.clear();
+	tickProgress_ = {};
+	return true;
 }
 
 }
@@ -0,0 +1,55 @@
+#include "ChunkBufferPool.h"
+
+#include "lib/test.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace Swan;
+
+TEST("Released chunk buffers get reused")
+{
+	ChunkBufferPool pool;
+	uint8_t *first;
+	{
+		auto buf = pool.allocate(1000);
+		first = buf.get();
+		memset(buf.get(), 0xff, 1000);
+		expecteq(pool.stats().buffersInUse, 1u);
+	}
+
+	expecteq(pool.stats().buffersInUse, 0u);
+	auto buf = pool.allocate(1000);
+	expect(buf.get() == first);
+}
+
+TEST("Chunk buffer pool tracks its high-water mark")
+{
+	ChunkBufferPool pool;
+	{
+		auto a = pool.allocate(4096);
+		auto b = pool.allocate(4096);
+		auto c = pool.allocate(20480);
+		expect(a.get() != b.get());
+		expecteq(pool.stats().bytesInUse, 4096u * 2 + 20480u);
+	}
+
+	expecteq(pool.stats().bytesInUse, 0u);
+	expecteq(pool.stats().highWaterBytes, 4096u * 2 + 20480u);
+	expecteq(pool.stats().slabBytes, ChunkBufferPool::SLAB_SIZE * 2);
+}
+
+TEST("Chunk buffers come from the same slab")
+{
+	ChunkBufferPool pool;
+	std::vector<ChunkBufferPool::Buffer> bufs;
+	for (int i = 0; i < 100; ++i) {
+		bufs.push_back(pool.allocate(20480));
+		memset(bufs.back().get(), i, 20480);
+	}
+
+	expecteq(pool.stats().slabBytes, ChunkBufferPool::SLAB_SIZE);
+	for (int i = 0; i < 100; ++i) {
+		expecteq(bufs[i][20479], i);
+	}
+}
@@ -0,0 +1,75 @@
+#include "ChunkIndex.h"
+
+#include "lib/test.h"
+
+using namespace Swan;
+
+TEST("Chunk index finds inserted chunks")
+{
+	ChunkBufferPool pool;
+	ChunkIndex index;
+	for (int y = -40; y < 40; y += 3) {
+		for (int x = -40; x < 40; x += 7) {
+			index.insert(Chunk({x, y}, pool));
+		}
+	}
+
+	expecteq(index.size(), 27u * 12u);
+	for (int y = -40; y < 40; ++y) {
+		for (int x = -40; x < 40; ++x) {
+			Chunk *chunk = index.find({x, y});
+			bool present = (y + 40) % 3 == 0 && (x + 40) % 7 == 0;
+			expecteq(chunk != nullptr, present);
+			if (chunk) {
+				expect(chunk->pos() == ChunkPos(x, y));
+			}
+		}
+	}
+}
+
+TEST("Chunk index keeps chunk addresses stable")
+{
+	ChunkBufferPool pool;
+	ChunkIndex index;
+	Chunk *first = &index.insert(Chunk({0, 0}, pool));
+	for (int i = 1; i < 2000; ++i) {
+		index.insert(Chunk({i * 13, -i * 5}, pool));
+	}
+
+	expect(index.find({0, 0}) == first);
+	expect(&index.insert(Chunk({0, 0}, pool)) == first);
+}
+
+TEST("Chunk index erase")
+{
+	ChunkBufferPool pool;
+	ChunkIndex index;
+	index.insert(Chunk({-1, -1}, pool));
+	index.insert(Chunk({-1, 0}, pool));
+
+	index.erase({-1, -1});
+	expect(!index.contains({-1, -1}));
+	expect(index.contains({-1, 0}));
+	expecteq(index.size(), 1u);
+
+	index.clear();
+	expecteq(index.size(), 0u);
+	expect(!index.contains({-1, 0}));
+}
+
+TEST("Chunk index caches notice erased chunks")
+{
+	ChunkBufferPool pool;
+	ChunkIndex index;
+	ChunkIndex::Cache cache;
+	Chunk *chunk = &index.insert(Chunk({5, 6}, pool));
+	expect(cache.find(index, {5, 6}) == chunk);
+	expect(cache.find(index, {5, 6}) == chunk);
+	expect(cache.find(index, {9, 6}) == nullptr);
+
+	index.erase({5, 6});
+	expect(cache.find(index, {5, 6}) == nullptr);
+
+	chunk = &index.insert(Chunk({9, 6}, pool));
+	expect(cache.find(index, {9, 6}) == chunk);
+}
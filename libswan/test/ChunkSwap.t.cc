@@ -0,0 +1,109 @@
+#include "ChunkSwap.h"
+
+#include "lib/test.h"
+
+#include <filesystem>
+#include <string.h>
+#include <vector>
+#include <swan/util.h>
+
+using namespace Swan;
+
+static std::vector<unsigned char> makePage(size_t words, unsigned char seed)
+{
+	std::vector<unsigned char> data(words * sizeof(uint64_t));
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (unsigned char)(seed + i);
+	}
+	return data;
+}
+
+static bool pageEquals(const ChunkSwap::Page &page, const std::vector<unsigned char> &data)
+{
+	return page.words.size() * sizeof(uint64_t) == data.size() &&
+		memcmp(page.words.data(), data.data(), data.size()) == 0;
+}
+
+TEST("Chunks round-trip through the swap")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-chunk-swap";
+	ChunkSwap swap;
+	swap.setPath(path);
+
+	auto a = makePage(10, 1);
+	auto b = makePage(3, 50);
+	expect(swap.put({1, 2}, a, true));
+	expect(swap.put({-3, 4}, b, false));
+	expect(swap.contains({1, 2}));
+	expecteq(swap.chunkCount(), 2);
+	expecteq(swap.stats().liveBytes, a.size() + b.size());
+	expecteq(swap.list().size(), 2);
+
+	auto page = swap.take({-3, 4});
+	expect(page.has_value());
+	expect(pageEquals(*page, b));
+	expect(!page->needsSave);
+	expect(!swap.contains({-3, 4}));
+	expect(!swap.take({-3, 4}).has_value());
+
+	page = swap.take({1, 2});
+	expect(page.has_value());
+	expect(pageEquals(*page, a));
+	expect(page->needsSave);
+	expecteq(swap.stats().evictions, 2);
+	expecteq(swap.stats().faults, 2);
+	expecteq(swap.stats().liveBytes, 0);
+
+	swap.close();
+	expect(!std::filesystem::exists(path));
+}
+
+TEST("Chunk swap reuses freed space")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-chunk-swap-reuse";
+	ChunkSwap swap;
+	swap.setPath(path);
+
+	auto big = makePage(8, 1);
+	auto small = makePage(2, 2);
+	expect(swap.put({0, 0}, big, true));
+	expect(swap.put({1, 0}, big, true));
+	size_t fileBytes = swap.stats().fileBytes;
+
+	// Two small chunks fit where the big one was
+	expect(swap.take({0, 0}).has_value());
+	expect(swap.put({2, 0}, small, true));
+	expect(swap.put({3, 0}, small, true));
+	expecteq(swap.stats().fileBytes, fileBytes);
+
+	auto page = swap.take({1, 0});
+	expect(page.has_value());
+	expect(pageEquals(*page, big));
+	page = swap.take({3, 0});
+	expect(page.has_value());
+	expect(pageEquals(*page, small));
+
+	// Data which isn't made of whole words isn't accepted
+	unsigned char odd[3] = {};
+	expect(!swap.put({4, 0}, odd, true));
+}
+
+TEST("Chunks which can't be read back stay in the swap")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-chunk-swap-fail";
+	ChunkSwap swap;
+	swap.setPath(path);
+
+	auto a = makePage(4, 1);
+	expect(swap.put({5, 5}, a, true));
+	size_t liveBytes = swap.stats().liveBytes;
+
+	// Cut the file short, as if the disk had lost it
+	std::filesystem::resize_file(path, 0);
+	expect(!swap.take({5, 5}).has_value());
+	expect(swap.contains({5, 5}));
+	expecteq(swap.stats().liveBytes, liveBytes);
+	expecteq(swap.stats().faults, 0);
+
+	swap.close();
+}
@@ -0,0 +1,62 @@
+#include "FluidActivityMap.h"
+
+#include "lib/test.h"
+
+using namespace Swan;
+
+TEST("Fluid activity map marks cells once")
+{
+	FluidActivityMap map;
+	expect(!map.contains({3, 4}));
+	expect(map.insert({3, 4}));
+	expect(!map.insert({3, 4}));
+	expect(map.contains({3, 4}));
+	expect(!map.contains({4, 3}));
+	expecteq(map.chunkCount(), 1u);
+}
+
+TEST("Fluid activity map keeps chunks apart")
+{
+	constexpr int W = FluidActivityMap::WIDTH;
+	constexpr int H = FluidActivityMap::HEIGHT;
+	FluidActivityMap map;
+
+	// Cells on either side of chunk borders, including negative ones
+	expect(map.insert({W - 1, 0}));
+	expect(map.insert({W, 0}));
+	expect(map.insert({-1, -1}));
+	expect(map.insert({0, H}));
+	expecteq(map.chunkCount(), 4u);
+
+	expect(map.contains({W - 1, 0}));
+	expect(map.contains({W, 0}));
+	expect(map.contains({-1, -1}));
+	expect(map.contains({0, H}));
+	expect(!map.contains({-W - 1, 0}));
+	expect(!map.contains({W * 2 - 1, H - 1}));
+	expect(!map.contains({0, 0}));
+
+	// Looking for cells mustn't make bitmaps for their chunks
+	expect(!map.contains({W * 10, H * 10}));
+	expecteq(map.chunkCount(), 4u);
+}
+
+TEST("Cleared fluid activity map is empty")
+{
+	FluidActivityMap map;
+	for (int i = 0; i < 1000; ++i) {
+		map.insert({i * 7, i * 3});
+	}
+
+	size_t chunks = map.chunkCount();
+	map.clear();
+	expecteq(map.chunkCount(), 0u);
+	for (int i = 0; i < 1000; ++i) {
+		expect(!map.contains({i * 7, i * 3}));
+	}
+
+	// The old bitmaps are reused
+	expect(map.insert({7, 3}));
+	expect(!map.insert({7, 3}));
+	expect(chunks > 1);
+}
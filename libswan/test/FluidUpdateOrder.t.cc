@@ -0,0 +1,76 @@
+#include "FluidUpdateOrder.h"
+
+#include "lib/test.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+using namespace Swan;
+
+static std::vector<FluidPos> makeUpdates()
+{
+	std::vector<FluidPos> updates;
+	for (int y = -40; y < 300; y += 3) {
+		for (int x = -300; x < 600; x += 7) {
+			updates.push_back({x, y});
+		}
+	}
+	return updates;
+}
+
+TEST("Fluid update order is a permutation")
+{
+	auto updates = makeUpdates();
+	auto shuffled = updates;
+	FluidUpdateOrder order;
+	order.shuffle(shuffled, 1234);
+	expect(shuffled != updates);
+
+	auto byPos = [](FluidPos a, FluidPos b) {
+		return a.y == b.y ? a.x < b.x : a.y < b.y;
+	};
+	std::sort(updates.begin(), updates.end(), byPos);
+	std::sort(shuffled.begin(), shuffled.end(), byPos);
+	expect(shuffled == updates);
+}
+
+TEST("Fluid updates are grouped by bucket")
+{
+	auto updates = makeUpdates();
+	FluidUpdateOrder order;
+	order.shuffle(updates, 99);
+
+	// Every bucket shows up as one run of updates
+	std::unordered_set<uint64_t> seen;
+	uint64_t current = FluidUpdateOrder::bucketOf(updates[0]);
+	seen.insert(current);
+	for (FluidPos pos: updates) {
+		uint64_t bucket = FluidUpdateOrder::bucketOf(pos);
+		if (bucket != current) {
+			expect(!seen.contains(bucket));
+			seen.insert(bucket);
+			current = bucket;
+		}
+	}
+	expect(seen.size() > 10);
+}
+
+TEST("Fluid update order depends on the seed")
+{
+	auto a = makeUpdates();
+	auto b = a;
+	FluidUpdateOrder order;
+	order.shuffle(a, 1);
+	order.shuffle(b, 2);
+	expect(a != b);
+
+	// Cells in different chunks or bands are in different buckets
+	constexpr int W = CHUNK_WIDTH * FLUID_RESOLUTION;
+	constexpr int BAND = FluidUpdateOrder::BAND_ROWS;
+	expecteq(FluidUpdateOrder::bucketOf({0, 0}), FluidUpdateOrder::bucketOf({W - 1, BAND - 1}));
+	expect(FluidUpdateOrder::bucketOf({0, 0}) != FluidUpdateOrder::bucketOf({W, 0}));
+	expect(FluidUpdateOrder::bucketOf({0, 0}) != FluidUpdateOrder::bucketOf({0, BAND}));
+	expect(FluidUpdateOrder::bucketOf({0, 0}) != FluidUpdateOrder::bucketOf({-1, 0}));
+	expect(FluidUpdateOrder::bucketOf({0, 0}) != FluidUpdateOrder::bucketOf({0, -1}));
+}
@@ -0,0 +1,108 @@
+#include "OS.h"
+
+#include "lib/test.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <vector>
+
+using namespace Swan;
+
+TEST("MappedFile maps the whole file")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-mapped-file";
+	std::vector<char> content(100000);
+	for (size_t i = 0; i < content.size(); ++i) {
+		content[i] = char(i * 7);
+	}
+
+	{
+		std::ofstream f(path, std::ios::binary);
+		f.write(content.data(), content.size());
+	}
+
+	OS::MappedFile file;
+	expect(file.open(path));
+	expecteq(file.size(), content.size());
+	expect(memcmp(file.data(), content.data(), content.size()) == 0);
+
+	// The mapping is page aligned
+	expecteq((uintptr_t)file.data() % 4096, 0);
+
+	// Moving hands over the mapping
+	OS::MappedFile other = std::move(file);
+	expect(file.data() == nullptr);
+	expecteq(other.size(), content.size());
+
+	other.close();
+	expect(other.data() == nullptr);
+	std::filesystem::remove(path);
+}
+
+TEST("MappedFile fails on missing and empty files")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-mapped-empty";
+	OS::MappedFile file;
+	expect(!file.open(path));
+
+	{
+		std::ofstream f(path, std::ios::binary);
+	}
+	expect(!file.open(path));
+	expect(file.data() == nullptr);
+	std::filesystem::remove(path);
+}
+
+TEST("writeFileDurably replaces the file")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-durable";
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << "old contents";
+	}
+
+	std::string a = "hello ", b = "world";
+	std::span<const unsigned char> parts[] = {
+		{(const unsigned char *)a.data(), a.size()},
+		{(const unsigned char *)b.data(), b.size()},
+	};
+	expect(OS::writeFileDurably(path, parts));
+	expect(!std::filesystem::exists(path.string() + ".tmp"));
+
+	OS::MappedFile file;
+	expect(file.open(path));
+	expecteq(std::string((const char *)file.data(), file.size()), "hello world");
+
+	file.close();
+	std::filesystem::remove(path);
+}
+
+TEST("AppendFile appends and cuts off the tail")
+{
+	auto path = std::filesystem::temp_directory_path() / "swan-test-append";
+	std::filesystem::remove(path);
+
+	std::string a = "hello", b = " world";
+	OS::AppendFile file;
+	expect(file.open(path));
+	expect(file.append({(const unsigned char *)a.data(), a.size()}));
+	expect(file.append({(const unsigned char *)b.data(), b.size()}));
+	expecteq(file.size(), 11);
+	file.close();
+	expect(!file.isOpen());
+
+	// Reopening keeps only what was asked for, and appends after it
+	expect(file.open(path, 5));
+	expecteq(file.size(), 5);
+	expect(file.append({(const unsigned char *)"!", 1}));
+	file.close();
+
+	OS::MappedFile mapped;
+	expect(mapped.open(path));
+	expecteq(std::string((const char *)mapped.data(), mapped.size()), "hello!");
+
+	mapped.close();
+	std::filesystem::remove(path);
+}
@@ -0,0 +1,108 @@
+#include "PaletteTileData.h"
+
+#include "lib/test.h"
+
+#include <vector>
+
+using namespace Swan;
+
+using ID = PaletteTileData::ID;
+
+TEST("Palette starts out as a single entry")
+{
+	PaletteTileData data(5);
+	expecteq(data.bitsPerTile(), 0);
+	expecteq(data.paletteSize(), 1u);
+	expecteq(data.get(0), 5);
+	expecteq(data.get(PaletteTileData::SIZE - 1), 5);
+}
+
+TEST("Palette widens when new IDs are set")
+{
+	PaletteTileData data(1);
+	data.set(10, 2);
+	expecteq(data.bitsPerTile(), 1);
+	expecteq(data.get(10), 2);
+	expecteq(data.get(11), 1);
+
+	data.set(11, 3);
+	expecteq(data.bitsPerTile(), 2);
+	data.set(12, 4);
+	expecteq(data.bitsPerTile(), 2);
+	data.set(13, 5);
+	expecteq(data.bitsPerTile(), 4);
+
+	expecteq(data.get(9), 1);
+	expecteq(data.get(10), 2);
+	expecteq(data.get(11), 3);
+	expecteq(data.get(12), 4);
+	expecteq(data.get(13), 5);
+	expecteq(data.get(14), 1);
+}
+
+TEST("Palette falls back to direct storage")
+{
+	std::vector<ID> input(PaletteTileData::SIZE);
+	for (size_t i = 0; i < input.size(); ++i) {
+		input[i] = ID(i * 7);
+	}
+
+	PaletteTileData data;
+	data.pack(input);
+	expecteq(data.bitsPerTile(), 16);
+	expecteq(data.paletteSize(), 0u);
+
+	std::vector<ID> output(PaletteTileData::SIZE);
+	data.unpack(output);
+	expect(input == output);
+
+	data.set(100, 65535);
+	expecteq(data.get(100), 65535);
+	expecteq(data.get(101), ID(101 * 7));
+}
+
+TEST("Round-trip palette pack/unpack")
+{
+	std::vector<ID> input(PaletteTileData::SIZE);
+	for (size_t i = 0; i < input.size(); ++i) {
+		input[i] = ID(1000 + (i / 3) % 100);
+	}
+
+	PaletteTileData data;
+	data.pack(input);
+	expecteq(data.bitsPerTile(), 8);
+	expecteq(data.paletteSize(), 100u);
+
+	std::vector<ID> output(PaletteTileData::SIZE);
+	data.unpack(output);
+	expect(input == output);
+
+	for (size_t i = 0; i < input.size(); ++i) {
+		expecteq(data.get(i), input[i]);
+	}
+}
+
+TEST("Re-packing drops unused palette entries")
+{
+	PaletteTileData data(1);
+	data.set(0, 2);
+	data.set(1, 3);
+	data.set(2, 4);
+	expecteq(data.paletteSize(), 4u);
+	expecteq(data.bitsPerTile(), 2);
+
+	// 2 and 3 are no longer used, but stay in the palette
+	data.set(0, 1);
+	data.set(1, 1);
+	expecteq(data.paletteSize(), 4u);
+
+	// Palette is full, setting a fifth ID re-packs
+	// and only keeps the IDs which are still in use
+	data.set(3, 5);
+	expecteq(data.paletteSize(), 3u);
+	expecteq(data.bitsPerTile(), 2);
+	expecteq(data.get(0), 1);
+	expecteq(data.get(2), 4);
+	expecteq(data.get(3), 5);
+	expecteq(data.get(4), 1);
+}
@@ -0,0 +1,97 @@
+#include "RegionFile.h"
+
+#include "lib/test.h"
+
+#include <capnp/message.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <swan/util.h>
+
+using namespace Swan;
+
+static std::filesystem::path tempRegionPath(const char *name)
+{
+	return std::filesystem::temp_directory_path() / cat("swan-test-", name, ".swr");
+}
+
+TEST("Region positions round down")
+{
+	expecteq(RegionFile::regionPos({0, 0}), RegionPos(0, 0));
+	expecteq(RegionFile::regionPos({31, 32}), RegionPos(0, 1));
+	expecteq(RegionFile::regionPos({-1, -32}), RegionPos(-1, -1));
+	expecteq(RegionFile::regionPos({-33, 64}), RegionPos(-2, 2));
+	expecteq(RegionFile::firstChunk({-2, 1}), ChunkPos(-64, 32));
+}
+
+TEST("Round-trip region file")
+{
+	std::vector<ChunkPos> positions = {{32, -32}, {40, -1}, {63, -20}};
+	auto path = tempRegionPath("round-trip");
+
+	RegionWriter writer;
+	for (size_t i = 0; i < positions.size(); ++i) {
+		capnp::MallocMessageBuilder mb;
+		auto chunk = mb.initRoot<proto::Chunk>();
+		chunk.initPos().setX(positions[i].x);
+		chunk.getPos().setY(positions[i].y);
+		chunk.setCompression(proto::Chunk::Compression::RLE);
+		auto data = chunk.initData(100 + i);
+		for (size_t j = 0; j < data.size(); ++j) {
+			data[j] = i + j;
+		}
+
+		writer.setChunk(positions[i], mb);
+	}
+	expect(writer.write(path));
+
+	RegionReader reader;
+	expect(reader.load(path));
+	expecteq(reader.chunkCount(), positions.size());
+
+	std::map<std::pair<int, int>, std::vector<uint8_t>> found;
+	reader.forEachChunk([&](proto::Chunk::Reader chunk) {
+		auto data = chunk.getData();
+		found[{chunk.getPos().getX(), chunk.getPos().getY()}] =
+			std::vector<uint8_t>(data.begin(), data.end());
+	});
+
+	expecteq(found.size(), positions.size());
+	for (size_t i = 0; i < positions.size(); ++i) {
+		auto &data = found[{positions[i].x, positions[i].y}];
+		expecteq(data.size(), 100 + i);
+		for (size_t j = 0; j < data.size(); ++j) {
+			expecteq(data[j], uint8_t(i + j));
+		}
+	}
+
+	std::filesystem::remove(path);
+}
+
+TEST("Region reader rejects bad files")
+{
+	RegionReader reader;
+	expect(!reader.load(tempRegionPath("does-not-exist")));
+
+	auto path = tempRegionPath("garbage");
+	{
+		std::ofstream f(path, std::ios::binary);
+		std::vector<char> garbage(20000, 'x');
+		f.write(garbage.data(), garbage.size());
+	}
+	expect(!reader.load(path));
+	expecteq(reader.chunkCount(), 0);
+
+	// A valid file which was cut short must not index past the end
+	RegionWriter writer;
+	capnp::MallocMessageBuilder mb;
+	auto chunk = mb.initRoot<proto::Chunk>();
+	chunk.initData(1000);
+	writer.setChunk({0, 0}, mb);
+	expect(writer.write(path));
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) - 64);
+	expect(!reader.load(path));
+
+	std::filesystem::remove(path);
+}
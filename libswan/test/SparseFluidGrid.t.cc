@@ -0,0 +1,109 @@
+#include "SparseFluidGrid.h"
+
+#include "lib/test.h"
+
+#include <vector>
+
+using namespace Swan;
+
+TEST("Sparse fluid grid starts out empty")
+{
+	SparseFluidGrid grid;
+	expecteq(grid.get({0, 0}), SparseFluidGrid::AIR);
+	expecteq(grid.get({SparseFluidGrid::WIDTH - 1, 10}), SparseFluidGrid::AIR);
+	expecteq(grid.getMemUsage(), 0u);
+}
+
+TEST("Uniform tiles don't allocate blocks")
+{
+	SparseFluidGrid grid;
+	grid.fillTile({3, 4}, SparseFluidGrid::SOLID);
+	expecteq(grid.blockCount(), 0u);
+	expect(grid.peekBlock({3, 4}) == nullptr);
+	expecteq(grid.get({3 * FLUID_RESOLUTION, 4 * FLUID_RESOLUTION}), SparseFluidGrid::SOLID);
+	expecteq(grid.get({3 * FLUID_RESOLUTION - 1, 4 * FLUID_RESOLUTION}), SparseFluidGrid::AIR);
+
+	grid.fillTile({3, 4}, 7);
+	expecteq(grid.blockCount(), 1u);
+	expecteq(grid.get({3 * FLUID_RESOLUTION + 1, 4 * FLUID_RESOLUTION + 2}), 7);
+
+	grid.fillTile({3, 4}, SparseFluidGrid::AIR);
+	expecteq(grid.blockCount(), 0u);
+	expecteq(grid.get({3 * FLUID_RESOLUTION + 1, 4 * FLUID_RESOLUTION + 2}), SparseFluidGrid::AIR);
+}
+
+TEST("Writing one cell allocates a block for its tile")
+{
+	SparseFluidGrid grid;
+	grid.fillTile({1, 1}, SparseFluidGrid::SOLID);
+
+	uint8_t *cell = grid.getForWrite({5, 6});
+	expecteq(*cell, SparseFluidGrid::SOLID);
+	*cell = 9;
+	expecteq(grid.blockCount(), 1u);
+	expecteq(grid.get({5, 6}), 9);
+	expecteq(grid.get({4, 4}), SparseFluidGrid::SOLID);
+
+	// Allocating lots of other blocks mustn't move the first one
+	for (int x = 10; x < SparseFluidGrid::WIDTH; x += FLUID_RESOLUTION) {
+		grid.set({x, 20}, 3);
+	}
+	expecteq(*cell, 9);
+
+	*cell = SparseFluidGrid::SOLID;
+	grid.collapseTile({1, 1});
+	expect(grid.peekBlock({1, 1}) == nullptr);
+	expecteq(grid.get({5, 6}), SparseFluidGrid::SOLID);
+}
+
+TEST("Round-trip sparse fluid grid pack/unpack")
+{
+	std::vector<uint8_t> input(SparseFluidGrid::SIZE, SparseFluidGrid::AIR);
+	for (int y = 100; y < 120; ++y) {
+		for (int x = 0; x < SparseFluidGrid::WIDTH; ++x) {
+			input[y * SparseFluidGrid::WIDTH + x] = SparseFluidGrid::SOLID;
+		}
+	}
+	input[50 * SparseFluidGrid::WIDTH + 77] = 5;
+	input[51 * SparseFluidGrid::WIDTH + 78] = 6 | 0x40;
+
+	SparseFluidGrid grid;
+	grid.pack(input);
+	expecteq(grid.blockCount(), 1u);
+
+	std::vector<uint8_t> output(SparseFluidGrid::SIZE);
+	grid.unpack(output);
+	expect(input == output);
+}
+
+TEST("Packing an all-solid chunk needs no memory")
+{
+	std::vector<uint8_t> input(SparseFluidGrid::SIZE, SparseFluidGrid::SOLID);
+
+	SparseFluidGrid grid;
+	grid.pack(input);
+	expecteq(grid.getMemUsage(), 0u);
+	expecteq(grid.get({123, 45}), SparseFluidGrid::SOLID);
+}
+
+TEST("Unpacking rows only touches those rows")
+{
+	constexpr int W = SparseFluidGrid::WIDTH;
+	SparseFluidGrid grid;
+	grid.set({10, 5 * FLUID_RESOLUTION + 1}, 7);
+	grid.set({20, 9 * FLUID_RESOLUTION}, 8);
+
+	std::vector<uint8_t> output(SparseFluidGrid::SIZE, 0xff);
+	grid.unpackRows(output, 5, 6);
+	expecteq(output[(5 * FLUID_RESOLUTION + 1) * W + 10], 7);
+	expecteq(output[(5 * FLUID_RESOLUTION) * W + 10], SparseFluidGrid::AIR);
+	expecteq(output[(6 * FLUID_RESOLUTION) * W + 10], 0xff);
+	expecteq(output[(9 * FLUID_RESOLUTION) * W + 20], 0xff);
+	expecteq(output[(5 * FLUID_RESOLUTION) * W - 1], 0xff);
+
+	// A grid with nothing allocated is filled in too
+	SparseFluidGrid empty;
+	empty.unpackRows(output, 9, 10);
+	expecteq(output[(9 * FLUID_RESOLUTION) * W + 20], SparseFluidGrid::AIR);
+	expecteq(output[(10 * FLUID_RESOLUTION) * W + 20], 0xff);
+}
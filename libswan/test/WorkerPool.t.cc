@@ -0,0 +1,62 @@
+#include "WorkerPool.h"
+
+#include "lib/test.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Swan;
+
+TEST("Worker pool runs every job")
+{
+	WorkerPool pool(3);
+	std::atomic<int> sum = 0;
+	std::vector<WorkerPool::JobPtr> jobs;
+	for (int i = 1; i <= 100; ++i) {
+		jobs.push_back(pool.submit([&sum, i] { sum += i; }));
+	}
+
+	for (auto &job: jobs) {
+		job->wait();
+		expect(job->done());
+	}
+
+	expecteq(sum.load(), 5050);
+	expecteq(pool.pendingJobs(), 0u);
+}
+
+TEST("Destroying a worker pool finishes queued jobs")
+{
+	std::atomic<int> count = 0;
+	{
+		WorkerPool pool(1);
+		for (int i = 0; i < 50; ++i) {
+			pool.submit([&] { count += 1; });
+		}
+	}
+
+	expecteq(count.load(), 50);
+}
+
+TEST("Worker pool jobs keep what they threw")
+{
+	WorkerPool pool(2);
+	auto bad = pool.submit([] { throw std::runtime_error("corrupt"); });
+	auto good = pool.submit([] {});
+	bad->wait();
+	good->wait();
+
+	expect(bad->failed());
+	expect(!good->failed());
+
+	std::string what;
+	try {
+		bad->rethrow();
+	} catch (std::runtime_error &err) {
+		what = err.what();
+	}
+	expecteq(what, "corrupt");
+	expecteq(pool.pendingJobs(), 0u);
+}
@@ -0,0 +1,121 @@
+#include "WorldJournal.h"
+
+#include "lib/test.h"
+
+#include <filesystem>
+#include <swan/util.h>
+
+using namespace Swan;
+
+static std::filesystem::path tempWorldPath(const char *name)
+{
+	return std::filesystem::temp_directory_path() / cat("swan-test-", name, ".swan");
+}
+
+TEST("Round-trip journal")
+{
+	auto worldPath = tempWorldPath("journal");
+	auto path = WorldJournal::path(worldPath, 3);
+
+	WorldJournal journal;
+	expect(journal.open(path, 3));
+	journal.setTile(0, {1, -2}, 10, "core::stone");
+	journal.setBackground(1, {3, 4}, 10, "core::stone");
+	journal.setFluid(0, {5, 6}, WorldJournal::FluidOp::REPLACE, 4, "core::water");
+	expect(journal.flush());
+
+	unsigned char data[] = {1, 2, 3};
+	journal.spawnEntity(0, "core::item-stack", 42, data);
+	journal.despawnEntity(0, "core::item-stack", 41);
+	journal.spawnTileEntity(2, {7, 8}, "core::chest");
+	journal.despawnTileEntity(2, {7, 8});
+	expect(journal.pendingBytes() > 0);
+	journal.close();
+
+	auto contents = WorldJournal::read(path);
+	expect(contents.has_value());
+	expecteq(contents->epoch, 3);
+	expecteq(contents->validSize, std::filesystem::file_size(path));
+
+	using Type = WorldJournal::RecordType;
+	auto &recs = contents->records;
+	expecteq(recs.size(), 7);
+	expect(recs[0].type == Type::SET_TILE);
+	expecteq(recs[0].pos, TilePos(1, -2));
+	expecteq(recs[0].name, "core::stone");
+	expect(recs[1].type == Type::SET_BACKGROUND);
+	expecteq(recs[1].plane, 1);
+	expecteq(recs[1].name, "core::stone");
+	expect(recs[2].type == Type::SET_FLUID);
+	expect(recs[2].fluidOp == WorldJournal::FluidOp::REPLACE);
+	expecteq(recs[2].name, "core::water");
+	expect(recs[3].type == Type::SPAWN_ENTITY);
+	expecteq(recs[3].id, 42);
+	expecteq(recs[3].data.size(), 3);
+	expecteq(recs[3].data[2], 3);
+	expect(recs[4].type == Type::DESPAWN_ENTITY);
+	expecteq(recs[4].name, "core::item-stack");
+	expect(recs[5].type == Type::SPAWN_TILE_ENTITY);
+	expecteq(recs[5].name, "core::chest");
+	expect(recs[6].type == Type::DESPAWN_TILE_ENTITY);
+	expecteq(recs[6].pos, TilePos(7, 8));
+
+	std::filesystem::remove(path);
+}
+
+TEST("Journal drops a torn batch and keeps appending")
+{
+	auto worldPath = tempWorldPath("journal-torn");
+	auto path = WorldJournal::path(worldPath, 0);
+
+	WorldJournal journal;
+	expect(journal.open(path, 0));
+	journal.setTile(0, {1, 1}, 5, "core::dirt");
+	expect(journal.flush());
+	journal.setTile(0, {2, 2}, 6, "core::grass");
+	expect(journal.flush());
+	journal.close();
+
+	// Cut the last batch short, like a crash in the middle of a write would
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+
+	auto contents = WorldJournal::read(path);
+	expect(contents.has_value());
+	expecteq(contents->records.size(), 1);
+	expecteq(contents->records[0].name, "core::dirt");
+
+	// Resuming cuts off the torn batch, and has to name tiles again
+	expect(journal.open(path, 0, contents->validSize));
+	journal.setTile(0, {3, 3}, 6, "core::grass");
+	journal.close();
+
+	contents = WorldJournal::read(path);
+	expect(contents.has_value());
+	expecteq(contents->records.size(), 2);
+	expecteq(contents->records[1].pos, TilePos(3, 3));
+	expecteq(contents->records[1].name, "core::grass");
+
+	std::filesystem::remove(path);
+}
+
+TEST("Find journals by epoch")
+{
+	auto worldPath = tempWorldPath("journal-find");
+	for (auto &[epoch, path]: WorldJournal::find(worldPath)) {
+		std::filesystem::remove(path);
+	}
+
+	WorldJournal journal;
+	expect(journal.open(WorldJournal::path(worldPath, 10), 10));
+	expect(journal.open(WorldJournal::path(worldPath, 2), 2));
+	journal.close();
+
+	auto journals = WorldJournal::find(worldPath);
+	expecteq(journals.size(), 2);
+	expecteq(journals[0].first, 2);
+	expecteq(journals[1].first, 10);
+
+	for (auto &[epoch, path]: journals) {
+		std::filesystem::remove(path);
+	}
+}
@@ -0,0 +1,48 @@
+#include "gzip.h"
+
+#include "lib/test.h"
+
+#include <vector>
+
+using namespace Swan;
+
+TEST("Round-trip gzip")
+{
+	std::vector<uint8_t> input;
+	for (int i = 0; i < 100000; ++i) {
+		input.push_back((i / 100) % 7);
+	}
+
+	for (int level = GZIP_LEVEL_FASTEST; level <= GZIP_LEVEL_BEST; ++level) {
+		std::vector<uint8_t> compressed;
+		gzipEncode(compressed, input, level);
+		expect(compressed.size() < input.size() / 10);
+
+		std::vector<uint8_t> output;
+		expect(gzipDecode(output, compressed));
+		expect(output == input);
+	}
+}
+
+TEST("gzip appends to the output")
+{
+	std::vector<uint8_t> input = {1, 2, 3, 4};
+	std::vector<uint8_t> compressed = {0xaa};
+	gzipEncode(compressed, input, GZIP_LEVEL_FASTEST);
+	expecteq(compressed[0], 0xaa);
+
+	std::vector<uint8_t> output = {9};
+	expect(gzipDecode(output, std::span(compressed).subspan(1)));
+	expect(output == std::vector<uint8_t>({9, 1, 2, 3, 4}));
+}
+
+TEST("gzip rejects truncated input")
+{
+	std::vector<uint8_t> input(5000, 42);
+	std::vector<uint8_t> compressed;
+	gzipEncode(compressed, input, GZIP_LEVEL_BEST);
+	compressed.resize(compressed.size() / 2);
+
+	std::vector<uint8_t> output;
+	expect(!gzipDecode(output, compressed));
+}
@@ -2,7 +2,10 @@
 
 #include "lib/test.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <iterator>
 #include <span>
 #include <vector>
 #include <cstring>
@@ -50,3 +53,165 @@ TEST("Round-trip RLE16SRO")
 	expecteq(rleDecode16SRO(too_small_output, output), 12);
 	expect(memcmp(input, too_small_output, 6) == 0);
 }
+
+// The straightforward encoders which the optimized ones replaced,
+// to make sure the output format stays exactly the same
+static void referenceEncode8(std::vector<uint8_t> &out, std::span<const uint8_t> in)
+{
+	for (size_t i = 0; i < in.size();) {
+		size_t len = 1;
+		while (i + len < in.size() && in[i + len] == in[i] && len < 256) {
+			len += 1;
+		}
+		out.push_back(in[i]);
+		out.push_back(len - 1);
+		i += len;
+	}
+}
+
+static void referenceEncode16SRO(std::vector<uint8_t> &out, std::span<const uint16_t> in)
+{
+	for (size_t i = 0; i < in.size();) {
+		size_t len = 1;
+		while (i + len < in.size() && in[i + len] == in[i] && len < 257) {
+			len += 1;
+		}
+		uint16_t val = len == 1 ? in[i] | 0x8000 : in[i] & ~0x8000;
+		out.push_back(val & 0xff);
+		out.push_back(val >> 8);
+		if (len > 1) {
+			out.push_back(len - 2);
+		}
+		i += len;
+	}
+}
+
+// Random data made up of runs of random lengths,
+// biased towards the lengths where the encoders change behaviour
+template<typename T>
+static std::vector<T> randomRuns(uint32_t &rng, size_t size, T maxVal)
+{
+	static const size_t interesting[] = {1, 2, 15, 16, 17, 31, 32, 33, 255, 256, 257, 258, 1000};
+
+	std::vector<T> data;
+	while (data.size() < size) {
+		rng = rng * 1664525 + 1013904223;
+		size_t len = (rng >> 16) % 2 == 0
+			? interesting[(rng >> 8) % std::size(interesting)]
+			: (rng >> 8) % 40 + 1;
+		rng = rng * 1664525 + 1013904223;
+		T val = T((rng >> 8) % (size_t(maxVal) + 1));
+		for (size_t i = 0; i < len && data.size() < size; ++i) {
+			data.push_back(val);
+		}
+	}
+	return data;
+}
+
+TEST("Fuzz round-trip RLE8")
+{
+	uint32_t rng = 1;
+	for (int iter = 0; iter < 500; ++iter) {
+		size_t size = iter < 40 ? iter : (rng >> 4) % 20000;
+		auto input = randomRuns<uint8_t>(rng, size, iter % 2 ? 3 : 255);
+
+		std::vector<uint8_t> encoded;
+		rleEncode8(encoded, input);
+		std::vector<uint8_t> reference;
+		referenceEncode8(reference, input);
+		expect(encoded == reference);
+
+		std::vector<uint8_t> decoded(input.size());
+		expecteq(rleDecode8(decoded, encoded), input.size());
+		expect(decoded == input);
+	}
+}
+
+TEST("Fuzz round-trip RLE16SRO")
+{
+	uint32_t rng = 2;
+	for (int iter = 0; iter < 500; ++iter) {
+		size_t size = iter < 40 ? iter : (rng >> 4) % 20000;
+		auto input = randomRuns<uint16_t>(rng, size, iter % 2 ? 3 : 0x7fff);
+
+		std::vector<uint8_t> encoded;
+		rleEncode16SRO(encoded, input);
+		std::vector<uint8_t> reference;
+		referenceEncode16SRO(reference, input);
+		expect(encoded == reference);
+
+		std::vector<uint16_t> decoded(input.size());
+		expecteq(rleDecode16SRO(decoded, encoded), input.size());
+		expect(decoded == input);
+
+		// Decoding into a too small buffer mustn't write out of bounds
+		if (input.size() > 10) {
+			std::vector<uint16_t> small(input.size() / 3);
+			expecteq(rleDecode16SRO(small, encoded), input.size());
+			expect(std::equal(small.begin(), small.end(), input.begin()));
+		}
+	}
+}
+
+TEST("RLE decoders handle empty and truncated input")
+{
+	uint8_t out8[4];
+	uint16_t out16[4];
+	expecteq(rleDecode8(out8, std::span<const uint8_t>()), 0u);
+	expecteq(rleDecode16SRO(out16, std::span<const uint8_t>()), 0u);
+
+	// A normal run whose length byte is missing
+	const uint8_t truncated[] = {5, 0};
+	expecteq(rleDecode16SRO(out16, truncated), 0u);
+}
+
+TEST("RLE throughput")
+{
+	uint32_t rng = 3;
+	auto bytes = randomRuns<uint8_t>(rng, 1 << 20, 3);
+	auto shorts = randomRuns<uint16_t>(rng, 1 << 19, 3);
+	std::vector<uint8_t> enc8, enc16;
+	std::vector<uint8_t> dec8(bytes.size());
+	std::vector<uint16_t> dec16(shorts.size());
+
+	auto mbps = [](size_t bytes, auto start) {
+		auto end = std::chrono::steady_clock::now();
+		double sec = std::chrono::duration<double>(end - start).count();
+		return bytes / (1024.0 * 1024.0) / sec;
+	};
+
+	constexpr int ROUNDS = 20;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; ++i) {
+		enc8.clear();
+		rleEncode8(enc8, bytes);
+	}
+	double encode8 = mbps(bytes.size() * ROUNDS, start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; ++i) {
+		rleDecode8(dec8, enc8);
+	}
+	double decode8 = mbps(bytes.size() * ROUNDS, start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; ++i) {
+		enc16.clear();
+		rleEncode16SRO(enc16, shorts);
+	}
+	double encode16 = mbps(shorts.size() * 2 * ROUNDS, start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; ++i) {
+		rleDecode16SRO(dec16, enc16);
+	}
+	double decode16 = mbps(shorts.size() * 2 * ROUNDS, start);
+
+	expect(dec8 == bytes);
+	expect(dec16 == shorts);
+	std::cerr
+		<< "\n    RLE8:     encode " << int(encode8) << " MB/s, decode "
+		<< int(decode8) << " MB/s\n"
+		<< "    RLE16SRO: encode " << int(encode16) << " MB/s, decode "
+		<< int(decode16) << " MB/s\n";
+}
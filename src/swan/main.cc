@@ -1,4 +1,6 @@
 #include "swan/Clock.h"
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <random>
 #include <sstream>
@@ -132,6 +134,8 @@ int main(int argc, char **argv)
 	const char *swanRoot = ".";
 	bool doCompileMods = true;
 	const char *thumbnailPath = nullptr;
+	bool paletteTiles = false;
+	std::optional<std::pair<ChunkPos, ChunkPos>> pregenRange;
 	for (int i = 1; i < argc; ++i) {
 		std::string_view arg = argv[i];
 		if (arg == "--mod") {
@@ -151,6 +155,19 @@ int main(int argc, char **argv)
 		} else if (arg == "--seed") {
 			i += 1;
 			seedArg = uint32_t(std::stoul(argv[i]));
+		} else if (arg == "--palette-tiles") {
+			paletteTiles = true;
+		} else if (arg == "--pregen") {
+			i += 1;
+			ChunkPos from, to;
+			if (sscanf(argv[i], "%d,%d,%d,%d", &from.x, &from.y, &to.x, &to.y) != 4) {
+				panic << "Expected --pregen <x1>,<y1>,<x2>,<y2> (in chunks)";
+				return 1;
+			}
+			pregenRange = {
+				{std::min(from.x, to.x), std::min(from.y, to.y)},
+				{std::max(from.x, to.x), std::max(from.y, to.y)},
+			};
 		} else {
 			warn << "Unexpected option: " << arg;
 		}
@@ -244,6 +261,9 @@ int main(int argc, char **argv)
 
 	// Create the game and mod list
 	Game game(compileMods);
+	if (paletteTiles) {
+		game.chunkTileStorage_ = Chunk::TileStorage::PALETTE;
+	}
 
 	// Load or create world
 	if (std::filesystem::exists(worldPath)) {
@@ -264,6 +284,27 @@ int main(int argc, char **argv)
 		game.createWorld(worldPath, "core::default", seed, mods);
 	}
 
+	// Pre-generating a world, for example for a server, doesn't run the game
+	if (pregenRange) {
+		auto [from, to] = *pregenRange;
+		info << "Pre-generating chunks " << from << " to " << to << "...";
+
+		RTClock genClock;
+		size_t count = game.world_->currentPlane().pregenerate(from, to);
+		double genTime = genClock.duration();
+
+		RTClock saveClock;
+		game.save();
+		double saveTime = saveClock.duration();
+
+		info
+			<< "Generated " << count << " chunks in " << genTime << "s ("
+			<< size_t(count / std::max(genTime, 0.001)) << " chunks/s), saved in "
+			<< saveTime << "s (" << size_t(count / std::max(saveTime, 0.001))
+			<< " chunks/s)";
+		return 0;
+	}
+
 #ifndef SWAN_HEADLESS
 	gameptr = &game;
 	glfwSetKeyCallback(window, keyCallback);